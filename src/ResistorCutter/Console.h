@@ -0,0 +1,180 @@
+/*
+ * Non-blocking, table-driven command console for controlling the cutter over a serial port
+ *
+ * Nathaniel Baird
+ * bairdn@oregonstate.edu
+ *
+ * Started:      10/18/2026
+ * Last updated: 10/18/2026
+ */
+
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+#include <Arduino.h>
+
+#define CONSOLE_LINE_MAX 64 // Longest accepted command line, including the terminating NUL
+#define CONSOLE_MAX_ARGS 6  // Most whitespace-separated tokens parsed from one line
+#define CONSOLE_REPLY_MAX 96 // Longest formatted ok()/error() message
+
+class Console;
+
+/**
+ * @brief One entry in the console's command table
+ *
+ * @note `argv[0]` is the command name itself; tokens are NUL-terminated in place and only valid during the call
+ */
+struct ConsoleCommand {
+    const char *name;
+    const char *usage;
+    void (*handler)(Console &console, int argc, char *argv[]);
+};
+
+class Console {
+    private:
+        Stream               &stream;
+        const ConsoleCommand *commands;
+        uint8_t               numCommands;
+        char                  line[CONSOLE_LINE_MAX];
+        uint8_t               length;
+        bool                  overflowed, machine;
+
+        /**
+         * @brief Prints a reply in the current response mode
+         *
+         * @param prefix The machine-mode status word (OK/ERR)
+         * @param human  What to print before the message in human mode (may be empty)
+         */
+        void reply(const char *prefix, const char *human, const char *fmt, va_list args) {
+            char message[CONSOLE_REPLY_MAX] = "";
+            if(fmt) vsnprintf(message, sizeof(message), fmt, args);
+
+            if(machine) {
+                stream.print(prefix);
+                if(*message) stream.print(' ');
+            } else {
+                if(!*message) return;
+                stream.print(human);
+            }
+            stream.println(message);
+        }
+
+        /**
+         * @brief Splits the assembled line into tokens & calls the matching command's handler
+         */
+        void dispatch() {
+            char *argv[CONSOLE_MAX_ARGS];
+            int   argc = 0;
+
+            for(char *token = strtok(line, " \t"); token; token = strtok(NULL, " \t")) {
+                if(argc == CONSOLE_MAX_ARGS) {
+                    error("too many arguments");
+                    return;
+                }
+                argv[argc++] = token;
+            }
+            if(!argc) return;
+
+            if(!strcasecmp(argv[0], "mode")) {
+                if(argc == 2 && !strcasecmp(argv[1], "machine")) machine = true;
+                else if(argc == 2 && !strcasecmp(argv[1], "human")) machine = false;
+                else return error("usage: mode <human|machine>");
+                return ok(machine ? NULL : "Human-readable responses");
+            }
+
+            if(!strcasecmp(argv[0], "help")) {
+                for(uint8_t i = 0; i < numCommands; i++) {
+                    stream.printf("%s%-10s %s\n", machine ? "# " : "", commands[i].name, commands[i].usage);
+                }
+                stream.printf("%s%-10s %s\n", machine ? "# " : "", "mode", "<human|machine>");
+                return ok(NULL);
+            }
+
+            for(uint8_t i = 0; i < numCommands; i++) {
+                if(!strcasecmp(argv[0], commands[i].name)) {
+                    commands[i].handler(*this, argc, argv);
+                    return;
+                }
+            }
+
+            error("unknown command '%s' (try 'help')", argv[0]);
+        }
+
+    public:
+        /**
+         * @param stream      The serial port (or any other Stream) to read commands from & reply to
+         * @param commands    The command table
+         * @param numCommands How many entries are in `commands`
+         */
+        Console(Stream &stream, const ConsoleCommand *commands, uint8_t numCommands)
+            : stream(stream), commands(commands), numCommands(numCommands) {
+                length = 0;
+                overflowed = machine = false;
+        }
+
+        /**
+         * @brief Consumes whatever bytes have already arrived & runs any lines they complete
+         *
+         * @note Never waits on the stream, so it's safe to call from every pass of loop()
+         */
+        void poll() {
+            while(stream.available()) {
+                char c = stream.read();
+
+                if(c == '\r') continue;
+
+                if(c == '\n') {
+                    line[length] = '\0';
+                    if(overflowed) error("line longer than %d characters", CONSOLE_LINE_MAX - 1);
+                    else dispatch();
+
+                    length = 0;
+                    overflowed = false;
+                } else if(length < CONSOLE_LINE_MAX - 1) {
+                    line[length++] = c;
+                } else {
+                    overflowed = true;
+                }
+            }
+        }
+
+        /**
+         * @return Whether replies should be terse & machine-parseable ("OK ..."/"ERR ...")
+         */
+        bool isMachineMode() {
+            return machine;
+        }
+
+        /**
+         * @return The stream replies are printed to, for commands that print more than one line
+         */
+        Print &out() {
+            return stream;
+        }
+
+        /**
+         * @brief Reports success; prints "OK <message>" in machine mode or just the message in human mode
+         *
+         * @param fmt printf-style format for the message, or NULL for none
+         */
+        void ok(const char *fmt, ...) {
+            va_list args;
+            va_start(args, fmt);
+            reply("OK", "", fmt, args);
+            va_end(args);
+        }
+
+        /**
+         * @brief Reports a failure; prints "ERR <message>" in machine mode or "Error: <message>" in human mode
+         *
+         * @param fmt printf-style format for the message
+         */
+        void error(const char *fmt, ...) {
+            va_list args;
+            va_start(args, fmt);
+            reply("ERR", "Error: ", fmt, args);
+            va_end(args);
+        }
+};
+
+#endif
@@ -5,7 +5,7 @@
  * bairdn@oregonstate.edu
  *
  * Started:      07/11/2023
- * Last updated: 07/18/2023
+ * Last updated: 10/18/2026
  */
 
 /***********************************************************************************************************\
@@ -28,12 +28,21 @@
 \***********************************************************************************************************/
 
 #include <Adafruit_PCD8544.h> // Version 2.0.1 -- For LCD screen
+#include "Profiler.h"         // For timing LCD flushes
 
 class Display {
     private:
         // 14chars x 6chars, 84px x 48px
         Adafruit_PCD8544 display;
 
+        /**
+         * @brief Pushes the frame buffer out to the LCD over SPI
+         */
+        void flush() {
+            PROFILE_SCOPE("lcd.flush");
+            display.display();
+        }
+
     public:
         /**
          * @param sclk The ESP32 pin connected to the Nokia display's CLK pin
@@ -103,7 +112,7 @@ class Display {
             }
             display.print(number);
             
-            display.display();
+            flush();
         }
 
         /** 
@@ -139,7 +148,7 @@ class Display {
             }
             display.print(number);
             
-            display.display();
+            flush();
         }
 
         /** 
@@ -189,7 +198,7 @@ class Display {
             \***********************************************************************************************************/
             display.invertRect(5, 25, percent*75/100, 9);
             
-            display.display();
+            flush();
         }
 
         /**
@@ -217,7 +226,7 @@ class Display {
                 display.print("Start");
             }
             
-            display.display();
+            flush();
         }
 
         /**
@@ -238,6 +247,6 @@ class Display {
             display.setCursor(0, 17);
             display.print("Safety switch flipped;      please resolve\nthe issue!");
 
-            display.display();
+            flush();
         }
 };
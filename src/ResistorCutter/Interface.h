@@ -5,13 +5,17 @@
  * bairdn@oregonstate.edu
  *
  * Started:      07/12/2023
- * Last updated: 07/18/2023
+ * Last updated: 10/18/2026
  */
 
 #include "Display.h"      // For LCD screen
 #include "Joystick.h"     // For joystick control
 #include "SafetySwitch.h" // For detecting an emergency interrupt
 #include "LocalHost.h"    // For sending info to connected devices
+#include "Telemetry.h"    // For logging state changes
+
+#define MAX_R_PER_KIT 10 // Most resistors that can be cut per kit
+#define MAX_KITS      50 // Most kits that can be cut in one job
 
 class Interface {
 private:
@@ -176,7 +180,7 @@ public:
      * @param paused Whether the device is paused
      */
     void setPausedStatus(bool paused) {
-        log_i("Detected pause change! Now %s\n", paused ? "pausing" : prevRunning ? "resuming" : "waiting to start");
+        Telemetry::get().log(TLM_PAUSE, paused, running);
         if(paused) {
             if(running != 2) prevRunning = running;
             running = 2;
@@ -203,6 +207,72 @@ public:
         }
     }
 
+    /**
+     * @brief Starts the machine as if the Start button had been pressed
+     *
+     * @note Calls `callbackFn`, so this doesn't return until the job does
+     *
+     * @return false if the machine is already running or paused
+     */
+    bool start() {
+        if(running != 0) return false;
+
+        running = 1;
+        display.updateAll(currentSelection, rPerKit, kits, percent, running);
+        localHost.updatePageInfo(rPerKit, kits, running);
+
+        callbackFn(running);
+        return true;
+    }
+
+    /**
+     * @brief Stops the current job; if paused, the job stays stopped once the pause is resolved
+     *
+     * @note Unlike the Stop button, this doesn't call `callbackFn` -- the running job sees getRunningStatus() change
+     *
+     * @return false if no job is running
+     */
+    bool stop() {
+        if(running == 0 || (running == 2 && prevRunning == 0)) return false;
+
+        if(running == 2) {
+            prevRunning = 0;
+        } else {
+            running = 0;
+            display.updateAll(currentSelection, rPerKit, kits, percent, running);
+            localHost.updatePageInfo(rPerKit, kits, running);
+        }
+        return true;
+    }
+
+    /**
+     * @param rPerKit The desired number of resistors for each kit, from 1 to MAX_R_PER_KIT
+     *
+     * @return false if out of range or the machine isn't idle
+     */
+    bool setResistorsPerKit(int rPerKit) {
+        if(running != 0 || rPerKit < 1 || rPerKit > MAX_R_PER_KIT) return false;
+
+        this->rPerKit = rPerKit;
+        display.updateAll(currentSelection, this->rPerKit, kits, percent, running);
+        localHost.updatePageInfo(this->rPerKit, kits, running);
+        return true;
+    }
+
+    /**
+     * @param kits The number of kits to cut resistors for, from 1 to MAX_KITS
+     *
+     * @return false if out of range or the machine isn't idle
+     */
+    bool setKits(int kits) {
+        if(running != 0 || kits < 1 || kits > MAX_KITS) return false;
+
+        this->kits = kits;
+        display.updateAll(currentSelection, rPerKit, this->kits, percent, running);
+        localHost.updatePageInfo(rPerKit, this->kits, running);
+        return true;
+    }
+
     /**
      * @return The desired number of resistors for each kit
      */
@@ -216,6 +286,13 @@ public:
     int getKits() {
         return kits;
     }
+
+    /**
+     * @return The completion percentage of the current job
+     */
+    int getPercent() {
+        return percent;
+    }
     
     /**
      * @brief The current running status is 0 if not running, 1 if running, or 2 if paused
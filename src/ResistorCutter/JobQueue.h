@@ -0,0 +1,80 @@
+/*
+ * Fixed-capacity FIFO of cutting jobs waiting to run after the current one
+ *
+ * Nathaniel Baird
+ * bairdn@oregonstate.edu
+ *
+ * Started:      10/18/2026
+ * Last updated: 10/18/2026
+ */
+
+#ifndef JOB_QUEUE_H
+#define JOB_QUEUE_H
+
+#define JOB_QUEUE_SIZE 8 // Most jobs that can wait in the queue at once
+
+struct Job {
+    uint8_t rPerKit, kits;
+};
+
+class JobQueue {
+    private:
+        Job     jobs[JOB_QUEUE_SIZE];
+        uint8_t head, count;
+
+    public:
+        JobQueue() : head(0), count(0) {}
+
+        /**
+         * @brief Adds a job to the back of the queue
+         *
+         * @return false if the queue is full
+         */
+        bool push(uint8_t rPerKit, uint8_t kits) {
+            if(count == JOB_QUEUE_SIZE) return false;
+
+            jobs[(head + count++) % JOB_QUEUE_SIZE] = {rPerKit, kits};
+            return true;
+        }
+
+        /**
+         * @brief Removes the job at the front of the queue
+         *
+         * @param job Where to copy the removed job
+         *
+         * @return false if the queue is empty
+         */
+        bool pop(Job &job) {
+            if(!count) return false;
+
+            job = jobs[head];
+            head = (head + 1) % JOB_QUEUE_SIZE;
+            count--;
+            return true;
+        }
+
+        /**
+         * @param i The position in the queue, 0 being the next job to run
+         *
+         * @return The job at position `i`
+         */
+        const Job &at(uint8_t i) const {
+            return jobs[(head + i) % JOB_QUEUE_SIZE];
+        }
+
+        /**
+         * @return How many jobs are waiting
+         */
+        uint8_t size() const {
+            return count;
+        }
+
+        /**
+         * @brief Discards every waiting job
+         */
+        void clear() {
+            head = count = 0;
+        }
+};
+
+#endif
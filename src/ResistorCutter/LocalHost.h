@@ -9,7 +9,7 @@
  * bairdn@oregonstate.edu
  *
  * Started:      07/12/2023
- * Last updated: 07/18/2023
+ * Last updated: 10/18/2026
  */
 
 /**
@@ -28,8 +28,9 @@
 #include <DNSServer.h>
 #include <ESPAsyncWebServer.h> // --- https://github.com/me-no-dev/ESPAsyncWebServer using the latest dev version from @me-no-dev
 #include <esp_wifi.h>		   // --- Used for mpdu_rx_disable android workaround
-#include "esp32-hal-timer.h"   // Used for timer interrupt to automatically update DNS server
 #include "Webpages.h"
+#include "Profiler.h"          // For serving control loop timings
+#include "Telemetry.h"         // For logging served pages & redirects
 
 // --- Pre reading on the fundamentals of captive portals https://textslashplain.com/2022/06/24/captive-portals/
 
@@ -39,7 +40,9 @@
 #define MAX_CLIENTS 1	// --- Define the maximum number of clients that can connect to the server -- ESP32 supposedly supports up to 10
                         // WARNING: Set to 1 to allow proper handling of captive portal escape for JS
 #define WIFI_CHANNEL 6	// --- 2.4ghz channel 6 https://en.wikipedia.org/wiki/List_of_WLAN_channels#2.4_GHz_(802.11b/g/n/ax)
-#define DNS_INTERVAL 30 // --- Define the DNS interval in milliseconds between processing DNS requests
+
+#define WEB_WORKERS 1   // AsyncTCP tasks serving web clients -- the handlers below share state, so they MUST stay on 1 task
+#define WEB_CORE (ARDUINO_RUNNING_CORE ? 0 : 1) // Keep web traffic off the core running loop() (the motion & UI loop)
 
 class LocalHost {
     private: 
@@ -53,26 +56,25 @@ class LocalHost {
         AsyncWebServer server;
         bool portalOpened;
 
+        // Fixed replies to the captive-portal probes, serialised once in setUpWebserver()
+        AsyncPreparedResponse portalRedirect;  // 302 to localIPURL
+        AsyncPreparedResponse logoutRedirect;  // 302 to http://logout.net
+        AsyncPreparedResponse notFound;
+        AsyncPreparedResponse ok;
+
+        AsyncEventSource statusEvents;  // Pushes the status page's values to open pages
+        AsyncWebTopic *status;          // Latest status, so slow clients skip to it instead of queueing every update
+        int percent;                    // Last job percentage, republished with every status
+
         Webpages webpages;
 
-        /**
-         * @brief Calls the correct object's update() method
-         * 
-         * @note Timer interrupt callback requires a static fn when calling a class method, but allows passing `this`
-         *
-         * @param thisArg The object `this` to call the update() method for
-         */
-        static void handleUpdateTimer(void *thisArg) {
-            LocalHost *obj = (LocalHost *)thisArg;
-            obj->update();
-        }
-    
         /**
          * @author CD_FER
          *
          * @brief Sets initial setings for the DNS server, forwarding all traffic to the specified IP address
          *
          * @note Necessary for redirecting the initial (captive-portal-checking) request
+         * @note Queries are answered by the DNS server's own task as soon as they arrive, so nothing needs to poll it
          *
          * @param dnsServer The DNSServer object to set up
          * @param localIP   The IP address to forward all traffic to
@@ -81,6 +83,7 @@ class LocalHost {
             // --- Set the TTL for DNS response and start the DNS server
             dnsServer.setTTL(3600);
             dnsServer.start(53, "*", localIP);
+            dnsServer.startTask();
         }
 
         /**
@@ -132,53 +135,73 @@ class LocalHost {
             // --- SAFARI (IOS) there is a 128KB limit to the size of the HTML. The HTML can reference external resources/images that bring the total over 128KB
             // --- SAFARI (IOS) popup browser has some severe limitations (javascript disabled, cookies disabled)
 
+            portalRedirect.addHeader("Location", localIPURL);
+            logoutRedirect.addHeader("Location", "http://logout.net");
+
             // --- Required
-            server.on("/connecttest.txt", [&](AsyncWebServerRequest *request) { request->redirect("http://logout.net"); });	// --- windows 11 captive portal workaround
-            server.on("/wpad.dat", [&](AsyncWebServerRequest *request) { request->send(404); });								// --- Honestly don't understand what this is but a 404 stops win 10 keep calling this repeatedly and panicking the esp32 :)
+            server.on("/connecttest.txt", [&](AsyncWebServerRequest *request) { request->send(logoutRedirect); });	// --- windows 11 captive portal workaround
+            server.on("/wpad.dat", [&](AsyncWebServerRequest *request) { request->send(notFound); });				// --- Honestly don't understand what this is but a 404 stops win 10 keep calling this repeatedly and panicking the esp32 :)
 
             // --- Background responses: Probably not all are Required, but some are. Others might speed things up?
             // --- A Tier (commonly used by modern systems)
-            server.on("/generate_204", [&](AsyncWebServerRequest *request) { request->redirect(localIPURL); });		   // --- android captive portal redirect
-            server.on("/redirect", [&](AsyncWebServerRequest *request) { request->redirect(localIPURL); });			   // --- microsoft redirect
-            server.on("/hotspot-detect.html", [&](AsyncWebServerRequest *request) { request->redirect(localIPURL); }); // --- apple call home
-            server.on("/canonical.html", [&](AsyncWebServerRequest *request) { request->redirect(localIPURL); });	   // --- firefox captive portal call home
-            server.on("/success.txt", [&](AsyncWebServerRequest *request) { request->send(200); });					   // --- firefox captive portal call home
-            server.on("/ncsi.txt", [&](AsyncWebServerRequest *request) { request->redirect(localIPURL); });			   // --- windows call home
+            server.on("/generate_204", [&](AsyncWebServerRequest *request) { request->send(portalRedirect); });		   // --- android captive portal redirect
+            server.on("/redirect", [&](AsyncWebServerRequest *request) { request->send(portalRedirect); });			   // --- microsoft redirect
+            server.on("/hotspot-detect.html", [&](AsyncWebServerRequest *request) { request->send(portalRedirect); }); // --- apple call home
+            server.on("/canonical.html", [&](AsyncWebServerRequest *request) { request->send(portalRedirect); });	   // --- firefox captive portal call home
+            server.on("/success.txt", [&](AsyncWebServerRequest *request) { request->send(ok); });					   // --- firefox captive portal call home
+            server.on("/ncsi.txt", [&](AsyncWebServerRequest *request) { request->send(portalRedirect); });			   // --- windows call home
 
             // --- return 404 to webpage icon
-            server.on("/favicon.ico", [&](AsyncWebServerRequest *request) { request->send(404); });	// webpage icon
+            server.on("/favicon.ico", [&](AsyncWebServerRequest *request) { request->send(notFound); });	// webpage icon
+
+            // Serve the control loop timings as JSON
+            server.on("/api/metrics", HTTP_GET, [&](AsyncWebServerRequest *request) {
+                AsyncResponseStream *response = request->beginResponseStream("application/json");
+                response->addHeader("Cache-Control", "no-store");
+                Profiler::get().printJSON(*response);
+                request->send(response);
+            }).setCompression();
+
+            // Serve the AsyncTCP event packet pool's counters as JSON
+            server.on("/api/async-tcp", HTTP_GET, [&](AsyncWebServerRequest *request) {
+                async_event_pool_stats_t stats;
+                async_tcp_event_pool_stats(&stats);
+
+                AsyncResponseStream *response = request->beginResponseStream("application/json");
+                response->addHeader("Cache-Control", "no-store");
+                response->printf("{\"eventPool\":{\"size\":%u,\"free\":%u,\"hits\":%u,\"misses\":%u},\"coalesced\":%u}",
+                    stats.size, stats.free, (unsigned)stats.hits, (unsigned)stats.misses, (unsigned)stats.coalesced);
+                request->send(response);
+            });
+
+            // Serve the web server's request arena counters & how fragmented the heap is as JSON
+            server.on("/api/web", HTTP_GET, [&](AsyncWebServerRequest *request) {
+                AsyncWebArenaStats stats;
+                AsyncWebArena::getStats(stats);
+
+                AsyncResponseStream *response = request->beginResponseStream("application/json");
+                response->addHeader("Cache-Control", "no-store");
+                response->printf("{\"arena\":{\"size\":%u,\"allocs\":%u,\"fallbacks\":%u,\"heapAllocs\":%u,\"peak\":%u},",
+                    ASYNCWEBSERVER_ARENA_SIZE, (unsigned)stats.allocs, (unsigned)stats.fallbacks, (unsigned)stats.heapAllocs, (unsigned)stats.peak);
+                response->printf("\"heap\":{\"free\":%u,\"minFree\":%u,\"largestBlock\":%u}}",
+                    (unsigned)ESP.getFreeHeap(), (unsigned)ESP.getMinFreeHeap(), (unsigned)ESP.getMaxAllocHeap());
+                request->send(response);
+            });
 
-            // Serve the appropriate webpage
-            server.on("/", HTTP_ANY, [&](AsyncWebServerRequest *request) {this->processRequest(request);});
+            // Stream status updates; each client only gets the newest one its connection has room for
+            server.addHandler(&statusEvents);
+            status = statusEvents.topic("status");
+
+            // Serve the appropriate webpage, compressed as the soft-AP's airtime is the bottleneck
+            server.on("/", HTTP_ANY, [&](AsyncWebServerRequest *request) {this->processRequest(request);}).setCompression();
 
             // --- the catch all
             server.onNotFound([&](AsyncWebServerRequest *request) {
-                request->redirect(localIPURL);
-                Serial.print("onnotfound ");
-                Serial.print(request->host());
-                Serial.print(" ");
-                Serial.print(request->url());
-                Serial.print(" sent redirect to " + localIPURL + "\n");
+                request->send(portalRedirect);
+                Telemetry::get().log(TLM_REDIRECT, 0, (uint32_t)request->client()->remoteIP(), request->url().length());
             });
         }
 
-        /**
-         * @brief Sets a timer interrupt to update the DNS server every 20ms
-         *
-         * @note Allows "set and forget" treatment while still updating the DNS server
-         */
-        void setUpTimerInterrupt() {
-            // CREDIT/INFO: https://github.com/espressif/arduino-esp32/issues/8422
-            esp_timer_handle_t dnsTimer;
-            esp_timer_create_args_t timerConfig;
-            timerConfig.arg = this;
-            timerConfig.callback = reinterpret_cast<esp_timer_cb_t>(handleUpdateTimer);
-            timerConfig.dispatch_method = ESP_TIMER_TASK;
-            timerConfig.name = "DNS_Timer";
-            esp_timer_create(&timerConfig, &dnsTimer);
-            esp_timer_start_periodic(dnsTimer, 20000); // Call update() to update dnsServer every 20ms
-        }
-        
         /**
          * @brief Processes client requests & sends the appropriate HTML page response
          *
@@ -187,53 +210,36 @@ class LocalHost {
          * @param request The object containing info about the request to respond to
          */
         void processRequest(AsyncWebServerRequest *request) {
-            log_v("Recieved HTTP request");
-            log_v("Requested host: ");
-            log_v(request->host());
-            log_v("; URL requested: ");
-            log_v(request->url());
-            log_v("; Parameters:\n");
-
             if(request->host().indexOf("citrix") > -1) {
-                request->send(404);
+                request->send(notFound);
+                Telemetry::get().log(TLM_PAGE_SERVED, 3, request->params());
                 return;
             } // Tell Citrix there's no connection
 
-            for(int i = 0; i < request->params(); i++) {
-                AsyncWebParameter* param = request->getParam(i);
-                log_v("    Name: %s; Value: %s", param->name().c_str(), param->value().c_str());
-                param->name(); // Needed to prove to the IDE that `param` is used
-            }
-
             if(request->hasParam("redirect")) {
                 portalOpened = true;
-                AsyncWebServerResponse *response = request->beginResponse(200, "text/html", webpages.getMainHTML());
+                AsyncWebServerResponse *response = request->beginResponse(200, "text/html", webpages.getMainTemplate(),
+                    [&](uint8_t id, char *value, size_t maxLen) { return webpages.fillMainValue(id, value, maxLen); });
                 response->addHeader("Cache-Control", "public,no-store");  // don't save this file to cache
                 request->send(response);
-                log_d("Served Main HTML Page\n");
+                Telemetry::get().log(TLM_PAGE_SERVED, 2, request->params());
             } else if(portalOpened) {
                 AsyncWebServerResponse *response = request->beginResponse(200, "text/html", webpages.getSuccessHTML());
                 response->addHeader("Cache-Control", "public,no-store");  // don't save this file to cache
                 request->send(response);
-                log_d("Served Success HTML Page\n");
+                Telemetry::get().log(TLM_PAGE_SERVED, 1, request->params());
             } else {
                 AsyncWebServerResponse *response = request->beginResponse(200, "text/html", webpages.getCaptiveHTML());
                 response->addHeader("Cache-Control", "public,no-store");  // don't save this file to cache
                 request->send(response);
-                log_d("Served Captive HTML Page\n");
+                Telemetry::get().log(TLM_PAGE_SERVED, 0, request->params());
             }
         }
 
-        /**
-         * @brief Allows the DNS server to process its next request
-         */
-        void update() {
-            dnsServer.processNextRequest();	 // --- I call this atleast every 10ms in my other projects (can be higher but I haven't tested it for stability)
-        }
-
     public:
         LocalHost() : localIP(4, 3, 2, 1), gatewayIP(4, 3, 2, 1), subnetMask(255, 255, 255, 0), 
-            localIPURL("http://4.3.2.1/"), server(80) {
+            localIPURL("http://4.3.2.1/"), server(80), portalRedirect(302), logoutRedirect(302), notFound(404), ok(200),
+            statusEvents("/api/status"), status(NULL), percent(0) {
                 portalOpened = false;
         }
 
@@ -241,9 +247,8 @@ class LocalHost {
          * @brief Sets up everything that can't happen in the constructor:
          *     - Starts the WiFi AP
          *     - Starts the DNS server
-         *     - Starts the web server
+         *     - Starts the web server (on the core loop() isn't using)
          *     - Sets the event handlers
-         *     - Sets a timer interrupt to update the DNS server
          *
          * @warning Setup fn is MANDATORY & MUST be run AFTER the .ino setup() fn begins to prevent obscure issues when setting up WiFi AP
          */
@@ -253,16 +258,18 @@ class LocalHost {
             setUpDNSServer(dnsServer, localIP);
 
             setUpWebserver(server, localIP);
+            async_tcp_set_workers(WEB_WORKERS, WEB_CORE);
             server.begin();
 
             WiFi.onEvent([&](WiFiEvent_t event, WiFiEventInfo_t info) {portalOpened = false;}, ARDUINO_EVENT_WIFI_AP_STADISCONNECTED);
-
-            setUpTimerInterrupt();
         }
 
         /**
          * @brief Passes updated values to Webpages.h to update the next-generated status page's data
          *
+         * @note Also publishes them as JSON to the "status" event on /api/status; publishing only replaces
+         *       the topic's value, so updates faster than a client can take them don't pile up
+         *
          * @param rPerKit How many resistors per kit are currently wanted
          * @param kits    How many kits are currently wanted
          * @param running The current running state (see Interface.h)
@@ -272,6 +279,19 @@ class LocalHost {
             webpages.setRPerKit(rPerKit);
             webpages.setKits(kits);
             webpages.setRunning(running);
-            if(percent != -1) webpages.setPercent(percent);
+            if(percent != -1) {
+                webpages.setPercent(percent);
+                this->percent = percent;
+            }
+
+            if(status != NULL) {
+                // 42 fixed chars plus four ints of up to 11 chars each
+                char json[42 + 4 * 11 + 1];
+                int len = snprintf(json, sizeof(json), "{\"rPerKit\":%d,\"kits\":%d,\"running\":%d,\"percent\":%d}",
+                    rPerKit, kits, running, this->percent);
+                if(len > 0) {
+                    status->publish(json, min((size_t)len, sizeof(json) - 1));
+                }
+            }
         }
 };
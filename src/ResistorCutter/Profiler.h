@@ -0,0 +1,238 @@
+/*
+ * Lightweight cycle-counter profiler for timing named sections of the control loop
+ *
+ * Nathaniel Baird
+ * bairdn@oregonstate.edu
+ *
+ * Started:      10/18/2026
+ * Last updated: 10/18/2026
+ */
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#if defined(ARDUINO_ARCH_ESP32)
+#include <Arduino.h>     // For ESP.getCycleCount() & Print
+#else
+#include <x86intrin.h>   // For __rdtsc() in the host build
+#endif
+
+#ifndef PROFILER_ENABLED
+#define PROFILER_ENABLED 1   // Set to 0 to compile every PROFILE_SCOPE() down to nothing
+#endif
+
+#define PROFILER_MAX_SCOPES 8    // Maximum number of distinct named scopes
+#define PROFILER_SUB_BITS   2    // Histogram sub-buckets per power of two = 2^PROFILER_SUB_BITS (~19% resolution)
+#define PROFILER_BUCKETS    ((32 - PROFILER_SUB_BITS + 1) << PROFILER_SUB_BITS)
+
+class Profiler {
+    private:
+        struct Scope {
+            const char *name;
+            uint32_t    count, min, max;
+            uint64_t    total;
+            uint32_t    histogram[PROFILER_BUCKETS];
+        };
+
+        Scope   scopes[PROFILER_MAX_SCOPES];
+        uint8_t numScopes;
+
+        Profiler() : numScopes(0) {}
+
+        /**
+         * @brief Resets a scope's statistics to their empty state
+         */
+        static void clear(Scope &s) {
+            s.count = s.max = 0;
+            s.min   = UINT32_MAX;
+            s.total = 0;
+            memset(s.histogram, 0, sizeof(s.histogram));
+        }
+
+        /**
+         * @brief Maps a cycle count onto a log-linear histogram bucket (exact below 2^PROFILER_SUB_BITS)
+         */
+        static uint16_t bucketOf(uint32_t cycles) {
+            if(cycles < (1u << PROFILER_SUB_BITS)) return cycles;
+
+            uint8_t msb = 31 - __builtin_clz(cycles);
+            uint8_t exp = msb - PROFILER_SUB_BITS + 1;
+            uint8_t sub = (cycles >> (msb - PROFILER_SUB_BITS)) & ((1u << PROFILER_SUB_BITS) - 1);
+            return (exp << PROFILER_SUB_BITS) + sub;
+        }
+
+        /**
+         * @return The largest cycle count that falls into `bucket`
+         */
+        static uint32_t bucketMax(uint16_t bucket) {
+            if(bucket < (1u << PROFILER_SUB_BITS)) return bucket;
+
+            uint8_t  exp   = bucket >> PROFILER_SUB_BITS;
+            uint8_t  sub   = bucket & ((1u << PROFILER_SUB_BITS) - 1);
+            uint32_t lower = ((1u << PROFILER_SUB_BITS) + sub) << (exp - 1);
+            return lower + ((1u << (exp - 1)) - 1);
+        }
+
+        /**
+         * @return Converts a cycle count to microseconds using the current CPU frequency
+         */
+        static float toMicros(uint32_t cycles) {
+        #if defined(ARDUINO_ARCH_ESP32)
+            return (float)cycles / ESP.getCpuFreqMHz();
+        #else
+            return (float)cycles;
+        #endif
+        }
+
+    public:
+        Profiler(Profiler const &) = delete;
+        Profiler &operator=(Profiler const &) = delete;
+
+        /**
+         * @return The single profiler shared by every scope in the sketch
+         */
+        static Profiler &get() {
+            static Profiler instance;
+            return instance;
+        }
+
+        /**
+         * @return The CPU's free-running cycle counter
+         *
+         * @note The counter is 32 bits wide, so a single scope may not last longer than ~17s at 240MHz
+         */
+        static inline uint32_t cycles() {
+        #if defined(ARDUINO_ARCH_ESP32)
+            return ESP.getCycleCount();
+        #else
+            return (uint32_t)__rdtsc();
+        #endif
+        }
+
+        /**
+         * @brief Finds or creates the slot for a named scope
+         *
+         * @param name A string literal naming the scope (the pointer is kept, not copied)
+         *
+         * @return The scope's ID, or PROFILER_MAX_SCOPES if every slot is taken
+         */
+        uint8_t registerScope(const char *name) {
+            for(uint8_t i = 0; i < numScopes; i++) {
+                if(!strcmp(scopes[i].name, name)) return i;
+            }
+            if(numScopes == PROFILER_MAX_SCOPES) return PROFILER_MAX_SCOPES;
+
+            scopes[numScopes].name = name;
+            clear(scopes[numScopes]);
+            return numScopes++;
+        }
+
+        /**
+         * @brief Adds one sample to a scope's statistics
+         *
+         * @warning Only call from the loop() task; readers on other tasks may see a partially-updated sample
+         *
+         * @param id     The ID returned by registerScope()
+         * @param cycles How many CPU cycles the scope took
+         */
+        void record(uint8_t id, uint32_t cycles) {
+            if(id >= numScopes) return;
+
+            Scope &s = scopes[id];
+            if(cycles < s.min) s.min = cycles;
+            if(cycles > s.max) s.max = cycles;
+            s.total += cycles;
+            s.count++;
+            s.histogram[bucketOf(cycles)]++;
+        }
+
+        /**
+         * @brief Clears the statistics of every scope, keeping their names & IDs
+         */
+        void reset() {
+            for(uint8_t i = 0; i < numScopes; i++) clear(scopes[i]);
+        }
+
+        /**
+         * @param id       The scope to look up
+         * @param fraction The percentile to find, from 0 to 1 (eg 0.99 for p99)
+         *
+         * @return An upper bound (in cycles) on the requested percentile of the scope's samples
+         */
+        uint32_t percentile(uint8_t id, float fraction) const {
+            const Scope &s = scopes[id];
+            if(!s.count) return 0;
+
+            uint32_t target = (uint32_t)(s.count * fraction + 0.5f), seen = 0;
+            if(target == 0) target = 1;
+
+            for(uint16_t b = 0; b < PROFILER_BUCKETS; b++) {
+                seen += s.histogram[b];
+                if(seen >= target) return bucketMax(b) < s.max ? bucketMax(b) : s.max;
+            }
+            return s.max;
+        }
+
+        /**
+         * @brief Prints a human-readable table of every scope's timings (in microseconds)
+         *
+         * @param out Where to print the table (eg Serial)
+         */
+        void printTable(Print &out) const {
+            out.printf("%-18s %8s %9s %9s %9s %9s\n", "scope", "count", "min_us", "avg_us", "p99_us", "max_us");
+            for(uint8_t i = 0; i < numScopes; i++) {
+                const Scope &s = scopes[i];
+                out.printf("%-18s %8u %9.1f %9.1f %9.1f %9.1f\n", s.name, (unsigned)s.count,
+                    toMicros(s.count ? s.min : 0), s.count ? toMicros(s.total / s.count) : 0.0f,
+                    toMicros(percentile(i, 0.99f)), toMicros(s.max));
+            }
+        }
+
+        /**
+         * @brief Prints every scope's timings (in microseconds) as a JSON object keyed by scope name
+         *
+         * @param out Where to print the JSON (eg an AsyncResponseStream)
+         */
+        void printJSON(Print &out) const {
+            out.print('{');
+            for(uint8_t i = 0; i < numScopes; i++) {
+                const Scope &s = scopes[i];
+                out.printf("%s\"%s\":{\"count\":%u,\"min_us\":%.1f,\"avg_us\":%.1f,\"p99_us\":%.1f,\"max_us\":%.1f}",
+                    i ? "," : "", s.name, (unsigned)s.count,
+                    toMicros(s.count ? s.min : 0), s.count ? toMicros(s.total / s.count) : 0.0f,
+                    toMicros(percentile(i, 0.99f)), toMicros(s.max));
+            }
+            out.print('}');
+        }
+};
+
+/**
+ * @brief Times the enclosing block & records it under its scope's ID when the block exits
+ */
+class ProfileScope {
+    private:
+        uint8_t  id;
+        uint32_t start;
+
+    public:
+        ProfileScope(uint8_t id) : id(id), start(Profiler::cycles()) {}
+        ~ProfileScope() {
+            Profiler::get().record(id, Profiler::cycles() - start);
+        }
+};
+
+#define PROFILER_CONCAT_(a, b) a##b
+#define PROFILER_CONCAT(a, b)  PROFILER_CONCAT_(a, b)
+
+#if PROFILER_ENABLED
+/**
+ * @brief Times the rest of the enclosing block under `name` (a string literal)
+ */
+#define PROFILE_SCOPE(name) \
+    static const uint8_t PROFILER_CONCAT(profileId_, __LINE__) = Profiler::get().registerScope(name); \
+    ProfileScope PROFILER_CONCAT(profileScope_, __LINE__)(PROFILER_CONCAT(profileId_, __LINE__))
+#else
+#define PROFILE_SCOPE(name)
+#endif
+
+#endif
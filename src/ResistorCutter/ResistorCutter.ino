@@ -5,7 +5,7 @@
  * bairdn@oregonstate.edu
  *
  * Started:      07/10/2023
- * Last updated: 07/18/2023
+ * Last updated: 10/18/2026
  */
 
 /**
@@ -14,70 +14,253 @@
 
 #include "pins.h"       // List of all pin connections
 #include "Interface.h"  // For I/O using the LCD and joystick
-
-Interface interface(CLK_PIN, DIN_PIN, DC_PIN, CE_PIN, RST_PIN, VRx_PIN, VRy_PIN, SW_PIN, SAFE_PIN);
+#include "Profiler.h"   // For timing the control loop
+#include "Console.h"    // For accepting commands over the Serial interface
+#include "JobQueue.h"   // For jobs waiting to run after the current one
+#include "Telemetry.h"  // For streaming diagnostic events over the Serial interface
 
 void handleStateChange(int state);
-void checkPause(void);
+
+void cmdPause(Console &console, int argc, char *argv[]);
+void cmdResume(Console &console, int argc, char *argv[]);
+void cmdSet(Console &console, int argc, char *argv[]);
+void cmdStart(Console &console, int argc, char *argv[]);
+void cmdStop(Console &console, int argc, char *argv[]);
+void cmdStatus(Console &console, int argc, char *argv[]);
+void cmdMetrics(Console &console, int argc, char *argv[]);
+void cmdQueue(Console &console, int argc, char *argv[]);
+void cmdTelemetry(Console &console, int argc, char *argv[]);
+
+const ConsoleCommand commands[] = {
+    {"pause",     "                      Pause the machine",                         cmdPause},
+    {"resume",    "                      Resume after a pause",                      cmdResume},
+    {"set",       "<kits|rPerKit> <n>    Change a setting while idle",               cmdSet},
+    {"start",     "                      Start a job with the current settings",     cmdStart},
+    {"stop",      "                      Stop the current job",                      cmdStop},
+    {"status",    "                      Show the machine's state & settings",       cmdStatus},
+    {"metrics",   "[reset]               Show (or clear) control loop timings",      cmdMetrics},
+    {"queue",     "<add R K|list|clear>  Manage jobs to run after the current one",  cmdQueue},
+    {"telemetry", "<on|off>              Stream binary diagnostic events",           cmdTelemetry},
+};
+
+Interface interface(CLK_PIN, DIN_PIN, DC_PIN, CE_PIN, RST_PIN, VRx_PIN, VRy_PIN, SW_PIN, SAFE_PIN);
+Console   console(Serial, commands, sizeof(commands) / sizeof(commands[0]));
+JobQueue  jobQueue;
+bool      startRequested = false; // Set by the console; the job is started from loop() so the command can reply first
 
 void setup() {
     Serial.begin(115200);
     while(!Serial); // Wait for serial port to connect
     Serial.println("\n\nResistor cutter, compiled " __DATE__ " " __TIME__ " by bairdn");
+    Serial.println("Type 'help' for a list of commands");
+
+    Telemetry::get().begin();
 
     interface.setup();
     interface.setButtonListener(handleStateChange);
 }
 
 void loop() {
-    interface.update();
+    {
+        PROFILE_SCOPE("interface.update");
+        interface.update();
+    }
 
-    checkPause();
-}
+    {
+        PROFILE_SCOPE("console.poll");
+        console.poll();
+    }
 
-/**
- * @brief Checks if the user passed a pause/resume command through the Serial interface
- */
-void checkPause(void) {
-    if(Serial.available()) {
-        String input = Serial.readStringUntil('\n');
-
-        if(input.equalsIgnoreCase("pause")) {
-            interface.setPausedStatus(true);
-        } else if(input.equalsIgnoreCase("resume")) {
-            interface.setPausedStatus(false);
-        }
+    if(startRequested) {
+        startRequested = false;
+        interface.start();
     }
 }
 
 /**
  * @brief Handles UI button press (start/stop the machine)
- *     - Prints diagnostic info based on running state
+ *     - Logs the new running state & progress to Telemetry.h
  *     - Gradually fills the progress bar when the resistor cutter is started
+ *     - Queues the next job (if any) once this one finishes
  *
  * @param state The current running state: 0 for stopped, 1 for running, 2 for paused
  */
 void handleStateChange(int state) {
-    Serial.printf("Button pressed! Machine is %s.", interface.getRunningStatus() ? "on" : "off");
-    if(state == 2) {
-        // Shouldn't be possible
-        Serial.println("\nERR: Somehow, handleStateChange() was called while paused");
-    } else if(state == 1) {
-        Serial.printf(" Cutting groups of %d resistors for %d kits.\n", interface.getResistorsPerKit(), interface.getKits());
-    } else {
-        Serial.println();
-        return;
-    }
+    Telemetry::get().log(TLM_STATE_CHANGE, state, interface.getResistorsPerKit(), interface.getKits());
+    if(state != 1) return; // state == 2 shouldn't be possible
 
     for(int i = 0; i <= 100; i++) {
-        interface.update(i);// call function to update completion bar
+        {
+            PROFILE_SCOPE("cutIteration");
+            interface.update(i);// call function to update completion bar
 
-        if(interface.getRunningStatus() == 2) i--;
-        checkPause();
+            if(interface.getRunningStatus() == 2) i--;
+            else Telemetry::get().log(TLM_PROGRESS, i);
+            console.poll();
+        }
+
+        if(interface.getRunningStatus() == 0) break; // Stopped by the button or the console
 
         delay(50);
     }
 
+    bool finished = interface.getRunningStatus() != 0;
+    Telemetry::get().log(TLM_JOB_DONE, finished);
+
     // Have to tell Interface.h that the machine is no longer running
     interface.doneRunning();
+
+    Job next;
+    if(finished && jobQueue.pop(next)) {
+        interface.setResistorsPerKit(next.rPerKit);
+        interface.setKits(next.kits);
+        startRequested = true;
+    }
+}
+
+/**
+ * @brief Parses a whole base-10 integer
+ *
+ * @return false if `text` isn't entirely a number
+ */
+bool parseNumber(const char *text, int &value) {
+    char *end;
+    long parsed = strtol(text, &end, 10);
+    if(end == text || *end != '\0') return false;
+
+    value = parsed;
+    return true;
+}
+
+/**
+ * @brief pause -- Pauses the machine as if the safety switch had been flipped
+ */
+void cmdPause(Console &console, int argc, char *argv[]) {
+    interface.setPausedStatus(true);
+    console.ok("Paused");
+}
+
+/**
+ * @brief resume -- Undoes `pause`
+ */
+void cmdResume(Console &console, int argc, char *argv[]) {
+    if(interface.getRunningStatus() != 2) return console.error("not paused");
+
+    interface.setPausedStatus(false);
+    console.ok("Resumed");
+}
+
+/**
+ * @brief set <kits|rPerKit> <n> -- Changes a job setting while the machine is idle
+ */
+void cmdSet(Console &console, int argc, char *argv[]) {
+    int value;
+    if(argc != 3 || !parseNumber(argv[2], value)) return console.error("usage: set <kits|rPerKit> <n>");
+    if(interface.getRunningStatus() != 0) return console.error("can't change settings while running");
+
+    if(!strcasecmp(argv[1], "kits")) {
+        if(!interface.setKits(value)) return console.error("kits must be 1-%d", MAX_KITS);
+    } else if(!strcasecmp(argv[1], "rPerKit")) {
+        if(!interface.setResistorsPerKit(value)) return console.error("rPerKit must be 1-%d", MAX_R_PER_KIT);
+    } else {
+        return console.error("unknown setting '%s'", argv[1]);
+    }
+    console.ok("%s = %d", argv[1], value);
+}
+
+/**
+ * @brief start -- Starts a job with the current settings
+ */
+void cmdStart(Console &console, int argc, char *argv[]) {
+    if(interface.getRunningStatus() != 0 || startRequested) return console.error("already running");
+
+    startRequested = true;
+    console.ok("Starting %d resistors per kit for %d kits", interface.getResistorsPerKit(), interface.getKits());
+}
+
+/**
+ * @brief stop -- Stops the current job (queued jobs stay queued)
+ */
+void cmdStop(Console &console, int argc, char *argv[]) {
+    startRequested = false;
+    if(!interface.stop()) return console.error("not running");
+
+    console.ok("Stopped");
+}
+
+/**
+ * @brief status -- Prints the running state, settings & progress
+ */
+void cmdStatus(Console &console, int argc, char *argv[]) {
+    int running = interface.getRunningStatus();
+    const char *state = running == 1 ? "running" : running == 0 ? "idle" : "paused";
+
+    if(console.isMachineMode()) {
+        console.ok("state=%s rPerKit=%d kits=%d percent=%d queued=%d", state,
+            interface.getResistorsPerKit(), interface.getKits(), interface.getPercent(), jobQueue.size());
+    } else {
+        console.ok("Machine is %s: %d resistors per kit for %d kits (%d%%), %d job(s) queued", state,
+            interface.getResistorsPerKit(), interface.getKits(), interface.getPercent(), jobQueue.size());
+    }
+}
+
+/**
+ * @brief metrics [reset] -- Prints (or clears) the control loop timings from Profiler.h
+ */
+void cmdMetrics(Console &console, int argc, char *argv[]) {
+    if(argc == 2 && !strcasecmp(argv[1], "reset")) {
+        Profiler::get().reset();
+        return console.ok("Metrics cleared");
+    }
+
+    if(console.isMachineMode()) {
+        console.out().print("OK ");
+        Profiler::get().printJSON(console.out());
+        console.out().println();
+    } else {
+        Profiler::get().printTable(console.out());
+    }
+}
+
+/**
+ * @brief queue <add R K|list|clear> -- Manages the jobs that run automatically after the current one finishes
+ */
+void cmdQueue(Console &console, int argc, char *argv[]) {
+    if(argc == 4 && !strcasecmp(argv[1], "add")) {
+        int rPerKit, kits;
+        if(!parseNumber(argv[2], rPerKit) || rPerKit < 1 || rPerKit > MAX_R_PER_KIT) return console.error("R must be 1-%d", MAX_R_PER_KIT);
+        if(!parseNumber(argv[3], kits) || kits < 1 || kits > MAX_KITS) return console.error("K must be 1-%d", MAX_KITS);
+        if(!jobQueue.push(rPerKit, kits)) return console.error("queue full (%d jobs)", JOB_QUEUE_SIZE);
+
+        console.ok("queued=%d", jobQueue.size());
+    } else if(argc == 2 && !strcasecmp(argv[1], "list")) {
+        if(console.isMachineMode()) {
+            console.out().printf("OK queued=%d", jobQueue.size());
+            for(uint8_t i = 0; i < jobQueue.size(); i++) {
+                console.out().printf(" %dx%d", jobQueue.at(i).rPerKit, jobQueue.at(i).kits);
+            }
+            console.out().println();
+        } else {
+            for(uint8_t i = 0; i < jobQueue.size(); i++) {
+                console.out().printf("%d. %d resistors per kit for %d kits\n", i + 1, jobQueue.at(i).rPerKit, jobQueue.at(i).kits);
+            }
+            console.ok("%d job(s) queued", jobQueue.size());
+        }
+    } else if(argc == 2 && !strcasecmp(argv[1], "clear")) {
+        jobQueue.clear();
+        console.ok("Queue cleared");
+    } else {
+        console.error("usage: queue <add R K|list|clear>");
+    }
+}
+
+/**
+ * @brief telemetry <on|off> -- Turns the binary event stream from Telemetry.h on or off
+ */
+void cmdTelemetry(Console &console, int argc, char *argv[]) {
+    if(argc == 2 && !strcasecmp(argv[1], "on")) Telemetry::get().setEnabled(true);
+    else if(argc == 2 && !strcasecmp(argv[1], "off")) Telemetry::get().setEnabled(false);
+    else if(argc != 1) return console.error("usage: telemetry <on|off>");
+
+    console.ok("telemetry=%s", Telemetry::get().isEnabled() ? "on" : "off");
 }
@@ -0,0 +1,254 @@
+/*
+ * Structured binary telemetry: fixed-size event records are queued in a lock-free ring by any task
+ * and streamed out of the serial port by a low-priority task as COBS-framed packets
+ *
+ * Off until the console's `telemetry on` command: frames share the UART with the text console, so
+ * streaming them by default would garble the serial monitor
+ *
+ * Decode the stream on a PC with tools/telemetry_decode.py (keep its EVENTS table in sync with TelemetryEvent)
+ *
+ * Frame format (little-endian), COBS-encoded & followed by a 0x00 delimiter:
+ *     uint32 timestamp (us) | uint8 event | uint8 seq | uint16 a0 | int32 a1 | int32 a2 | uint8 crc8
+ *
+ * Nathaniel Baird
+ * bairdn@oregonstate.edu
+ *
+ * Started:      10/18/2026
+ * Last updated: 10/18/2026
+ */
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <Arduino.h>
+#include <atomic>
+
+#ifndef TELEMETRY_ENABLED
+#define TELEMETRY_ENABLED 1     // Set to 0 to compile every log() call down to nothing
+#endif
+
+#define TELEMETRY_SERIAL    Serial  // Where frames are streamed
+#define TELEMETRY_RING_SIZE 64      // Records buffered between producers & the drain task -- MUST be a power of 2
+#define TELEMETRY_TASK_PRIO (tskIDLE_PRIORITY + 1)
+
+/**
+ * @brief What a record describes & how to read its arguments
+ */
+enum TelemetryEvent : uint8_t {
+    TLM_BOOT         = 0, // (no args)
+    TLM_DROPPED      = 1, // a1 = records dropped because the ring was full
+    TLM_STATE_CHANGE = 2, // a0 = running state (see Interface.h), a1 = rPerKit, a2 = kits
+    TLM_PAUSE        = 3, // a0 = 1 if pausing/0 if resuming, a1 = running state before the change
+    TLM_PROGRESS     = 4, // a0 = percent complete
+    TLM_JOB_DONE     = 5, // a0 = 1 if the job finished/0 if it was stopped
+    TLM_PAGE_SERVED  = 6, // a0 = page (0 captive, 1 success, 2 main, 3 Citrix 404), a1 = # of params
+    TLM_REDIRECT     = 7, // a1 = client IPv4 address (as stored by IPAddress), a2 = length of the requested URL
+};
+
+struct TelemetryRecord {
+    uint32_t timestamp;
+    uint8_t  event;
+    uint8_t  seq;
+    uint16_t a0;
+    int32_t  a1, a2;
+};
+static_assert(sizeof(TelemetryRecord) == 16, "TelemetryRecord must stay packed; the decoder depends on its layout");
+
+class Telemetry {
+    private:
+        // Bounded MPSC ring (Vyukov): a cell is writable when sequence == pos & readable when sequence == pos + 1
+        struct Cell {
+            std::atomic<uint32_t> sequence;
+            TelemetryRecord       record;
+        };
+
+        Cell                  cells[TELEMETRY_RING_SIZE];
+        std::atomic<uint32_t> enqueuePos, dropped;
+        std::atomic<bool>     enabled, bootPending;
+        uint32_t              bootTime;
+        uint32_t              dequeuePos;
+        uint8_t               seq;
+        TaskHandle_t          task;
+
+        Telemetry() : enqueuePos(0), dropped(0), enabled(false), bootPending(false), bootTime(0), dequeuePos(0), seq(0), task(NULL) {
+            for(uint32_t i = 0; i < TELEMETRY_RING_SIZE; i++) cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief Removes the oldest record from the ring
+         *
+         * @warning Only the drain task may call this
+         *
+         * @return false if the ring is empty
+         */
+        bool pop(TelemetryRecord &record) {
+            Cell &cell = cells[dequeuePos & (TELEMETRY_RING_SIZE - 1)];
+            if(cell.sequence.load(std::memory_order_acquire) != dequeuePos + 1) return false;
+
+            record = cell.record;
+            cell.sequence.store(dequeuePos + TELEMETRY_RING_SIZE, std::memory_order_release);
+            dequeuePos++;
+            return true;
+        }
+
+        /**
+         * @brief Adds a record to the ring, stamped with `time`; drops & counts it if the ring is full
+         */
+        void push(uint32_t time, TelemetryEvent event, uint16_t a0, int32_t a1, int32_t a2) {
+        #if TELEMETRY_ENABLED
+            Cell    *cell;
+            uint32_t pos = enqueuePos.load(std::memory_order_relaxed);
+            for(;;) {
+                cell = &cells[pos & (TELEMETRY_RING_SIZE - 1)];
+                int32_t diff = (int32_t)(cell->sequence.load(std::memory_order_acquire) - pos);
+
+                if(diff == 0) {
+                    if(enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+                } else if(diff < 0) {
+                    dropped.fetch_add(1, std::memory_order_relaxed);
+                    return;
+                } else {
+                    pos = enqueuePos.load(std::memory_order_relaxed);
+                }
+            }
+
+            cell->record = {time, event, 0, a0, a1, a2};
+            cell->sequence.store(pos + 1, std::memory_order_release);
+
+            if(task) xTaskNotifyGive(task);
+        #endif
+        }
+
+        static uint8_t crc8(const uint8_t *data, size_t len) {
+            uint8_t crc = 0;
+            while(len--) {
+                crc ^= *data++;
+                for(uint8_t i = 0; i < 8; i++) crc = crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1;
+            }
+            return crc;
+        }
+
+        /**
+         * @brief Consistent Overhead Byte Stuffing: rewrites `in` so it contains no 0x00 bytes
+         *
+         * @param out Must have room for len + len/254 + 1 bytes
+         *
+         * @return How many bytes were written to `out`
+         */
+        static size_t cobsEncode(const uint8_t *in, size_t len, uint8_t *out) {
+            size_t  codeIndex = 0, outIndex = 1;
+            uint8_t code = 1;
+
+            for(size_t i = 0; i < len; i++) {
+                if(in[i]) {
+                    out[outIndex++] = in[i];
+                    code++;
+                }
+                if(!in[i] || code == 0xFF) {
+                    out[codeIndex] = code;
+                    codeIndex = outIndex++;
+                    code = 1;
+                }
+            }
+            out[codeIndex] = code;
+            return outIndex;
+        }
+
+        /**
+         * @brief Frames one record & writes it to the serial port in a single call (so other writers can't split it)
+         */
+        void send(TelemetryRecord &record) {
+            uint8_t payload[sizeof(TelemetryRecord) + 1];
+            uint8_t frame[sizeof(payload) + 2];
+
+            record.seq = seq++;
+            memcpy(payload, &record, sizeof(record));
+            payload[sizeof(record)] = crc8(payload, sizeof(record));
+
+            size_t len = cobsEncode(payload, sizeof(payload), frame);
+            frame[len++] = 0x00;
+            TELEMETRY_SERIAL.write(frame, len);
+        }
+
+        /**
+         * @brief Streams out everything in the ring, then reports any records that were dropped
+         */
+        void drain() {
+            TelemetryRecord record;
+            while(pop(record)) send(record);
+
+            uint32_t lost = dropped.exchange(0, std::memory_order_relaxed);
+            if(lost) {
+                record = {(uint32_t)micros(), TLM_DROPPED, 0, 0, (int32_t)lost, 0};
+                send(record);
+            }
+        }
+
+        static void drainTask(void *thisArg) {
+            Telemetry *obj = (Telemetry *)thisArg;
+            for(;;) {
+                ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+                obj->drain();
+            }
+        }
+
+    public:
+        Telemetry(Telemetry const &) = delete;
+        Telemetry &operator=(Telemetry const &) = delete;
+
+        /**
+         * @return The single telemetry stream shared by the whole sketch
+         */
+        static Telemetry &get() {
+            static Telemetry instance;
+            return instance;
+        }
+
+        /**
+         * @brief Starts the drain task; records logged before this are held (up to TELEMETRY_RING_SIZE) until now
+         *
+         * @note The TLM_BOOT record is held back until streaming is first turned on, & then sent ahead of everything else
+         *
+         * @warning MUST call after the serial port has been started
+         */
+        void begin() {
+            if(task) return;
+
+            xTaskCreate(drainTask, "telemetry", 2048, this, TELEMETRY_TASK_PRIO, &task);
+            bootTime = (uint32_t)micros();
+            bootPending.store(true, std::memory_order_release);
+        }
+
+        /**
+         * @brief Turns streaming on or off (it starts off, to keep a serial monitor readable); records logged while off are discarded
+         */
+        void setEnabled(bool enabled) {
+            if(enabled && bootPending.exchange(false, std::memory_order_acquire)) push(bootTime, TLM_BOOT, 0, 0, 0);
+            this->enabled.store(enabled, std::memory_order_relaxed);
+        }
+
+        /**
+         * @return Whether records are currently being streamed
+         */
+        bool isEnabled() {
+            return enabled.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief Queues a record for streaming; never blocks & never formats text, so it's safe on hot paths
+         *
+         * @note Safe to call from any task (not from ISRs); if the ring is full the record is dropped & counted
+         *
+         * @param event What happened
+         * @param a0-a2 Event-specific arguments (see TelemetryEvent)
+         */
+        void log(TelemetryEvent event, uint16_t a0 = 0, int32_t a1 = 0, int32_t a2 = 0) {
+        #if TELEMETRY_ENABLED
+            if(!enabled.load(std::memory_order_relaxed)) return;
+
+            push((uint32_t)micros(), event, a0, a1, a2);
+        #endif
+        }
+};
+
+#endif
@@ -5,7 +5,7 @@
  * bairdn@oregonstate.edu
  *
  * Started:      07/13/2023
- * Last updated: 07/18/2023
+ * Last updated: 10/18/2026
  */
 
 class Webpages {
@@ -102,24 +102,37 @@ class Webpages {
                     <div id="data" class="container">
                         <div id="rPerKit" style="border-right: 1px solid black;">
                             <h2>Resistors Per Kit</h2>
-                            <h1>{{rPerKit}}</h1>
+                            <h1>%rPerKit%</h1>
                         </div>
                         <div id="kits">
                             <h2>Kits</h2>
-                            <h1>{{kits}}</h1>
+                            <h1>%kits%</h1>
                         </div>
                     </div>
                     
                     <div id="status" class="container">
-                        <div class="{{cuttingClass}}"><h1>{{cuttingText}}</h1></div>
+                        <div class="%cuttingClass%"><h1>%cuttingText%</h1></div>
                     </div>
                 </body>
             </html>
             )=====";
 
         int rPerKit, kits, percent, running;
+
+        AsyncWebTemplate mainTemplate; // mainHTML cut at its placeholders once, at startup
     
     public:
+        /**
+         * @brief The placeholders in mainHTML, numbered in the order mainTemplate is given their names
+         */
+        enum MainVariable : uint8_t {
+            MAIN_R_PER_KIT,
+            MAIN_KITS,
+            MAIN_CUTTING_CLASS,
+            MAIN_CUTTING_TEXT
+        };
+
+
         /**
          * @brief Initialization allows the webpages to accurately display information from the moment they're first created
          * 
@@ -128,7 +141,8 @@ class Webpages {
          * @param percent If running, the percentage of the job that is complete
          * @param running The current running state (see Interface.h)
          */
-        Webpages(int rPerKit = 0, int kits = 0, int percent = 0, int running = 0) {
+        Webpages(int rPerKit = 0, int kits = 0, int percent = 0, int running = 0)
+            : mainTemplate(mainHTML, {"rPerKit", "kits", "cuttingClass", "cuttingText"}) {
             this->rPerKit = rPerKit;
             this->kits = kits;
             this->percent = percent;
@@ -178,29 +192,35 @@ class Webpages {
         }
 
         /**
-         * @return The filled HTML for the main status page
-         *
-         * @note This fills the mainHTML const with the data (eg rPerKit, running, etc) currently saved
-         *           in THIS CLASS, NOT Interface.h
+         * @return The main status page, compiled so serving it only copies its text & current values
          */
-        const char* getMainHTML() {
-            static std::string htmlCopy;
-            size_t index = 0;
-
-            htmlCopy = mainHTML;
-
-            index = htmlCopy.find("{{rPerKit}}");
-            if(index != std::string::npos) htmlCopy.replace(index, strlen("{{rPerKit}}"), String(rPerKit).c_str());
-
-            index = htmlCopy.find("{{kits}}");
-            if(index != std::string::npos) htmlCopy.replace(index, strlen("{{kits}}"), String(kits).c_str());
-            
-            index = htmlCopy.find("{{cuttingClass}}");
-            if(index != std::string::npos) htmlCopy.replace(index, strlen("{{cuttingClass}}"), running == 1 ? "cutting" : running == 0 ? "notCutting" : "paused");
-            
-            index = htmlCopy.find("{{cuttingText}}");
-            if(index != std::string::npos) htmlCopy.replace(index, strlen("{{cuttingText}}"), running == 1 ? "Cutting" : running == 0 ? "Not Cutting" : "Paused");
+        const AsyncWebTemplate& getMainTemplate() {
+            return mainTemplate;
+        }
 
-            return htmlCopy.c_str();
+        /**
+         * @brief Writes one of the main status page's values
+         *
+         * @note This fills in the data (eg rPerKit, running, etc) currently saved in THIS CLASS, NOT Interface.h
+         *
+         * @param id     Which placeholder to fill (see MainVariable)
+         * @param value  Where to write the value; not NUL-terminated
+         * @param maxLen The most characters value can hold
+         *
+         * @return The length of the value written
+         */
+        size_t fillMainValue(uint8_t id, char *value, size_t maxLen) {
+            const char *text;
+            switch(id) {
+                case MAIN_R_PER_KIT: return snprintf(value, maxLen, "%d", rPerKit);
+                case MAIN_KITS:      return snprintf(value, maxLen, "%d", kits);
+                case MAIN_CUTTING_CLASS: text = running == 1 ? "cutting" : running == 0 ? "notCutting" : "paused"; break;
+                case MAIN_CUTTING_TEXT:  text = running == 1 ? "Cutting" : running == 0 ? "Not Cutting" : "Paused"; break;
+                default: return 0;
+            }
+            size_t len = strlen(text);
+            if(len > maxLen) len = maxLen;
+            memcpy(value, text, len);
+            return len;
         }
 };
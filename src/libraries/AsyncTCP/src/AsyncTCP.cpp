@@ -20,6 +20,7 @@
  */
 
 #include "Arduino.h"
+#include <atomic>
 
 #include "AsyncTCP.h"
 extern "C"{
@@ -42,6 +43,8 @@ typedef enum {
 typedef struct {
         lwip_event_t event;
         void *arg;
+        int16_t slot;        //event slot of the client in arg, -1 if untracked
+        uint32_t generation; //the slot's generation when the event was posted
         union {
                 struct {
                         void * pcb;
@@ -76,8 +79,161 @@ typedef struct {
         };
 } lwip_event_packet_t;
 
-static xQueueHandle _async_queue;
-static TaskHandle_t _async_service_task_handle = NULL;
+/*
+ * Event Packet Pool
+ *
+ * Every LwIP callback posts one packet to the async task, so packets come from a fixed pool
+ * (a lock-free stack of indices) rather than a malloc/free pair per event. The head holds a
+ * 16 bit tag above the index so a pop racing with a pop+push of the same slot (ABA) fails.
+ * When the pool runs dry the packet comes from the heap instead & is counted as a miss.
+ * */
+
+#if CONFIG_ASYNC_TCP_EVENT_POOL_SIZE > 0
+#define ASYNC_EVENT_POOL_SIZE CONFIG_ASYNC_TCP_EVENT_POOL_SIZE
+#else
+#define ASYNC_EVENT_POOL_SIZE (CONFIG_LWIP_MAX_ACTIVE_TCP * 4) //recv, sent, poll & one spare in flight per connection
+#endif
+#define ASYNC_EVENT_POOL_EMPTY 0xFFFF
+
+static_assert(ASYNC_EVENT_POOL_SIZE < ASYNC_EVENT_POOL_EMPTY, "event pool indices must fit in 16 bits");
+
+static lwip_event_packet_t _event_pool[ASYNC_EVENT_POOL_SIZE];
+static std::atomic<uint16_t> _event_pool_next[ASYNC_EVENT_POOL_SIZE];
+static std::atomic<uint32_t> _event_pool_free(ASYNC_EVENT_POOL_SIZE);
+static std::atomic<uint32_t> _event_pool_hits(0);
+static std::atomic<uint32_t> _event_pool_misses(0);
+static std::atomic<uint32_t> _events_coalesced(0);
+static std::atomic<uint32_t> _event_pool_head([]() {
+    for (int i = 0; i < ASYNC_EVENT_POOL_SIZE; ++ i) {
+        _event_pool_next[i].store(i + 1 < ASYNC_EVENT_POOL_SIZE ? i + 1 : ASYNC_EVENT_POOL_EMPTY, std::memory_order_relaxed);
+    }
+    return (uint32_t)0;
+}());
+
+static inline uint32_t _event_pool_link(uint32_t head, uint16_t index){
+    return ((head + 0x10000) & 0xFFFF0000) | index;
+}
+
+static lwip_event_packet_t * _alloc_event_packet(){
+    uint32_t head = _event_pool_head.load(std::memory_order_acquire);
+    while((head & 0xFFFF) != ASYNC_EVENT_POOL_EMPTY){
+        uint16_t index = head & 0xFFFF;
+        uint32_t next = _event_pool_link(head, _event_pool_next[index].load(std::memory_order_relaxed));
+        if(_event_pool_head.compare_exchange_weak(head, next, std::memory_order_acquire, std::memory_order_acquire)){
+            _event_pool_free.fetch_sub(1, std::memory_order_relaxed);
+            _event_pool_hits.fetch_add(1, std::memory_order_relaxed);
+            return &_event_pool[index];
+        }
+    }
+    _event_pool_misses.fetch_add(1, std::memory_order_relaxed);
+    return (lwip_event_packet_t *)malloc(sizeof(lwip_event_packet_t));
+}
+
+static void _free_event_packet(lwip_event_packet_t * e){
+    uintptr_t offset = (uintptr_t)e - (uintptr_t)_event_pool;
+    if(offset >= sizeof(_event_pool)){
+        free((void*)(e));
+        return;
+    }
+    uint16_t index = offset / sizeof(lwip_event_packet_t);
+    uint32_t head = _event_pool_head.load(std::memory_order_relaxed);
+    do {
+        _event_pool_next[index].store(head & 0xFFFF, std::memory_order_relaxed);
+    } while(!_event_pool_head.compare_exchange_weak(head, _event_pool_link(head, index), std::memory_order_release, std::memory_order_relaxed));
+    _event_pool_free.fetch_add(1, std::memory_order_relaxed);
+}
+
+void async_tcp_event_pool_stats(async_event_pool_stats_t * stats){
+    stats->size = ASYNC_EVENT_POOL_SIZE;
+    stats->free = _event_pool_free.load(std::memory_order_relaxed);
+    stats->hits = _event_pool_hits.load(std::memory_order_relaxed);
+    stats->misses = _event_pool_misses.load(std::memory_order_relaxed);
+    stats->coalesced = _events_coalesced.load(std::memory_order_relaxed);
+}
+
+/*
+ * Client Event Slots
+ *
+ * Each client with a pcb owns a slot whose generation is stamped onto its events as they are posted.
+ * Clearing a client's events only bumps the generation, so anything still queued for it is dropped
+ * when it reaches the AsyncTCP task instead of the whole queue being drained and rebuilt.
+ * Clients that can't get a slot fall back to posting LWIP_TCP_CLEAR to purge the queue.
+ *
+ * The slot also coalesces the events that LwIP raises over & over for a busy client: while a SENT
+ * is queued, later acks only add their byte count to it, and while a POLL is queued, later polls
+ * are dropped. The AsyncTCP task then runs one _sent()/_poll() for all of them.
+ *
+ * The LwIP thread finds a client's slot by looking for the client among the slots' owners, starting
+ * where its address hashes to, so it never reads a client the AsyncTCP task may have deleted.
+ * */
+
+#define ASYNC_EVENT_SLOTS (CONFIG_LWIP_MAX_ACTIVE_TCP * 2) //clients may outlive their pcb until they are deleted
+
+typedef struct {
+    std::atomic<void *> owner;
+    std::atomic<uint32_t> generation;
+    std::atomic<uint32_t> sent_len;   //bytes acked since the queued SENT was posted, 0 if none is queued
+    std::atomic<bool> poll_queued;
+} async_event_slot_t;
+
+static async_event_slot_t _event_slots[ASYNC_EVENT_SLOTS];
+
+static inline uint32_t _event_slot_hash(void * client){
+    return ((uintptr_t)client >> 3) % ASYNC_EVENT_SLOTS;
+}
+
+//In LwIP Thread (arg is the client the callback belongs to, and only compared)
+static int16_t _event_slot_of(void * arg){
+    if(!arg){
+        return -1;
+    }
+    uint32_t start = _event_slot_hash(arg);
+    for (uint32_t n = 0; n < ASYNC_EVENT_SLOTS; ++ n) {
+        uint32_t i = (start + n) % ASYNC_EVENT_SLOTS;
+        if (_event_slots[i].owner.load(std::memory_order_acquire) == arg) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static inline void _stamp_event(lwip_event_packet_t * e){
+    e->slot = _event_slot_of(e->arg);
+    e->generation = e->slot < 0 ? 0 : _event_slots[e->slot].generation.load(std::memory_order_acquire);
+}
+
+static inline bool _event_is_stale(lwip_event_packet_t * e){
+    return e->slot >= 0 && _event_slots[e->slot].generation.load(std::memory_order_acquire) != e->generation;
+}
+
+/*
+ * Worker Tasks
+ *
+ * Events normally run on a single AsyncTCP task. async_tcp_set_workers() can spread them over up to
+ * ASYNC_TCP_MAX_WORKERS tasks, each with its own queue. Every event for a connection goes to the same
+ * worker (by event slot, or by client address when it has none), so one connection's events stay in
+ * order while a slow handler on one worker doesn't hold up the connections on the others.
+ * */
+
+#define ASYNC_TCP_MAX_WORKERS 4
+
+static_assert(CONFIG_ASYNC_TCP_WORKERS >= 1 && CONFIG_ASYNC_TCP_WORKERS <= ASYNC_TCP_MAX_WORKERS, "CONFIG_ASYNC_TCP_WORKERS must be 1-4");
+
+static xQueueHandle _async_queues[ASYNC_TCP_MAX_WORKERS];
+static TaskHandle_t _async_service_task_handles[ASYNC_TCP_MAX_WORKERS];
+static uint8_t _async_workers = CONFIG_ASYNC_TCP_WORKERS;
+static int _async_workers_core = CONFIG_ASYNC_TCP_RUNNING_CORE;
+
+static inline xQueueHandle _async_queue_for(lwip_event_packet_t * e){
+    if(_async_workers < 2){
+        return _async_queues[0];
+    }
+    //an accepted client must reach its worker before the client's own events do
+    void * client = e->event == LWIP_TCP_ACCEPT ? (void *)e->accept.client : e->arg;
+    int16_t slot = e->event == LWIP_TCP_ACCEPT ? _event_slot_of(client) : e->slot;
+    uint32_t key = slot >= 0 ? slot : ((uintptr_t)client >> 3);
+    return _async_queues[key % _async_workers];
+}
 
 
 SemaphoreHandle_t _slots_lock;
@@ -94,28 +250,32 @@ static uint32_t _closed_index = []() {
 
 
 static inline bool _init_async_event_queue(){
-    if(!_async_queue){
-        _async_queue = xQueueCreate(32, sizeof(lwip_event_packet_t *));
-        if(!_async_queue){
-            return false;
+    for(uint8_t i = 0; i < _async_workers; ++ i){
+        if(!_async_queues[i]){
+            _async_queues[i] = xQueueCreate(CONFIG_ASYNC_TCP_QUEUE_SIZE, sizeof(lwip_event_packet_t *));
+            if(!_async_queues[i]){
+                return false;
+            }
         }
     }
     return true;
 }
 
 static inline bool _send_async_event(lwip_event_packet_t ** e){
-    return _async_queue && xQueueSend(_async_queue, e, portMAX_DELAY) == pdPASS;
+    xQueueHandle queue = _async_queue_for(*e);
+    return queue && xQueueSend(queue, e, portMAX_DELAY) == pdPASS;
 }
 
 static inline bool _prepend_async_event(lwip_event_packet_t ** e){
-    return _async_queue && xQueueSendToFront(_async_queue, e, portMAX_DELAY) == pdPASS;
+    xQueueHandle queue = _async_queue_for(*e);
+    return queue && xQueueSendToFront(queue, e, portMAX_DELAY) == pdPASS;
 }
 
-static inline bool _get_async_event(lwip_event_packet_t ** e){
-    return _async_queue && xQueueReceive(_async_queue, e, portMAX_DELAY) == pdPASS;
+static inline bool _get_async_event(xQueueHandle queue, lwip_event_packet_t ** e){
+    return queue && xQueueReceive(queue, e, portMAX_DELAY) == pdPASS;
 }
 
-static bool _remove_events_with_arg(void * arg){
+static bool _remove_events_with_arg(xQueueHandle _async_queue, void * arg){
     lwip_event_packet_t * first_packet = NULL;
     lwip_event_packet_t * packet = NULL;
 
@@ -129,7 +289,7 @@ static bool _remove_events_with_arg(void * arg){
         }
         //discard packet if matching
         if((int)first_packet->arg == (int)arg){
-            free(first_packet);
+            _free_event_packet(first_packet);
             first_packet = NULL;
         //return first packet to the back of the queue
         } else if(xQueueSend(_async_queue, &first_packet, portMAX_DELAY) != pdPASS){
@@ -142,7 +302,7 @@ static bool _remove_events_with_arg(void * arg){
             return false;
         }
         if((int)packet->arg == (int)arg){
-            free(packet);
+            _free_event_packet(packet);
             packet = NULL;
         } else if(xQueueSend(_async_queue, &packet, portMAX_DELAY) != pdPASS){
             return false;
@@ -155,8 +315,13 @@ static void _handle_async_event(lwip_event_packet_t * e){
     if(e->arg == NULL){
         // do nothing when arg is NULL
         //ets_printf("event arg == NULL: 0x%08x\n", e->recv.pcb);
+    } else if(_event_is_stale(e)){
+        // the client's events were cleared after this was posted
+        if(e->event == LWIP_TCP_RECV && e->recv.pb){
+            pbuf_free(e->recv.pb);
+        }
     } else if(e->event == LWIP_TCP_CLEAR){
-        _remove_events_with_arg(e->arg);
+        _remove_events_with_arg(_async_queue_for(e), e->arg);
     } else if(e->event == LWIP_TCP_RECV){
         //ets_printf("-R: 0x%08x\n", e->recv.pcb);
         AsyncClient::_s_recv(e->arg, e->recv.pcb, e->recv.pb, e->recv.err);
@@ -165,9 +330,13 @@ static void _handle_async_event(lwip_event_packet_t * e){
         AsyncClient::_s_fin(e->arg, e->fin.pcb, e->fin.err);
     } else if(e->event == LWIP_TCP_SENT){
         //ets_printf("-S: 0x%08x\n", e->sent.pcb);
-        AsyncClient::_s_sent(e->arg, e->sent.pcb, e->sent.len);
+        uint32_t len = e->slot < 0 ? e->sent.len : _event_slots[e->slot].sent_len.exchange(0, std::memory_order_acq_rel);
+        AsyncClient::_s_sent(e->arg, e->sent.pcb, len);
     } else if(e->event == LWIP_TCP_POLL){
         //ets_printf("-P: 0x%08x\n", e->poll.pcb);
+        if(e->slot >= 0){
+            _event_slots[e->slot].poll_queued.store(false, std::memory_order_release);
+        }
         AsyncClient::_s_poll(e->arg, e->poll.pcb);
     } else if(e->event == LWIP_TCP_ERROR){
         //ets_printf("-E: 0x%08x %d\n", e->arg, e->error.err);
@@ -182,13 +351,14 @@ static void _handle_async_event(lwip_event_packet_t * e){
         //ets_printf("D: 0x%08x %s = %s\n", e->arg, e->dns.name, ipaddr_ntoa(&e->dns.addr));
         AsyncClient::_s_dns_found(e->dns.name, &e->dns.addr, e->arg);
     }
-    free((void*)(e));
+    _free_event_packet(e);
 }
 
 static void _async_service_task(void *pvParameters){
+    xQueueHandle queue = (xQueueHandle)pvParameters;
     lwip_event_packet_t * packet = NULL;
     for (;;) {
-        if(_get_async_event(&packet)){
+        if(_get_async_event(queue, &packet)){
 #if CONFIG_ASYNC_TCP_USE_WDT
             if(esp_task_wdt_add(NULL) != ESP_OK){
                 log_e("Failed to add async task to WDT");
@@ -203,13 +373,14 @@ static void _async_service_task(void *pvParameters){
         }
     }
     vTaskDelete(NULL);
-    _async_service_task_handle = NULL;
 }
 /*
 static void _stop_async_task(){
-    if(_async_service_task_handle){
-        vTaskDelete(_async_service_task_handle);
-        _async_service_task_handle = NULL;
+    for(uint8_t i = 0; i < _async_workers; ++ i){
+        if(_async_service_task_handles[i]){
+            vTaskDelete(_async_service_task_handles[i]);
+            _async_service_task_handles[i] = NULL;
+        }
     }
 }
 */
@@ -217,57 +388,89 @@ static bool _start_async_task(){
     if(!_init_async_event_queue()){
         return false;
     }
-    if(!_async_service_task_handle){
-        xTaskCreateUniversal(_async_service_task, "async_tcp", 8192 * 2, NULL, 3, &_async_service_task_handle, CONFIG_ASYNC_TCP_RUNNING_CORE);
-        if(!_async_service_task_handle){
-            return false;
+    for(uint8_t i = 0; i < _async_workers; ++ i){
+        if(!_async_service_task_handles[i]){
+            char name[16] = "async_tcp";
+            if(i){
+                snprintf(name, sizeof(name), "async_tcp_%u", i);
+            }
+            xTaskCreateUniversal(_async_service_task, name, 8192 * 2, (void *)_async_queues[i], 3, &_async_service_task_handles[i], _async_workers_core);
+            if(!_async_service_task_handles[i]){
+                return false;
+            }
         }
     }
     return true;
 }
 
+bool async_tcp_set_workers(uint8_t workers, int core){
+    if(!workers || workers > ASYNC_TCP_MAX_WORKERS){
+        log_e("workers must be 1-%u", ASYNC_TCP_MAX_WORKERS);
+        return false;
+    }
+    if(_async_service_task_handles[0]){
+        log_e("AsyncTCP is already running");
+        return false;
+    }
+    _async_workers = workers;
+    _async_workers_core = core;
+    return true;
+}
+
 /*
  * LwIP Callbacks
  * */
 
 static int8_t _tcp_clear_events(void * arg) {
-    lwip_event_packet_t * e = (lwip_event_packet_t *)malloc(sizeof(lwip_event_packet_t));
+    lwip_event_packet_t * e = _alloc_event_packet();
     e->event = LWIP_TCP_CLEAR;
     e->arg = arg;
+    e->slot = -1;
     if (!_prepend_async_event(&e)) {
-        free((void*)(e));
+        _free_event_packet(e);
     }
     return ERR_OK;
 }
 
 static int8_t _tcp_connected(void * arg, tcp_pcb * pcb, int8_t err) {
     //ets_printf("+C: 0x%08x\n", pcb);
-    lwip_event_packet_t * e = (lwip_event_packet_t *)malloc(sizeof(lwip_event_packet_t));
+    lwip_event_packet_t * e = _alloc_event_packet();
     e->event = LWIP_TCP_CONNECTED;
     e->arg = arg;
+    _stamp_event(e);
     e->connected.pcb = pcb;
     e->connected.err = err;
     if (!_prepend_async_event(&e)) {
-        free((void*)(e));
+        _free_event_packet(e);
     }
     return ERR_OK;
 }
 
 static int8_t _tcp_poll(void * arg, struct tcp_pcb * pcb) {
     //ets_printf("+P: 0x%08x\n", pcb);
-    lwip_event_packet_t * e = (lwip_event_packet_t *)malloc(sizeof(lwip_event_packet_t));
+    int16_t slot = _event_slot_of(arg);
+    if(slot >= 0 && _event_slots[slot].poll_queued.exchange(true, std::memory_order_acq_rel)){
+        _events_coalesced.fetch_add(1, std::memory_order_relaxed);
+        return ERR_OK;
+    }
+    lwip_event_packet_t * e = _alloc_event_packet();
     e->event = LWIP_TCP_POLL;
     e->arg = arg;
+    _stamp_event(e);
     e->poll.pcb = pcb;
     if (!_send_async_event(&e)) {
-        free((void*)(e));
+        _free_event_packet(e);
+        if(slot >= 0){
+            _event_slots[slot].poll_queued.store(false, std::memory_order_release);
+        }
     }
     return ERR_OK;
 }
 
 static int8_t _tcp_recv(void * arg, struct tcp_pcb * pcb, struct pbuf *pb, int8_t err) {
-    lwip_event_packet_t * e = (lwip_event_packet_t *)malloc(sizeof(lwip_event_packet_t));
+    lwip_event_packet_t * e = _alloc_event_packet();
     e->arg = arg;
+    _stamp_event(e);
     if(pb){
         //ets_printf("+R: 0x%08x\n", pcb);
         e->event = LWIP_TCP_RECV;
@@ -283,40 +486,51 @@ static int8_t _tcp_recv(void * arg, struct tcp_pcb * pcb, struct pbuf *pb, int8_
         AsyncClient::_s_lwip_fin(e->arg, e->fin.pcb, e->fin.err);
     }
     if (!_send_async_event(&e)) {
-        free((void*)(e));
+        _free_event_packet(e);
     }
     return ERR_OK;
 }
 
 static int8_t _tcp_sent(void * arg, struct tcp_pcb * pcb, uint16_t len) {
     //ets_printf("+S: 0x%08x\n", pcb);
-    lwip_event_packet_t * e = (lwip_event_packet_t *)malloc(sizeof(lwip_event_packet_t));
+    int16_t slot = _event_slot_of(arg);
+    if(slot >= 0 && _event_slots[slot].sent_len.fetch_add(len, std::memory_order_acq_rel) != 0){
+        _events_coalesced.fetch_add(1, std::memory_order_relaxed);
+        return ERR_OK;
+    }
+    lwip_event_packet_t * e = _alloc_event_packet();
     e->event = LWIP_TCP_SENT;
     e->arg = arg;
+    _stamp_event(e);
     e->sent.pcb = pcb;
     e->sent.len = len;
     if (!_send_async_event(&e)) {
-        free((void*)(e));
+        _free_event_packet(e);
+        if(slot >= 0){
+            _event_slots[slot].sent_len.store(0, std::memory_order_release);
+        }
     }
     return ERR_OK;
 }
 
 static void _tcp_error(void * arg, int8_t err) {
     //ets_printf("+E: 0x%08x\n", arg);
-    lwip_event_packet_t * e = (lwip_event_packet_t *)malloc(sizeof(lwip_event_packet_t));
+    lwip_event_packet_t * e = _alloc_event_packet();
     e->event = LWIP_TCP_ERROR;
     e->arg = arg;
+    _stamp_event(e);
     e->error.err = err;
     if (!_send_async_event(&e)) {
-        free((void*)(e));
+        _free_event_packet(e);
     }
 }
 
 static void _tcp_dns_found(const char * name, struct ip_addr * ipaddr, void * arg) {
-    lwip_event_packet_t * e = (lwip_event_packet_t *)malloc(sizeof(lwip_event_packet_t));
+    lwip_event_packet_t * e = _alloc_event_packet();
     //ets_printf("+DNS: name=%s ipaddr=0x%08x arg=%x\n", name, ipaddr, arg);
     e->event = LWIP_TCP_DNS;
     e->arg = arg;
+    _stamp_event(e);
     e->dns.name = name;
     if (ipaddr) {
         memcpy(&e->dns.addr, ipaddr, sizeof(struct ip_addr));
@@ -324,18 +538,19 @@ static void _tcp_dns_found(const char * name, struct ip_addr * ipaddr, void * ar
         memset(&e->dns.addr, 0, sizeof(e->dns.addr));
     }
     if (!_send_async_event(&e)) {
-        free((void*)(e));
+        _free_event_packet(e);
     }
 }
 
 //Used to switch out from LwIP thread
 static int8_t _tcp_accept(void * arg, AsyncClient * client) {
-    lwip_event_packet_t * e = (lwip_event_packet_t *)malloc(sizeof(lwip_event_packet_t));
+    lwip_event_packet_t * e = _alloc_event_packet();
     e->event = LWIP_TCP_ACCEPT;
     e->arg = arg;
+    e->slot = -1;
     e->accept.client = client;
     if (!_prepend_async_event(&e)) {
-        free((void*)(e));
+        _free_event_packet(e);
     }
     return ERR_OK;
 }
@@ -567,8 +782,10 @@ AsyncClient::AsyncClient(tcp_pcb* pcb)
 {
     _pcb = pcb;
     _closed_slot = -1;
+    _event_slot = -1;
     if(_pcb){
         _allocate_closed_slot();
+        _allocate_event_slot();
         _rx_last_packet = millis();
         tcp_arg(_pcb, this);
         tcp_recv(_pcb, &_tcp_recv);
@@ -582,6 +799,9 @@ AsyncClient::~AsyncClient(){
     if(_pcb) {
         _close();
     }
+    if(_event_slot != -1) {
+        _clear_events();
+    }
     _free_closed_slot();
 }
 
@@ -594,9 +814,16 @@ AsyncClient& AsyncClient::operator=(const AsyncClient& other){
         _close();
     }
 
+    //events still queued for the old connection go stale with the slot, and the new pcb's go to a
+    //slot of this client's own; other keeps its slot, as it keeps its own callbacks
+    if (_event_slot != -1) {
+        _clear_events();
+    }
+
     _pcb = other._pcb;
     _closed_slot = other._closed_slot;
     if (_pcb) {
+        _allocate_event_slot();
         _rx_last_packet = millis();
         tcp_arg(_pcb, this);
         tcp_recv(_pcb, &_tcp_recv);
@@ -694,6 +921,7 @@ bool AsyncClient::connect(IPAddress ip, uint16_t port){
         return false;
     }
 
+    _allocate_event_slot();
     tcp_arg(pcb, this);
     tcp_err(pcb, &_tcp_error);
     tcp_recv(pcb, &_tcp_recv);
@@ -712,6 +940,7 @@ bool AsyncClient::connect(const char* host, uint16_t port){
       return false;
     }
     
+    _allocate_event_slot();
     err_t err = dns_gethostbyname(host, &addr, (dns_found_callback)&_tcp_dns_found, this);
     if(err == ERR_OK) {
         return connect(IPAddress(addr.u_addr.ip4.addr), port);
@@ -805,12 +1034,13 @@ int8_t AsyncClient::_close(){
         tcp_recv(_pcb, NULL);
         tcp_err(_pcb, NULL);
         tcp_poll(_pcb, NULL, 0);
-        _tcp_clear_events(this);
         err = _tcp_close(_pcb, _closed_slot);
         if(err != ERR_OK) {
             err = abort();
         }
         _pcb = NULL;
+        //after the close the LwIP thread can't post anything new for this client
+        _clear_events();
         if(_discard_cb) {
             _discard_cb(_discard_cb_arg, this);
         }
@@ -833,6 +1063,34 @@ void AsyncClient::_allocate_closed_slot(){
     xSemaphoreGive(_slots_lock);
 }
 
+void AsyncClient::_allocate_event_slot(){
+    if (_event_slot != -1) {
+        return;
+    }
+    uint32_t start = _event_slot_hash(this);
+    for (uint32_t n = 0; n < ASYNC_EVENT_SLOTS; ++ n) {
+        uint32_t i = (start + n) % ASYNC_EVENT_SLOTS;
+        void * expected = NULL;
+        if (_event_slots[i].owner.compare_exchange_strong(expected, (void *)this)) {
+            _event_slot = i;
+            return;
+        }
+    }
+    log_w("no free event slot, events will be purged on close");
+}
+
+void AsyncClient::_clear_events(){
+    if (_event_slot == -1) {
+        _tcp_clear_events(this);
+        return;
+    }
+    _event_slots[_event_slot].generation.fetch_add(1, std::memory_order_release);
+    _event_slots[_event_slot].sent_len.store(0, std::memory_order_relaxed);
+    _event_slots[_event_slot].poll_queued.store(false, std::memory_order_relaxed);
+    _event_slots[_event_slot].owner.store(NULL, std::memory_order_release);
+    _event_slot = -1;
+}
+
 void AsyncClient::_free_closed_slot(){
     if (_closed_slot != -1) {
         _closed_slots[_closed_slot] = _closed_index;
@@ -902,14 +1160,14 @@ int8_t AsyncClient::_lwip_fin(tcp_pcb* pcb, int8_t err) {
 
 //In Async Thread
 int8_t AsyncClient::_fin(tcp_pcb* pcb, int8_t err) {
-    _tcp_clear_events(this);
+    _clear_events();
     if(_discard_cb) {
         _discard_cb(_discard_cb_arg, this);
     }
     return ERR_OK;
 }
 
-int8_t AsyncClient::_sent(tcp_pcb* pcb, uint16_t len) {
+int8_t AsyncClient::_sent(tcp_pcb* pcb, uint32_t len) {
     _rx_last_packet = millis();
     //log_i("%u", len);
     _pcb_busy = false;
@@ -1218,7 +1476,7 @@ int8_t AsyncClient::_s_lwip_fin(void * arg, struct tcp_pcb * pcb, int8_t err) {
     return reinterpret_cast<AsyncClient*>(arg)->_lwip_fin(pcb, err);
 }
 
-int8_t AsyncClient::_s_sent(void * arg, struct tcp_pcb * pcb, uint16_t len) {
+int8_t AsyncClient::_s_sent(void * arg, struct tcp_pcb * pcb, uint32_t len) {
     return reinterpret_cast<AsyncClient*>(arg)->_sent(pcb, len);
 }
 
@@ -36,6 +36,21 @@ extern "C" {
 #define CONFIG_ASYNC_TCP_USE_WDT 1 //if enabled, adds between 33us and 200us per event
 #endif
 
+//Tasks that AsyncTCP's events are spread over (see async_tcp_set_workers())
+#ifndef CONFIG_ASYNC_TCP_WORKERS
+#define CONFIG_ASYNC_TCP_WORKERS 1
+#endif
+
+//Depth of the queue between the LwIP callbacks and the AsyncTCP task
+#ifndef CONFIG_ASYNC_TCP_QUEUE_SIZE
+#define CONFIG_ASYNC_TCP_QUEUE_SIZE 32
+#endif
+
+//Event packets preallocated for the LwIP callbacks; 0 sizes the pool from the number of TCP connections
+#ifndef CONFIG_ASYNC_TCP_EVENT_POOL_SIZE
+#define CONFIG_ASYNC_TCP_EVENT_POOL_SIZE 0
+#endif
+
 class AsyncClient;
 
 #define ASYNC_MAX_ACK_TIME 5000
@@ -132,7 +147,7 @@ class AsyncClient {
     static int8_t _s_fin(void *arg, struct tcp_pcb *tpcb, int8_t err);
     static int8_t _s_lwip_fin(void *arg, struct tcp_pcb *tpcb, int8_t err);
     static void _s_error(void *arg, int8_t err);
-    static int8_t _s_sent(void *arg, struct tcp_pcb *tpcb, uint16_t len);
+    static int8_t _s_sent(void *arg, struct tcp_pcb *tpcb, uint32_t len);
     static int8_t _s_connected(void* arg, void* tpcb, int8_t err);
     static void _s_dns_found(const char *name, struct ip_addr *ipaddr, void *arg);
 
@@ -142,6 +157,7 @@ class AsyncClient {
   protected:
     tcp_pcb* _pcb;
     int8_t  _closed_slot;
+    int16_t _event_slot;
 
     AcConnectHandler _connect_cb;
     void* _connect_cb_arg;
@@ -172,10 +188,12 @@ class AsyncClient {
     int8_t _close();
     void _free_closed_slot();
     void _allocate_closed_slot();
+    void _allocate_event_slot();
+    void _clear_events();
     int8_t _connected(void* pcb, int8_t err);
     void _error(int8_t err);
     int8_t _poll(tcp_pcb* pcb);
-    int8_t _sent(tcp_pcb* pcb, uint16_t len);
+    int8_t _sent(tcp_pcb* pcb, uint32_t len);
     int8_t _fin(tcp_pcb* pcb, int8_t err);
     int8_t _lwip_fin(tcp_pcb* pcb, int8_t err);
     void _dns_found(struct ip_addr *ipaddr);
@@ -213,5 +231,21 @@ class AsyncServer {
     int8_t _accepted(AsyncClient* client);
 };
 
+typedef struct {
+    uint16_t size;      //packets preallocated in the pool
+    uint16_t free;      //packets currently available
+    uint32_t hits;      //events that got a pooled packet
+    uint32_t misses;    //events that fell back to malloc because the pool was empty
+    uint32_t coalesced; //SENT/POLL events merged into one already queued for the same client
+} async_event_pool_stats_t;
+
+//Snapshot of the event packet pool's counters (safe to call from any task)
+void async_tcp_event_pool_stats(async_event_pool_stats_t * stats);
+
+//Runs events on `workers` (1-4) tasks pinned to `core` (-1 for any), keeping each connection on one task.
+//Must be called before the first server or client is started. With more than one worker, handlers for
+//different connections run concurrently, so anything they share must be thread safe.
+bool async_tcp_set_workers(uint8_t workers, int core);
+
 
 #endif /* ASYNCTCP_H_ */
@@ -13,41 +13,49 @@ DNSServer::DNSServer()
 {
   _ttl = htonl(DNS_DEFAULT_TTL);
   _errorReplyCode = DNSReplyCode::NonExistentDomain;
-  _dnsHeader    = (DNSHeader*) malloc( sizeof(DNSHeader) ) ;
-  _dnsQuestion  = (DNSQuestion*) malloc( sizeof(DNSQuestion) ) ;     
-  _buffer     = NULL;
+  _dnsHeader = (DNSHeader*) _buffer;
   _currentPacketSize = 0;
   _port = 0;
+  _socket = -1;
+  _task = NULL;
+  _stopTask = false;
 }
 
 DNSServer::~DNSServer()
 {
-  if (_dnsHeader) {
-    free(_dnsHeader);
-    _dnsHeader = NULL;
-  }
-  if (_dnsQuestion) {
-    free(_dnsQuestion);
-    _dnsQuestion = NULL;
-  }
-  if (_buffer) {
-    free(_buffer);
-    _buffer = NULL;
-  }
+  stop();
 }
 
 bool DNSServer::start(const uint16_t &port, const String &domainName,
                      const IPAddress &resolvedIP)
 {
+  stop();
   _port = port;
-  _buffer = NULL;
   _domainName = domainName;
   _resolvedIP[0] = resolvedIP[0];
   _resolvedIP[1] = resolvedIP[1];
   _resolvedIP[2] = resolvedIP[2];
   _resolvedIP[3] = resolvedIP[3];
   downcaseAndRemoveWwwPrefix(_domainName);
-  return _udp.begin(_port) == 1;
+
+  if ((_socket = socket(AF_INET, SOCK_DGRAM, 0)) == -1)
+    return false;
+
+  int yes = 1;
+  setsockopt(_socket, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(_port);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  if (bind(_socket, (struct sockaddr*) &addr, sizeof(addr)) == -1)
+  {
+    stop();
+    return false;
+  }
+  fcntl(_socket, F_SETFL, O_NONBLOCK);
+  return true;
 }
 
 void DNSServer::setErrorReplyCode(const DNSReplyCode &replyCode)
@@ -60,11 +68,70 @@ void DNSServer::setTTL(const uint32_t &ttl)
   _ttl = htonl(ttl);
 }
 
+bool DNSServer::startTask(UBaseType_t priority, BaseType_t core)
+{
+  if (_socket == -1)
+    return false;
+  if (_task)
+    return true;
+
+  _stopTask = false;
+  TaskHandle_t task;
+  if (xTaskCreatePinnedToCore(taskLoop, "dns_server", DNS_TASK_STACK_SIZE, this, priority, &task, core) != pdPASS)
+    return false;
+  _task = task;
+  return true;
+}
+
+// Sleeps in select() until at least one query (or stopTask()'s wakeup) arrives, then answers
+// everything that's pending; an idle server never wakes the CPU
+void DNSServer::taskLoop(void *dnsServer)
+{
+  DNSServer *server = (DNSServer*) dnsServer;
+  while (!server->_stopTask)
+  {
+    fd_set readSet;
+    FD_ZERO(&readSet);
+    FD_SET(server->_socket, &readSet);
+    if (select(server->_socket + 1, &readSet, NULL, NULL, NULL) > 0 && !server->_stopTask)
+      server->processNextRequest();
+  }
+
+  server->_task = NULL;
+  vTaskDelete(NULL);
+}
+
+// Wakes the task with an empty datagram sent to ourselves over loopback, then waits for it to exit. It
+// has to leave on its own: deleted inside select(), it would leave lwIP pointing into its freed stack.
+// The wakeup is sent again while waiting, in case one is dropped (eg the loopback queue is full).
+void DNSServer::stopTask()
+{
+  if (!_task)
+    return;
+
+  _stopTask = true;
+
+  struct sockaddr_in self;
+  memset(&self, 0, sizeof(self));
+  self.sin_family = AF_INET;
+  self.sin_port = htons(_port);
+  self.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  for (uint32_t i = 0; _task; i++)
+  {
+    if (i % 10 == 0)
+      sendto(_socket, "", 1, 0, (struct sockaddr*) &self, sizeof(self));
+    vTaskDelay(1);
+  }
+}
+
 void DNSServer::stop()
 {
-  _udp.stop();
-  free(_buffer);
-  _buffer = NULL;
+  stopTask();
+  if (_socket != -1)
+  {
+    close(_socket);
+    _socket = -1;
+  }
 }
 
 void DNSServer::downcaseAndRemoveWwwPrefix(String &domainName)
@@ -75,57 +142,99 @@ void DNSServer::downcaseAndRemoveWwwPrefix(String &domainName)
 
 void DNSServer::processNextRequest()
 {
-  _currentPacketSize = _udp.parsePacket();
-  if (_currentPacketSize)
+  if (_socket == -1)
+    return;
+
+  while (processOneRequest());
+}
+
+// Receives and answers a single packet. Returns false once there are no packets left waiting
+bool DNSServer::processOneRequest()
+{
+  socklen_t addrLength = sizeof(_remoteAddr);
+  _currentPacketSize = recvfrom(_socket, _buffer, DNS_MAX_PACKET_SIZE, MSG_DONTWAIT,
+                                (struct sockaddr*) &_remoteAddr, &addrLength);
+  if (_currentPacketSize < 0)
+    return false;
+
+  // A packet too short to hold a header (eg stopTask()'s wakeup). A full buffer may have been truncated, so drop it too
+  if (_currentPacketSize < DNS_HEADER_SIZE || _currentPacketSize >= DNS_MAX_PACKET_SIZE)
+    return true;
+
+  if (_dnsHeader->QR != DNS_QR_QUERY)
+    return true;
+
+  size_t questionLength = 0;
+  if (_dnsHeader->OPCode == DNS_OPCODE_QUERY && requestIncludesOnlyOneQuestion())
+    questionLength = questionEnd();
+
+  if (questionLength && (_domainName == "*" || questionMatchesDomain()))
   {
-    // Allocate buffer for the DNS query
-    if (_buffer != NULL) 
-      free(_buffer);
-    _buffer = (unsigned char*)malloc(_currentPacketSize * sizeof(char));
-    if (_buffer == NULL) 
-      return;
-
-    // Put the packet received in the buffer and get DNS header (beginning of message)
-    // and the question
-    _udp.read(_buffer, _currentPacketSize);
-    memcpy( _dnsHeader, _buffer, DNS_HEADER_SIZE ) ; 
-    if ( requestIncludesOnlyOneQuestion() )
-    {
-      // The QName has a variable length, maximum 255 bytes and is comprised of multiple labels.
-      // Each label contains a byte to describe its length and the label itself. The list of 
-      // labels terminates with a zero-valued byte. In "github.com", we have two labels "github" & "com"
-      // Iterate through the labels and copy them as they come into a single buffer (for simplicity's sake)
-      _dnsQuestion->QNameLength = 0 ;
-      while ( _buffer[ DNS_HEADER_SIZE + _dnsQuestion->QNameLength ] != 0 )
-      {
-        memcpy( (void*) &_dnsQuestion->QName[_dnsQuestion->QNameLength], (void*) &_buffer[DNS_HEADER_SIZE + _dnsQuestion->QNameLength], _buffer[DNS_HEADER_SIZE + _dnsQuestion->QNameLength] + 1 ) ;
-        _dnsQuestion->QNameLength += _buffer[DNS_HEADER_SIZE + _dnsQuestion->QNameLength] + 1 ; 
-      }
-      _dnsQuestion->QName[_dnsQuestion->QNameLength] = 0 ; 
-      _dnsQuestion->QNameLength++ ;   
-
-      // Copy the QType and QClass 
-      memcpy( &_dnsQuestion->QType, (void*) &_buffer[DNS_HEADER_SIZE + _dnsQuestion->QNameLength], sizeof(_dnsQuestion->QType) ) ;
-      memcpy( &_dnsQuestion->QClass, (void*) &_buffer[DNS_HEADER_SIZE + _dnsQuestion->QNameLength + sizeof(_dnsQuestion->QType)], sizeof(_dnsQuestion->QClass) ) ;
-    }
-    
+    replyWithIP(questionLength);
+  }
+  else
+  {
+    replyWithCustomCode();
+  }
+  return true;
+}
+
+// Returns the offset just past the (single) question's QType and QClass, or 0 if it's malformed.
+// The QName has a variable length, maximum 255 bytes and is comprised of multiple labels.
+// Each label contains a byte to describe its length and the label itself. The list of 
+// labels terminates with a zero-valued byte. In "github.com", we have two labels "github" & "com"
+size_t DNSServer::questionEnd()
+{
+  size_t pos = DNS_HEADER_SIZE;
+  while (pos < (size_t)_currentPacketSize && _buffer[pos] != 0)
+  {
+    // Compression pointers aren't allowed in a lone question
+    if (_buffer[pos] & 0xC0)
+      return 0;
+    pos += _buffer[pos] + 1;
+  }
 
-    if (_dnsHeader->QR == DNS_QR_QUERY &&
-        _dnsHeader->OPCode == DNS_OPCODE_QUERY &&
-        requestIncludesOnlyOneQuestion() &&
-        (_domainName == "*" || getDomainNameWithoutWwwPrefix() == _domainName)
-       )
+  pos += 1 + 2 * sizeof(uint16_t); // terminating zero, QType & QClass
+  if (pos > (size_t)_currentPacketSize)
+    return 0;
+  return pos;
+}
+
+// Compares the question's QName against _domainName in place, ignoring case and a leading "www" label
+bool DNSServer::questionMatchesDomain()
+{
+  const unsigned char *label = _buffer + DNS_OFFSET_DOMAIN_NAME;
+  const char *domain = _domainName.c_str();
+  const char *end = domain + _domainName.length();
+
+  if (label[0] == 3 && tolower(label[1]) == 'w' && tolower(label[2]) == 'w' && tolower(label[3]) == 'w')
+    label += 4;
+
+  while (*label)
+  {
+    // Labels are matched by length against the name's next dot-separated part, so any byte inside a
+    // label (even 0x00 or '.') is only ever compared, never taken for the end of the name or a dot
+    unsigned char labelLength = *label++;
+    const char *dot = (const char *)memchr(domain, '.', end - domain);
+    size_t partLength = (dot ? dot : end) - domain;
+    if (partLength != labelLength)
+      return false;
+    for (unsigned char i = 0; i < labelLength; i++)
     {
-      replyWithIP();
+      if (tolower(label[i]) != domain[i])
+        return false;
     }
-    else if (_dnsHeader->QR == DNS_QR_QUERY)
+    label += labelLength;
+    domain += partLength;
+
+    if (*label)
     {
-      replyWithCustomCode();
+      if (domain == end)
+        return false;
+      domain++;
     }
-
-    free(_buffer);
-    _buffer = NULL;
   }
+  return domain == end;
 }
 
 bool DNSServer::requestIncludesOnlyOneQuestion()
@@ -139,11 +248,9 @@ bool DNSServer::requestIncludesOnlyOneQuestion()
 
 String DNSServer::getDomainNameWithoutWwwPrefix()
 {
-  // Error checking : if the buffer containing the DNS request is a null pointer, return an empty domain
+  // Only used for debug output; the request path matches names in place with questionMatchesDomain()
   String parsedDomainName = "";
-  if (_buffer == NULL) 
-    return parsedDomainName;
-  
+
   // Set the start of the domain just after the header (12 bytes). If equal to null character, return an empty domain
   unsigned char *start = _buffer + DNS_OFFSET_DOMAIN_NAME;
   if (*start == 0)
@@ -173,37 +280,33 @@ String DNSServer::getDomainNameWithoutWwwPrefix()
   }
 }
 
-void DNSServer::replyWithIP()
+void DNSServer::replyWithIP(size_t questionLength)
 {
-  _udp.beginPacket(_udp.remoteIP(), _udp.remotePort());
-  
   // Change the type of message to a response and set the number of answers equal to 
-  // the number of questions in the header
+  // the number of questions in the header. The question itself is left where it is
   _dnsHeader->QR      = DNS_QR_RESPONSE;
   _dnsHeader->ANCount = _dnsHeader->QDCount;
-  _udp.write( (unsigned char*) _dnsHeader, DNS_HEADER_SIZE ) ;
 
-  // Write the question
-  _udp.write(_dnsQuestion->QName, _dnsQuestion->QNameLength) ;
-  _udp.write( (unsigned char*) &_dnsQuestion->QType, 2 ) ;
-  _udp.write( (unsigned char*) &_dnsQuestion->QClass, 2 ) ;
-
-  // Write the answer 
+  // Write the answer right after the question
   // Use DNS name compression : instead of repeating the name in this RNAME occurence,
   // set the two MSB of the byte corresponding normally to the length to 1. The following
   // 14 bits must be used to specify the offset of the domain name in the message 
   // (<255 here so the first byte has the 6 LSB at 0) 
-  _udp.write((uint8_t) 0xC0); 
-  _udp.write((uint8_t) DNS_OFFSET_DOMAIN_NAME);  
+  unsigned char *answer = _buffer + questionLength;
+  answer[0] = 0xC0;
+  answer[1] = DNS_OFFSET_DOMAIN_NAME;
 
   // DNS type A : host address, DNS class IN for INternet, returning an IPv4 address 
-  uint16_t answerType = htons(DNS_TYPE_A), answerClass = htons(DNS_CLASS_IN), answerIPv4 = htons(DNS_RDLENGTH_IPV4)  ; 
-  _udp.write((unsigned char*) &answerType, 2 );
-  _udp.write((unsigned char*) &answerClass, 2 );
-  _udp.write((unsigned char*) &_ttl, 4);        // DNS Time To Live
-  _udp.write((unsigned char*) &answerIPv4, 2 );
-  _udp.write(_resolvedIP, sizeof(_resolvedIP)); // The IP address to return
-  _udp.endPacket();
+  answer[2] = 0;
+  answer[3] = DNS_TYPE_A;
+  answer[4] = 0;
+  answer[5] = DNS_CLASS_IN;
+  memcpy(&answer[6], &_ttl, 4);                           // DNS Time To Live
+  answer[10] = 0;
+  answer[11] = DNS_RDLENGTH_IPV4;
+  memcpy(&answer[12], _resolvedIP, sizeof(_resolvedIP)); // The IP address to return
+
+  sendReply(questionLength + DNS_ANSWER_SIZE);
 
   #ifdef DEBUG_ESP_DNS
     DEBUG_OUTPUT.printf("DNS responds: %s for %s\n",
@@ -217,7 +320,10 @@ void DNSServer::replyWithCustomCode()
   _dnsHeader->RCode = (unsigned char)_errorReplyCode;
   _dnsHeader->QDCount = 0;
 
-  _udp.beginPacket(_udp.remoteIP(), _udp.remotePort());
-  _udp.write((unsigned char*)_dnsHeader, sizeof(DNSHeader));
-  _udp.endPacket();
+  sendReply(sizeof(DNSHeader));
+}
+
+void DNSServer::sendReply(size_t length)
+{
+  sendto(_socket, _buffer, length, 0, (struct sockaddr*) &_remoteAddr, sizeof(_remoteAddr));
 }
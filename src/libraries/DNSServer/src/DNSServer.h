@@ -1,6 +1,9 @@
 #ifndef DNSServer_h
 #define DNSServer_h
 #include <WiFiUdp.h>
+#include <lwip/sockets.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 
 #define DNS_QR_QUERY 0
 #define DNS_QR_RESPONSE 1
@@ -8,6 +11,10 @@
 #define DNS_DEFAULT_TTL 60        // Default Time To Live : time interval in seconds that the resource record should be cached before being discarded
 #define DNS_OFFSET_DOMAIN_NAME 12 // Offset in bytes to reach the domain name in the DNS message 
 #define DNS_HEADER_SIZE 12 
+#define DNS_MAX_PACKET_SIZE 512   // Largest query accepted (classic UDP DNS limit); bigger packets are dropped
+#define DNS_ANSWER_SIZE 16        // Size of the single A record appended to a query to form the reply
+#define DNS_TASK_STACK_SIZE 3072  // Stack for the task started by startTask()
+#define DNS_TASK_PRIORITY 2       // Just above the Arduino loop() task so lookups aren't held up by it
 
 enum class DNSReplyCode
 {
@@ -64,19 +71,12 @@ struct DNSHeader
   uint16_t ARCount;          // number of resource entries
 };
 
-struct DNSQuestion
-{
-  uint8_t   QName[256] ; //need 1 Byte for zero termination!
-  uint16_t  QNameLength ; 
-  uint16_t  QType ; 
-  uint16_t  QClass ; 
-} ; 
-
 class DNSServer
 {
   public:
     DNSServer();
     ~DNSServer();
+    // Answers every query that has already arrived, without waiting for more
     void processNextRequest();
     void setErrorReplyCode(const DNSReplyCode &replyCode);
     void setTTL(const uint32_t &ttl);
@@ -85,26 +85,38 @@ class DNSServer
     bool start(const uint16_t &port,
               const String &domainName,
               const IPAddress &resolvedIP);
+    // Instead of polling processNextRequest(), answers queries from a task that sleeps until one arrives.
+    // Call after start(); stop() ends the task. Returns false if the task couldn't be created
+    bool startTask(UBaseType_t priority = DNS_TASK_PRIORITY, BaseType_t core = tskNO_AFFINITY);
     // stops the DNS server
     void stop();
 
   private:
-    WiFiUDP _udp;
+    int _socket;
     uint16_t _port;
     String _domainName;
     unsigned char _resolvedIP[4];
     int _currentPacketSize;
-    unsigned char* _buffer;
+    // The query is received into _buffer and the reply is built over it in place, so no per-packet allocation
+    unsigned char _buffer[DNS_MAX_PACKET_SIZE + DNS_ANSWER_SIZE] __attribute__((aligned(4)));
     DNSHeader* _dnsHeader;
+    struct sockaddr_in _remoteAddr;
     uint32_t _ttl;
     DNSReplyCode _errorReplyCode;
-    DNSQuestion*    _dnsQuestion ; 
+    TaskHandle_t volatile _task;
+    volatile bool _stopTask;
 
 
+    static void taskLoop(void *dnsServer);
+    void stopTask();
+    bool processOneRequest();
     void downcaseAndRemoveWwwPrefix(String &domainName);
     String getDomainNameWithoutWwwPrefix();
+    size_t questionEnd();
+    bool questionMatchesDomain();
     bool requestIncludesOnlyOneQuestion();
-    void replyWithIP();
+    void replyWithIP(size_t questionLength);
     void replyWithCustomCode();
+    void sendReply(size_t length);
 };
 #endif
@@ -20,107 +20,85 @@
 #include "Arduino.h"
 #include "AsyncEventSource.h"
 
-static String generateEventMessage(const char *message, const char *event, uint32_t id, uint32_t reconnect){
-  String ev = "";
+// Appends len bytes of str at out + at, unless out is NULL (when only the length is wanted)
+static size_t appendEvent(char *out, size_t at, const char *str, size_t len){
+  if(out != NULL)
+    memcpy(out + at, str, len);
+  return len;
+}
+
+// Writes the event to out & returns its length; called with out NULL first to size the buffer
+static size_t formatEventMessage(char *out, const char *message, size_t messageLen, const char *event, uint32_t id, uint32_t reconnect){
+  size_t at = 0;
+  char num[12];
 
   if(reconnect){
-    ev += "retry: ";
-    ev += String(reconnect);
-    ev += "\r\n";
+    at += appendEvent(out, at, "retry: ", 7);
+    at += appendEvent(out, at, num, snprintf(num, sizeof(num), "%lu", (unsigned long)reconnect));
+    at += appendEvent(out, at, "\r\n", 2);
   }
 
   if(id){
-    ev += "id: ";
-    ev += String(id);
-    ev += "\r\n";
+    at += appendEvent(out, at, "id: ", 4);
+    at += appendEvent(out, at, num, snprintf(num, sizeof(num), "%lu", (unsigned long)id));
+    at += appendEvent(out, at, "\r\n", 2);
   }
 
   if(event != NULL){
-    ev += "event: ";
-    ev += String(event);
-    ev += "\r\n";
+    at += appendEvent(out, at, "event: ", 7);
+    at += appendEvent(out, at, event, strlen(event));
+    at += appendEvent(out, at, "\r\n", 2);
   }
 
   if(message != NULL){
-    size_t messageLen = strlen(message);
-    char * lineStart = (char *)message;
-    char * lineEnd;
+    // One data: line per line of the message, which may end in \r\n, \n\r, \r or \n
+    const char * end = message + messageLen;
+    const char * lineStart = message;
     do {
-      char * nextN = strchr(lineStart, '\n');
-      char * nextR = strchr(lineStart, '\r');
-      if(nextN == NULL && nextR == NULL){
-        size_t llen = ((char *)message + messageLen) - lineStart;
-        char * ldata = (char *)malloc(llen+1);
-        if(ldata != NULL){
-          memcpy(ldata, lineStart, llen);
-          ldata[llen] = 0;
-          ev += "data: ";
-          ev += ldata;
-          ev += "\r\n\r\n";
-          free(ldata);
-        }
-        lineStart = (char *)message + messageLen;
-      } else {
-        char * nextLine = NULL;
-        if(nextN != NULL && nextR != NULL){
-          if(nextR < nextN){
-            lineEnd = nextR;
-            if(nextN == (nextR + 1))
-              nextLine = nextN + 1;
-            else
-              nextLine = nextR + 1;
-          } else {
-            lineEnd = nextN;
-            if(nextR == (nextN + 1))
-              nextLine = nextR + 1;
-            else
-              nextLine = nextN + 1;
-          }
-        } else if(nextN != NULL){
-          lineEnd = nextN;
-          nextLine = nextN + 1;
-        } else {
-          lineEnd = nextR;
-          nextLine = nextR + 1;
-        }
-
-        size_t llen = lineEnd - lineStart;
-        char * ldata = (char *)malloc(llen+1);
-        if(ldata != NULL){
-          memcpy(ldata, lineStart, llen);
-          ldata[llen] = 0;
-          ev += "data: ";
-          ev += ldata;
-          ev += "\r\n";
-          free(ldata);
-        }
-        lineStart = nextLine;
-        if(lineStart == ((char *)message + messageLen))
-          ev += "\r\n";
-      }
-    } while(lineStart < ((char *)message + messageLen));
+      const char * lineEnd = lineStart;
+      while(lineEnd < end && *lineEnd != '\r' && *lineEnd != '\n')
+        lineEnd++;
+      const char * nextLine = lineEnd;
+      if(lineEnd < end)
+        nextLine += (lineEnd + 1 < end && lineEnd[1] == (*lineEnd == '\r' ? '\n' : '\r')) ? 2 : 1;
+      at += appendEvent(out, at, "data: ", 6);
+      at += appendEvent(out, at, lineStart, lineEnd - lineStart);
+      at += appendEvent(out, at, "\r\n", 2);
+      if(nextLine == end)
+        at += appendEvent(out, at, "\r\n", 2);
+      lineStart = nextLine;
+    } while(lineStart < end);
   }
 
+  return at;
+}
+
+// The event formatted straight into a shared buffer the caller owns, or NULL if out of memory
+static AsyncWebSharedBuffer *generateEventMessage(const char *message, size_t messageLen, const char *event, uint32_t id, uint32_t reconnect){
+  AsyncWebSharedBuffer * ev = AsyncWebSharedBuffer::create(formatEventMessage(NULL, message, messageLen, event, id, reconnect));
+  if(ev != NULL)
+    formatEventMessage((char *)ev->data(), message, messageLen, event, id, reconnect);
   return ev;
 }
 
+static AsyncWebSharedBuffer *generateEventMessage(const char *message, const char *event, uint32_t id, uint32_t reconnect){
+  return generateEventMessage(message, message != NULL ? strlen(message) : 0, event, id, reconnect);
+}
+
 // Message
 
-AsyncEventSourceMessage::AsyncEventSourceMessage(const char * data, size_t len)
-: _data(nullptr), _len(len), _sent(0), _acked(0)
+AsyncEventSourceMessage::AsyncEventSourceMessage(AsyncWebSharedBuffer * buffer)
+: _buffer(buffer), _len(0), _sent(0), _acked(0)
 {
-  _data = (uint8_t*)malloc(_len+1);
-  if(_data == nullptr){
-    _len = 0;
-  } else {
-    memcpy(_data, data, len);
-    _data[_len] = 0;
+  if(_buffer != nullptr){
+    _buffer->retain();
+    _len = _buffer->length();
   }
 }
 
 AsyncEventSourceMessage::~AsyncEventSourceMessage() {
-     if(_data != NULL)
-        free(_data);
+     if(_buffer != NULL)
+        _buffer->release();
 }
 
 size_t AsyncEventSourceMessage::ack(size_t len, uint32_t time) {
@@ -142,7 +120,7 @@ size_t AsyncEventSourceMessage::send(AsyncClient *client) {
   if(client->space() < len){
     return 0;
   }
-  size_t sent = client->add((const char *)_data, len);
+  size_t sent = client->add((const char *)_buffer->data() + _sent, len);
   if(client->canSend())
     client->send();
   _sent += sent;
@@ -152,7 +130,8 @@ size_t AsyncEventSourceMessage::send(AsyncClient *client) {
 // Client
 
 AsyncEventSourceClient::AsyncEventSourceClient(AsyncWebServerRequest *request, AsyncEventSource *server)
-: _messageQueue(LinkedList<AsyncEventSourceMessage *>([](AsyncEventSourceMessage *m){ delete  m; }))
+: _messageQueue([](AsyncEventSourceMessage *m){ delete  m; })
+, _next(NULL)
 {
   _client = request->client();
   _server = server;
@@ -173,7 +152,8 @@ AsyncEventSourceClient::AsyncEventSourceClient(AsyncWebServerRequest *request, A
 }
 
 AsyncEventSourceClient::~AsyncEventSourceClient(){
-   _messageQueue.free();
+   _messageQueue.clear();
+   delete _next;
   close();
 }
 
@@ -184,28 +164,36 @@ void AsyncEventSourceClient::_queueMessage(AsyncEventSourceMessage *dataMessage)
     delete dataMessage;
     return;
   }
-  if(_messageQueue.length() >= SSE_MAX_QUEUED_MESSAGES){
+  if(!_messageQueue.push(dataMessage, _server->queuePolicy())){
       ets_printf("ERROR: Too many messages queued\n");
-      delete dataMessage;
-  } else {
-      _messageQueue.add(dataMessage);
   }
   if(_client->canSend())
     _runQueue();
 }
 
-void AsyncEventSourceClient::_onAck(size_t len, uint32_t time){
-  while(len && !_messageQueue.isEmpty()){
-    len = _messageQueue.front()->ack(len, time);
-    if(_messageQueue.front()->finished())
-      _messageQueue.remove(_messageQueue.front());
-  }
+// Topic values are only taken once there's room to send, so the newest one is what gets sent
+bool AsyncEventSourceClient::_takeTopic(){
+  if(!_client->canSend() || !_client->space())
+    return false;
+  AsyncWebSharedBuffer * ev = _topics.next(_server->topics());
+  if(ev == NULL)
+    return false;
+  _next = new AsyncEventSourceMessage(ev);
+  ev->release();
+  return _next != NULL;
+}
 
+void AsyncEventSourceClient::_onPublish(){
+  if(connected() && _client->canSend())
+    _runQueue();
+}
+
+void AsyncEventSourceClient::_onAck(size_t len __attribute__((unused)), uint32_t time __attribute__((unused))){
   _runQueue();
 }
 
 void AsyncEventSourceClient::_onPoll(){
-  if(!_messageQueue.isEmpty()){
+  if(_next != NULL || !_messageQueue.isEmpty() || _server->topics().count()){
     _runQueue();
   }
 }
@@ -226,24 +214,41 @@ void AsyncEventSourceClient::close(){
 }
 
 void AsyncEventSourceClient::write(const char * message, size_t len){
-  _queueMessage(new AsyncEventSourceMessage(message, len));
+  AsyncWebSharedBuffer * buffer = AsyncWebSharedBuffer::create(len);
+  if(buffer == NULL)
+    return;
+  memcpy(buffer->data(), message, len);
+  write(buffer);
+  buffer->release();
+}
+
+// Queues a reference to an already formatted event; the caller keeps its own reference
+void AsyncEventSourceClient::write(AsyncWebSharedBuffer * message){
+  if(message != NULL)
+    _queueMessage(new AsyncEventSourceMessage(message));
 }
 
 void AsyncEventSourceClient::send(const char *message, const char *event, uint32_t id, uint32_t reconnect){
-  String ev = generateEventMessage(message, event, id, reconnect);
-  _queueMessage(new AsyncEventSourceMessage(ev.c_str(), ev.length()));
+  AsyncWebSharedBuffer * ev = generateEventMessage(message, event, id, reconnect);
+  write(ev);
+  if(ev != NULL)
+    ev->release();
 }
 
+// Sends queued events in order for as long as each fits whole. TCP copies what it's given, so an
+// event is done with once sent; only one task at a time gets past the runner.
 void AsyncEventSourceClient::_runQueue(){
-  while(!_messageQueue.isEmpty() && _messageQueue.front()->finished()){
-    _messageQueue.remove(_messageQueue.front());
-  }
-
-  for(auto i = _messageQueue.begin(); i != _messageQueue.end(); ++i)
-  {
-    if(!(*i)->sent())
-      (*i)->send(_client);
-  }
+  if(!_runner.request())
+    return;
+  do {
+    _runner.start();
+    while(_next != NULL || _messageQueue.pop(_next) || _takeTopic()){
+      if(!_next->sent() && !_next->send(_client))
+        break;
+      delete _next;
+      _next = NULL;
+    }
+  } while(_runner.next());
 }
 
 
@@ -251,8 +256,11 @@ void AsyncEventSourceClient::_runQueue(){
 
 AsyncEventSource::AsyncEventSource(const String& url)
   : _url(url)
-  , _clients(LinkedList<AsyncEventSourceClient *>([](AsyncEventSourceClient *c){ delete c; }))
+  , _clients([this](AsyncEventSourceClient *c){ _retiredClients.add(c); })
+  , _walking(0)
+  , _retiredClients(nullptr)
   , _connectcb(NULL)
+  , _queuePolicy(QUEUE_DROP_NEWEST)
 {}
 
 AsyncEventSource::~AsyncEventSource(){
@@ -277,24 +285,69 @@ void AsyncEventSource::_addClient(AsyncEventSourceClient * client){
     free(temp);
   }*/
   
-  _clients.add(client);
+  {
+    AsyncWebLockGuard l(_lock);
+    _clients.add(client);
+  }
   if(_connectcb)
     _connectcb(client);
+  if(_topics.count())
+    client->_onPublish();
 }
 
 void AsyncEventSource::_handleDisconnect(AsyncEventSourceClient * client){
-  _clients.remove(client);
+  {
+    AsyncWebLockGuard l(_lock);
+    _clients.remove(client);
+  }
+  _collectClients();
 }
 
-void AsyncEventSource::close(){
-  for(const auto &c: _clients){
-    if(c->connected())
-      c->close();
+// Runs fn on every connected client without holding _lock: sends block on the TCP/IP task, which
+// can be waiting on AsyncTCP's task, which takes _lock to add & drop clients
+void AsyncEventSource::_forEachConnected(std::function<void(AsyncEventSourceClient *)> fn){
+  AsyncWebList<AsyncEventSourceClient *, 8> clients(nullptr);
+  {
+    AsyncWebLockGuard l(_lock);
+    for(const auto &c: _clients){
+      if(c->connected())
+        clients.add(c);
+    }
+    _walking++;
+  }
+  for(const auto &c: clients)
+    fn(c);
+  {
+    AsyncWebLockGuard l(_lock);
+    _walking--;
+  }
+  _collectClients();
+}
+
+// Deletes the clients that disconnected while sends were walking them, once none is
+void AsyncEventSource::_collectClients(){
+  for(;;){
+    AsyncEventSourceClient *client;
+    {
+      AsyncWebLockGuard l(_lock);
+      if(_walking || _retiredClients.isEmpty())
+        return;
+      client = _retiredClients.front();
+      _retiredClients.remove(client);
+    }
+    delete client;
   }
 }
 
+void AsyncEventSource::close(){
+  _forEachConnected([](AsyncEventSourceClient *c){
+    c->close();
+  });
+}
+
 // pmb fix
 size_t AsyncEventSource::avgPacketsWaiting() const {
+  AsyncWebLockGuard l(_lock);
   if(_clients.isEmpty())
     return 0;
   
@@ -312,17 +365,35 @@ size_t AsyncEventSource::avgPacketsWaiting() const {
 }
 
 void AsyncEventSource::send(const char *message, const char *event, uint32_t id, uint32_t reconnect){
+  AsyncWebSharedBuffer * ev = generateEventMessage(message, event, id, reconnect);
+  if(ev == NULL)
+    return;
+  _forEachConnected([=](AsyncEventSourceClient *c){
+    c->write(ev);
+  });
+  ev->release();
+}
 
+AsyncWebTopic * AsyncEventSource::topic(const char *event){
+  return _topics.add(new AsyncEventSourceTopic(this, event));
+}
 
-  String ev = generateEventMessage(message, event, id, reconnect);
-  for(const auto &c: _clients){
-    if(c->connected()) {
-      c->write(ev.c_str(), ev.length());
-    }
-  }
+void AsyncEventSource::_onPublish(){
+  _forEachConnected([](AsyncEventSourceClient *c){
+    c->_onPublish();
+  });
+}
+
+AsyncWebSharedBuffer *AsyncEventSourceTopic::_format(const char *message, size_t len){
+  return generateEventMessage(message, len, _event.c_str(), 0, 0);
+}
+
+void AsyncEventSourceTopic::_notify(){
+  _server->_onPublish();
 }
 
 size_t AsyncEventSource::count() const {
+  AsyncWebLockGuard l(_lock);
   return _clients.count_if([](AsyncEventSourceClient *c){
     return c->connected();
   });
@@ -336,6 +407,12 @@ bool AsyncEventSource::canHandle(AsyncWebServerRequest *request){
   return true;
 }
 
+WebRouteKind AsyncEventSource::route(String& path, WebRequestMethodComposite& methods) const {
+  path = _url;
+  methods = HTTP_GET;
+  return ROUTE_EXACT;
+}
+
 void AsyncEventSource::handleRequest(AsyncWebServerRequest *request){
   if((_username != "" && _password != "") && !request->authenticate(_username.c_str(), _password.c_str()))
     return request->requestAuthentication();
@@ -354,8 +431,13 @@ AsyncEventSourceResponse::AsyncEventSourceResponse(AsyncEventSource *server){
 }
 
 void AsyncEventSourceResponse::_respond(AsyncWebServerRequest *request){
-  String out = _assembleHead(request->version());
-  request->client()->write(out.c_str(), _headLength);
+  if(!_buildHead(request->version())){
+    _state = RESPONSE_FAILED;
+    request->client()->close(true);
+    return;
+  }
+  request->client()->write(_head, _headLength);
+  _freeHead();
   _state = RESPONSE_WAIT_ACK;
 }
 
@@ -31,6 +31,9 @@
 #include <ESPAsyncWebServer.h>
 
 #include "AsyncWebSynchronization.h"
+#include "WebSharedBuffer.h"
+#include "WebQueue.h"
+#include "WebTopic.h"
 
 #ifdef ESP8266
 #include <Hash.h>
@@ -50,15 +53,16 @@ class AsyncEventSourceResponse;
 class AsyncEventSourceClient;
 typedef std::function<void(AsyncEventSourceClient *client)> ArEventHandlerFunction;
 
+// A client's cursor into a formatted event, which is shared by every client it was sent to
 class AsyncEventSourceMessage {
   private:
-    uint8_t * _data; 
+    AsyncWebSharedBuffer * _buffer;
     size_t _len;
     size_t _sent;
     //size_t _ack;
     size_t _acked; 
   public:
-    AsyncEventSourceMessage(const char * data, size_t len);
+    AsyncEventSourceMessage(AsyncWebSharedBuffer * buffer);
     ~AsyncEventSourceMessage();
     size_t ack(size_t len, uint32_t time __attribute__((unused)));
     size_t send(AsyncClient *client);
@@ -71,9 +75,13 @@ class AsyncEventSourceClient {
     AsyncClient *_client;
     AsyncEventSource *_server;
     uint32_t _lastId;
-    LinkedList<AsyncEventSourceMessage *> _messageQueue;
+    AsyncWebQueue<AsyncEventSourceMessage *, SSE_MAX_QUEUED_MESSAGES> _messageQueue;
+    AsyncEventSourceMessage *_next; // taken off the queue, waiting for room to send
+    AsyncWebQueueRunner _runner;
+    AsyncWebTopicCursor _topics;
     void _queueMessage(AsyncEventSourceMessage *dataMessage);
     void _runQueue();
+    bool _takeTopic();
 
   public:
 
@@ -83,12 +91,14 @@ class AsyncEventSourceClient {
     AsyncClient* client(){ return _client; }
     void close();
     void write(const char * message, size_t len);
+    void write(AsyncWebSharedBuffer * message);
     void send(const char *message, const char *event=NULL, uint32_t id=0, uint32_t reconnect=0);
     bool connected() const { return (_client != NULL) && _client->connected(); }
     uint32_t lastId() const { return _lastId; }
-    size_t  packetsWaiting() const { return _messageQueue.length(); }
+    size_t  packetsWaiting() const { return _messageQueue.length() + (_next != NULL); }
 
     //system callbacks (do not call)
+    void _onPublish();
     void _onAck(size_t len, uint32_t time);
     void _onPoll(); 
     void _onTimeout(uint32_t time);
@@ -98,8 +108,16 @@ class AsyncEventSourceClient {
 class AsyncEventSource: public AsyncWebHandler {
   private:
     String _url;
-    LinkedList<AsyncEventSourceClient *> _clients;
+    AsyncWebList<AsyncEventSourceClient *> _clients;
+    AsyncWebLock _lock; // _clients is changed by the AsyncTCP task while the sketch's sends walk it
+    size_t _walking; // sends running on a snapshot of _clients, outside _lock
+    AsyncWebList<AsyncEventSourceClient *> _retiredClients; // removed meanwhile, & deleted by _collectClients()
     ArEventHandlerFunction _connectcb;
+    AwsQueuePolicy _queuePolicy;
+    AsyncWebTopics _topics;
+
+    void _forEachConnected(std::function<void(AsyncEventSourceClient *)> fn);
+    void _collectClients();
   public:
     AsyncEventSource(const String& url);
     ~AsyncEventSource();
@@ -107,17 +125,37 @@ class AsyncEventSource: public AsyncWebHandler {
     const char * url() const { return _url.c_str(); }
     void close();
     void onConnect(ArEventHandlerFunction cb);
+    // What a client's full message queue does with one more event (default QUEUE_DROP_NEWEST)
+    void setQueuePolicy(AwsQueuePolicy policy){ _queuePolicy = policy; }
+    AwsQueuePolicy queuePolicy() const { return _queuePolicy; }
     void send(const char *message, const char *event=NULL, uint32_t id=0, uint32_t reconnect=0);
     size_t count() const; //number clinets connected
     size_t  avgPacketsWaiting() const;
 
+    // A new latest-value topic sent as `event`, owned by the source; NULL past ASYNCWEB_MAX_TOPICS
+    AsyncWebTopic * topic(const char *event);
+    const AsyncWebTopics & topics() const { return _topics; }
+
     //system callbacks (do not call)
     void _addClient(AsyncEventSourceClient * client);
     void _handleDisconnect(AsyncEventSourceClient * client);
+    void _onPublish();
     virtual bool canHandle(AsyncWebServerRequest *request) override final;
+    virtual WebRouteKind route(String& path, WebRequestMethodComposite& methods) const override final;
     virtual void handleRequest(AsyncWebServerRequest *request) override final;
 };
 
+class AsyncEventSourceTopic: public AsyncWebTopic {
+  private:
+    AsyncEventSource *_server;
+    String _event;
+  protected:
+    virtual AsyncWebSharedBuffer *_format(const char *message, size_t len) override;
+    virtual void _notify() override;
+  public:
+    AsyncEventSourceTopic(AsyncEventSource *server, const char *event): _server(server), _event(event) {}
+};
+
 class AsyncEventSourceResponse: public AsyncWebServerResponse {
   private:
     String _content;
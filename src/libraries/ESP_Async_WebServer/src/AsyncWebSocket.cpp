@@ -40,6 +40,40 @@ size_t webSocketSendFrameWindow(AsyncClient *client){
   return space - 8;
 }
 
+typedef uint32_t __attribute__((__may_alias__)) webSocketWord;
+
+// XORs `data` with a frame's 4-byte `mask`, starting `offset` bytes into its payload. Aligned words
+// take the mask rotated to line up with them, so there's no per-byte modulo; only the unaligned
+// head & the tail go a byte at a time.
+void webSocketMask(uint8_t *data, size_t len, const uint8_t *mask, size_t offset){
+  size_t k = offset & 3;
+  while(len && ((uintptr_t)data & 3)){
+    *data++ ^= mask[k];
+    k = (k + 1) & 3;
+    len--;
+  }
+  if(len >= 4){
+    // Built in memory order, so one word XOR matches the byte loop on either endianness
+    const uint8_t rotated[4] = { mask[k], mask[(k + 1) & 3], mask[(k + 2) & 3], mask[(k + 3) & 3] };
+    webSocketWord m;
+    memcpy(&m, rotated, 4);
+    webSocketWord *words = (webSocketWord*)data;
+    size_t n = len >> 2;
+    for(; n >= 2; n -= 2, words += 2){
+      words[0] ^= m;
+      words[1] ^= m;
+    }
+    if(n)
+      *words++ ^= m;
+    data = (uint8_t*)words;
+    len &= 3;
+  }
+  while(len--){
+    *data++ ^= mask[k];
+    k = (k + 1) & 3;
+  }
+}
+
 size_t webSocketSendFrame(AsyncClient *client, bool final, uint8_t opcode, bool mask, uint8_t *data, size_t len){
   if(!client->canSend())
     return 0;
@@ -92,9 +126,7 @@ size_t webSocketSendFrame(AsyncClient *client, bool final, uint8_t opcode, bool
 
   if(len){
     if(len && mask){
-      size_t i;
-      for(i=0;i<len;i++)
-        data[i] = data[i] ^ mbuf[i%4];
+      webSocketMask(data, len, mbuf, 0);
     }
     if(client->add((const char *)data, len) != len){
       //os_printf("error adding %lu data bytes\n", len);
@@ -108,6 +140,36 @@ size_t webSocketSendFrame(AsyncClient *client, bool final, uint8_t opcode, bool
   return len;
 }
 
+// A whole unmasked frame with FIN set, as servers send them, for a payload of len bytes; the
+// payload is copied from data, or left for the caller to fill in at the end of the frame if data
+// is NULL. The caller owns the returned reference.
+static AsyncWebSharedBuffer *webSocketFrame(uint8_t opcode, const uint8_t *data, size_t len){
+  size_t headLen = (len < 126) ? 2 : (len < 0x10000) ? 4 : 10;
+  AsyncWebSharedBuffer *frame = AsyncWebSharedBuffer::create(headLen + len);
+  if(frame == NULL)
+    return NULL;
+  uint8_t *buf = frame->data();
+  buf[0] = 0x80 | (opcode & 0x0F);
+  if(len < 126){
+    buf[1] = len;
+  } else if(len < 0x10000){
+    buf[1] = 126;
+    buf[2] = (uint8_t)(len >> 8);
+    buf[3] = (uint8_t)len;
+  } else {
+    buf[1] = 127;
+    for(size_t i = 0; i < 8; i++)
+      buf[9 - i] = (uint8_t)((uint64_t)len >> (8 * i));
+  }
+  if(data != NULL)
+    memcpy(buf + headLen, data, len);
+  return frame;
+}
+
+static uint8_t *webSocketFramePayload(AsyncWebSharedBuffer *frame, size_t len){
+  return frame->data() + frame->length() - len;
+}
+
 
 /*
  *    AsyncWebSocketMessageBuffer
@@ -457,6 +519,64 @@ AsyncWebSocketMultiMessage::~AsyncWebSocketMultiMessage() {
 }
 
 
+/*
+ * AsyncWebSocketSharedMessage Message
+ */
+
+AsyncWebSocketSharedMessage::AsyncWebSocketSharedMessage(AsyncWebSharedBuffer * frame)
+  :_frame(frame)
+  ,_sent(0)
+  ,_ack(0)
+  ,_acked(0)
+{
+  if (_frame) {
+    _frame->retain();
+    _status = WS_MSG_SENDING;
+  }
+}
+
+AsyncWebSocketSharedMessage::~AsyncWebSocketSharedMessage() {
+  if (_frame) {
+    _frame->release();
+  }
+}
+
+void AsyncWebSocketSharedMessage::ack(size_t len, uint32_t time)  {
+  (void)time;
+  _acked += len;
+  if(_frame && _sent == _frame->length() && _acked >= _ack){
+    _status = WS_MSG_SENT;
+  }
+}
+
+// The frame is already built, so it goes out as raw bytes in whatever pieces the window allows
+// without waiting for each piece to be acked
+size_t AsyncWebSocketSharedMessage::send(AsyncClient *client)  {
+  if(_status != WS_MSG_SENDING)
+    return 0;
+  size_t toSend = _frame->length() - _sent;
+  if(toSend == 0){
+    if(_acked >= _ack)
+      _status = WS_MSG_SENT;
+    return 0;
+  }
+  if(!client->canSend())
+    return 0;
+  size_t space = client->space();
+  if(space < toSend)
+    toSend = space;
+  if(toSend == 0)
+    return 0;
+
+  size_t sent = client->add((const char *)_frame->data() + _sent, toSend);
+  if(sent)
+    client->send();
+  _sent += sent;
+  _ack += sent;
+  return sent;
+}
+
+
 /*
  * Async WebSocket Client
  */
@@ -464,8 +584,12 @@ AsyncWebSocketMultiMessage::~AsyncWebSocketMultiMessage() {
  const size_t AWSC_PING_PAYLOAD_LEN = 22;
 
 AsyncWebSocketClient::AsyncWebSocketClient(AsyncWebServerRequest *request, AsyncWebSocket *server)
-  : _controlQueue(LinkedList<AsyncWebSocketControl *>([](AsyncWebSocketControl *c){ delete  c; }))
-  , _messageQueue(LinkedList<AsyncWebSocketMessage *>([](AsyncWebSocketMessage *m){ delete  m; }))
+  : _controlQueue([](AsyncWebSocketControl *c){ delete  c; })
+  , _messageQueue([](AsyncWebSocketMessage *m){ delete  m; })
+  , _control(NULL)
+  , _message(NULL)
+  , _ackedLen(0)
+  , _ackTime(0)
   , _tempObject(NULL)
 {
   _client = request->client();
@@ -485,58 +609,104 @@ AsyncWebSocketClient::AsyncWebSocketClient(AsyncWebServerRequest *request, Async
   _server->_addClient(this);
   _server->_handleEvent(this, WS_EVT_CONNECT, request, NULL, 0);
   delete request;
+  // A new client starts from the topics' current values rather than waiting for the next publish
+  if(_server->topics().count())
+    _onPublish();
 }
 
 AsyncWebSocketClient::~AsyncWebSocketClient(){
-  _messageQueue.free();
-  _controlQueue.free();
+  _messageQueue.clear();
+  _controlQueue.clear();
+  delete _message;
+  delete _control;
   _server->_handleEvent(this, WS_EVT_DISCONNECT, NULL, NULL, 0);
 }
 
 void AsyncWebSocketClient::_onAck(size_t len, uint32_t time){
   _lastMessageTime = millis();
-  if(!_controlQueue.isEmpty()){
-    auto head = _controlQueue.front();
-    if(head->finished()){
-      len -= head->len();
-      if(_status == WS_DISCONNECTING && head->opcode() == WS_DISCONNECT){
-        _controlQueue.remove(head);
-        _status = WS_DISCONNECTED;
-        _client->close(true);
-        return;
-      }
-      _controlQueue.remove(head);
-    }
-  }
-  if(len && !_messageQueue.isEmpty()){
-    _messageQueue.front()->ack(len, time);
-  }
+  _ackTime.store(time);
+  _ackedLen.fetch_add(len);
   _server->_cleanBuffers(); 
   _runQueue();
 }
 
 void AsyncWebSocketClient::_onPoll(){
-  if(_client->canSend() && (!_controlQueue.isEmpty() || !_messageQueue.isEmpty())){
+  bool idle = _control == NULL && _message == NULL && _controlQueue.isEmpty() && _messageQueue.isEmpty();
+  if(_client->canSend() && (!idle || _server->topics().count())){
     _runQueue();
-  } else if(_keepAlivePeriod > 0 && _controlQueue.isEmpty() && _messageQueue.isEmpty() && (millis() - _lastMessageTime) >= _keepAlivePeriod){
+  }
+  if(_keepAlivePeriod > 0 && idle && (millis() - _lastMessageTime) >= _keepAlivePeriod){
     ping((uint8_t *)AWSC_PING_PAYLOAD, AWSC_PING_PAYLOAD_LEN);
   }
 }
 
+// Producers on any task & AsyncTCP's acks & polls all end up here; one of them at a time drains
+// the queues while the rest only ask for another pass
 void AsyncWebSocketClient::_runQueue(){
-  while(!_messageQueue.isEmpty() && _messageQueue.front()->finished()){
-    _messageQueue.remove(_messageQueue.front());
+  if(!_runner.request())
+    return;
+  do {
+    _runner.start();
+    if(!_drainQueue())
+      return; // closed, and the client may already be deleted
+  } while(_runner.next());
+}
+
+bool AsyncWebSocketClient::_drainQueue(){
+  size_t len = _ackedLen.exchange(0);
+  if(len){
+    if(_control != NULL && _control->finished()){
+      len -= std::min(len, (size_t)_control->len());
+      bool closing = (_status == WS_DISCONNECTING && _control->opcode() == WS_DISCONNECT);
+      delete _control;
+      _control = NULL;
+      if(closing){
+        _status = WS_DISCONNECTED;
+        _client->close(true);
+        return false;
+      }
+    }
+    if(len && _message != NULL){
+      _message->ack(len, _ackTime.load());
+    }
+  }
+
+  if(_message != NULL && _message->finished()){
+    delete _message;
+    _message = NULL;
+  }
+  while(_message == NULL && _messageQueue.pop(_message)){
+    if(_message->finished()){
+      delete _message;
+      _message = NULL;
+    }
+  }
+  // Topic values are only taken once they can go out, so the newest one is what gets sent
+  if(_message == NULL && _status == WS_CONNECTED && webSocketSendFrameWindow(_client)){
+    AsyncWebSharedBuffer *frame = _topics.next(_server->topics());
+    if(frame != NULL){
+      _message = new AsyncWebSocketSharedMessage(frame);
+      frame->release();
+    }
   }
+  if(_control == NULL)
+    _controlQueue.pop(_control);
 
-  if(!_controlQueue.isEmpty() && (_messageQueue.isEmpty() || _messageQueue.front()->betweenFrames()) && webSocketSendFrameWindow(_client) > (size_t)(_controlQueue.front()->len() - 1)){
-    _controlQueue.front()->send(_client);
-  } else if(!_messageQueue.isEmpty() && _messageQueue.front()->betweenFrames() && webSocketSendFrameWindow(_client)){
-    _messageQueue.front()->send(_client);
+  if(_control != NULL && !_control->finished() && (_message == NULL || _message->betweenFrames()) && webSocketSendFrameWindow(_client) > (size_t)(_control->len() - 1)){
+    _control->send(_client);
+  } else if(_message != NULL && webSocketSendFrameWindow(_client)){
+    _message->send(_client);
   }
+  return true;
+}
+
+void AsyncWebSocketClient::_onPublish(){
+  if(_status == WS_CONNECTED && _client->canSend())
+    _runQueue();
 }
 
 bool AsyncWebSocketClient::queueIsFull(){
-  if((_messageQueue.length() >= WS_MAX_QUEUED_MESSAGES) || (_status != WS_CONNECTED) ) return true;
+  if(_messageQueue.isFull() || (_status != WS_CONNECTED) ) return true;
   return false;
 }
 
@@ -547,20 +717,18 @@ void AsyncWebSocketClient::_queueMessage(AsyncWebSocketMessage *dataMessage){
     delete dataMessage;
     return;
   }
-  if(_messageQueue.length() >= WS_MAX_QUEUED_MESSAGES){
+  if(!_messageQueue.push(dataMessage, _server->queuePolicy())){
       ets_printf("ERROR: Too many messages queued\n");
-      delete dataMessage;
-  } else {
-      _messageQueue.add(dataMessage);
   }
   if(_client->canSend())
     _runQueue();
 }
 
+// Stale pings & pongs give way, so a close always gets queued
 void AsyncWebSocketClient::_queueControl(AsyncWebSocketControl *controlMessage){
   if(controlMessage == NULL)
     return;
-  _controlQueue.add(controlMessage);
+  _controlQueue.push(controlMessage, QUEUE_DROP_OLDEST);
   if(_client->canSend())
     _runQueue();
 }
@@ -641,8 +809,7 @@ void AsyncWebSocketClient::_onData(void *pbuf, size_t plen){
     const auto datalast = data[datalen];
 
     if(_pinfo.masked){
-      for(size_t i=0;i<datalen;i++)
-        data[i] ^= _pinfo.mask[(_pinfo.index+i)%4];
+      webSocketMask(data, datalen, _pinfo.mask, _pinfo.index);
     }
 
     if((datalen + _pinfo.index) < _pinfo.len){
@@ -849,10 +1016,13 @@ uint16_t AsyncWebSocketClient::remotePort() {
 
 AsyncWebSocket::AsyncWebSocket(const String& url)
   :_url(url)
-  ,_clients(LinkedList<AsyncWebSocketClient *>([](AsyncWebSocketClient *c){ delete c; }))
+  ,_clients([this](AsyncWebSocketClient *c){ _retiredClients.add(c); })
   ,_cNextId(1)
   ,_enabled(true)
-  ,_buffers(LinkedList<AsyncWebSocketMessageBuffer *>([](AsyncWebSocketMessageBuffer *b){ delete b; }))
+  ,_queuePolicy(QUEUE_DROP_NEWEST)
+  ,_walking(0)
+  ,_retiredClients(nullptr)
+  ,_buffers([](AsyncWebSocketMessageBuffer *b){ delete b; })
 {
   _eventHandler = NULL;
 }
@@ -866,17 +1036,58 @@ void AsyncWebSocket::_handleEvent(AsyncWebSocketClient * client, AwsEventType ty
 }
 
 void AsyncWebSocket::_addClient(AsyncWebSocketClient * client){
+  AsyncWebLockGuard l(_lock);
   _clients.add(client);
 }
 
 void AsyncWebSocket::_handleDisconnect(AsyncWebSocketClient * client){
-  
-  _clients.remove_first([=](AsyncWebSocketClient * c){
-    return c->id() == client->id();
-  });
+  {
+    AsyncWebLockGuard l(_lock);
+    _clients.remove_first([=](AsyncWebSocketClient * c){
+      return c->id() == client->id();
+    });
+  }
+  _collectClients();
+}
+
+// Runs fn on every connected client without holding _lock: sends block on the TCP/IP task, which
+// can be waiting on AsyncTCP's task, which takes _lock to add & drop clients
+void AsyncWebSocket::_forEachConnected(std::function<void(AsyncWebSocketClient *)> fn){
+  AsyncWebList<AsyncWebSocketClient *, DEFAULT_MAX_WS_CLIENTS> clients(nullptr);
+  {
+    AsyncWebLockGuard l(_lock);
+    for(const auto& c: _clients){
+      if(c->status() == WS_CONNECTED)
+        clients.add(c);
+    }
+    _walking++;
+  }
+  for(const auto& c: clients)
+    fn(c);
+  {
+    AsyncWebLockGuard l(_lock);
+    _walking--;
+  }
+  _collectClients();
+}
+
+// Deletes the clients that disconnected while sends were walking them, once none is
+void AsyncWebSocket::_collectClients(){
+  for(;;){
+    AsyncWebSocketClient *client;
+    {
+      AsyncWebLockGuard l(_lock);
+      if(_walking || _retiredClients.isEmpty())
+        return;
+      client = _retiredClients.front();
+      _retiredClients.remove(client);
+    }
+    delete client;
+  }
 }
 
 bool AsyncWebSocket::availableForWriteAll(){
+  AsyncWebLockGuard l(_lock);
   for(const auto& c: _clients){
     if(c->queueIsFull()) return false;
   }
@@ -884,6 +1095,7 @@ bool AsyncWebSocket::availableForWriteAll(){
 }
 
 bool AsyncWebSocket::availableForWrite(uint32_t id){
+  AsyncWebLockGuard l(_lock);
   for(const auto& c: _clients){
     if(c->queueIsFull() && (c->id() == id )) return false;
   }
@@ -891,12 +1103,14 @@ bool AsyncWebSocket::availableForWrite(uint32_t id){
 }
 
 size_t AsyncWebSocket::count() const {
+  AsyncWebLockGuard l(_lock);
   return _clients.count_if([](AsyncWebSocketClient * c){
     return c->status() == WS_CONNECTED;
   });
 }
 
 AsyncWebSocketClient * AsyncWebSocket::client(uint32_t id){
+  AsyncWebLockGuard l(_lock);
   for(const auto &c: _clients){
     if(c->id() == id && c->status() == WS_CONNECTED){
       return c;
@@ -913,16 +1127,21 @@ void AsyncWebSocket::close(uint32_t id, uint16_t code, const char * message){
 }
 
 void AsyncWebSocket::closeAll(uint16_t code, const char * message){
-  for(const auto& c: _clients){
-    if(c->status() == WS_CONNECTED)
-      c->close(code, message);
-  }
+  _forEachConnected([=](AsyncWebSocketClient *c){
+    c->close(code, message);
+  });
 }
 
+// Closes the oldest connected client
 void AsyncWebSocket::cleanupClients(uint16_t maxClients)
 {
   if (count() > maxClients){
-    _clients.front()->close();
+    bool closed = false;
+    _forEachConnected([&](AsyncWebSocketClient *c){
+      if(!closed)
+        c->close();
+      closed = true;
+    });
   }
 }
 
@@ -933,10 +1152,9 @@ void AsyncWebSocket::ping(uint32_t id, uint8_t *data, size_t len){
 }
 
 void AsyncWebSocket::pingAll(uint8_t *data, size_t len){
-  for(const auto& c: _clients){
-    if(c->status() == WS_CONNECTED)
-      c->ping(data, len);
-  }
+  _forEachConnected([=](AsyncWebSocketClient *c){
+    c->ping(data, len);
+  });
 }
 
 void AsyncWebSocket::text(uint32_t id, const char * message, size_t len){
@@ -945,22 +1163,24 @@ void AsyncWebSocket::text(uint32_t id, const char * message, size_t len){
     c->text(message, len);
 }
 
+// Queues one reference to frame on every connected client & drops the caller's
+void AsyncWebSocket::_broadcast(AsyncWebSharedBuffer * frame){
+  if (!frame) return;
+  _forEachConnected([=](AsyncWebSocketClient *c){
+    c->message(new AsyncWebSocketSharedMessage(frame));
+  });
+  frame->release();
+}
+
 void AsyncWebSocket::textAll(AsyncWebSocketMessageBuffer * buffer){
   if (!buffer) return;
-  buffer->lock(); 
-  for(const auto& c: _clients){
-    if(c->status() == WS_CONNECTED){
-        c->text(buffer);
-    }
-  }
-  buffer->unlock();
+  _broadcast(webSocketFrame(WS_TEXT, buffer->get(), buffer->length()));
   _cleanBuffers(); 
 }
 
 
 void AsyncWebSocket::textAll(const char * message, size_t len){
-  AsyncWebSocketMessageBuffer * WSBuffer = makeBuffer((uint8_t *)message, len); 
-    textAll(WSBuffer); 
+  _broadcast(webSocketFrame(WS_TEXT, (const uint8_t *)message, len));
 }
 
 void AsyncWebSocket::binary(uint32_t id, const char * message, size_t len){
@@ -970,19 +1190,13 @@ void AsyncWebSocket::binary(uint32_t id, const char * message, size_t len){
 }
 
 void AsyncWebSocket::binaryAll(const char * message, size_t len){
-  AsyncWebSocketMessageBuffer * buffer = makeBuffer((uint8_t *)message, len); 
-  binaryAll(buffer); 
+  _broadcast(webSocketFrame(WS_BINARY, (const uint8_t *)message, len));
 }
 
 void AsyncWebSocket::binaryAll(AsyncWebSocketMessageBuffer * buffer)
 {
   if (!buffer) return;
-  buffer->lock(); 
-    for(const auto& c: _clients){
-    if(c->status() == WS_CONNECTED)
-      c->binary(buffer);
-  }
-  buffer->unlock(); 
+  _broadcast(webSocketFrame(WS_BINARY, buffer->get(), buffer->length()));
   _cleanBuffers(); 
 }
 
@@ -993,13 +1207,30 @@ void AsyncWebSocket::message(uint32_t id, AsyncWebSocketMessage *message){
 }
 
 void AsyncWebSocket::messageAll(AsyncWebSocketMultiMessage *message){
-  for(const auto& c: _clients){
-    if(c->status() == WS_CONNECTED)
-      c->message(message);
-  }
+  _forEachConnected([=](AsyncWebSocketClient *c){
+    c->message(message);
+  });
   _cleanBuffers(); 
 }
 
+AsyncWebTopic * AsyncWebSocket::topic(){
+  return _topics.add(new AsyncWebSocketTopic(this));
+}
+
+AsyncWebSharedBuffer *AsyncWebSocketTopic::_format(const char *message, size_t len){
+  return webSocketFrame(WS_TEXT, (const uint8_t *)message, len);
+}
+
+void AsyncWebSocketTopic::_notify(){
+  _server->_onPublish();
+}
+
+void AsyncWebSocket::_onPublish(){
+  _forEachConnected([](AsyncWebSocketClient *c){
+    c->_onPublish();
+  });
+}
+
 size_t AsyncWebSocket::printf(uint32_t id, const char *format, ...){
   AsyncWebSocketClient * c = client(id);
   if(c){
@@ -1023,16 +1254,16 @@ size_t AsyncWebSocket::printfAll(const char *format, ...) {
   va_end(arg);
   delete[] temp;
   
-  AsyncWebSocketMessageBuffer * buffer = makeBuffer(len); 
-  if (!buffer) {
+  AsyncWebSharedBuffer * frame = webSocketFrame(WS_TEXT, NULL, len);
+  if (!frame) {
     return 0;
   }
 
   va_start(arg, format);
-  vsnprintf( (char *)buffer->get(), len + 1, format, arg);
+  vsnprintf((char *)webSocketFramePayload(frame, len), len + 1, format, arg);
   va_end(arg);
 
-  textAll(buffer);
+  _broadcast(frame);
   return len;
 }
 
@@ -1061,16 +1292,16 @@ size_t AsyncWebSocket::printfAll_P(PGM_P formatP, ...) {
   va_end(arg);
   delete[] temp;
   
-  AsyncWebSocketMessageBuffer * buffer = makeBuffer(len + 1); 
-  if (!buffer) {
+  AsyncWebSharedBuffer * frame = webSocketFrame(WS_TEXT, NULL, len);
+  if (!frame) {
     return 0;
   }
 
   va_start(arg, formatP);
-  vsnprintf_P((char *)buffer->get(), len + 1, formatP, arg);
+  vsnprintf_P((char *)webSocketFramePayload(frame, len), len + 1, formatP, arg);
   va_end(arg);
 
-  textAll(buffer);
+  _broadcast(frame);
   return len;
 }
 
@@ -1104,9 +1335,12 @@ void AsyncWebSocket::textAll(const String &message){
   textAll(message.c_str(), message.length());
 }
 void AsyncWebSocket::textAll(const __FlashStringHelper *message){
-  for(const auto& c: _clients){
-    if(c->status() == WS_CONNECTED)
-      c->text(message);
+  PGM_P p = reinterpret_cast<PGM_P>(message);
+  size_t len = strlen_P(p);
+  AsyncWebSharedBuffer * frame = webSocketFrame(WS_TEXT, NULL, len);
+  if (frame) {
+    memcpy_P(webSocketFramePayload(frame, len), p, len);
+    _broadcast(frame);
   }
 }
 void AsyncWebSocket::binary(uint32_t id, const char * message){
@@ -1139,11 +1373,12 @@ void AsyncWebSocket::binaryAll(const String &message){
   binaryAll(message.c_str(), message.length());
 }
 void AsyncWebSocket::binaryAll(const __FlashStringHelper *message, size_t len){
-  for(const auto& c: _clients){
-    if(c->status() == WS_CONNECTED)
-      c-> binary(message, len);
+  AsyncWebSharedBuffer * frame = webSocketFrame(WS_BINARY, NULL, len);
+  if (frame) {
+    memcpy_P(webSocketFramePayload(frame, len), reinterpret_cast<PGM_P>(message), len);
+    _broadcast(frame);
   }
- }
+}
 
 const char * WS_STR_CONNECTION = "Connection";
 const char * WS_STR_UPGRADE = "Upgrade";
@@ -1161,38 +1396,41 @@ bool AsyncWebSocket::canHandle(AsyncWebServerRequest *request){
   if(request->method() != HTTP_GET || !request->url().equals(_url) || !request->isExpectedRequestedConnType(RCT_WS))
     return false;
 
-  request->addInterestingHeader(WS_STR_CONNECTION);
-  request->addInterestingHeader(WS_STR_UPGRADE);
-  request->addInterestingHeader(WS_STR_ORIGIN);
-  request->addInterestingHeader(WS_STR_VERSION);
-  request->addInterestingHeader(WS_STR_KEY);
-  request->addInterestingHeader(WS_STR_PROTOCOL);
+  request->addInterestingHeader(HDR_CONNECTION);
+  request->addInterestingHeader(HDR_UPGRADE);
+  request->addInterestingHeader(HDR_ORIGIN);
+  request->addInterestingHeader(HDR_WS_VERSION);
+  request->addInterestingHeader(HDR_WS_KEY);
+  request->addInterestingHeader(HDR_WS_PROTOCOL);
   return true;
 }
 
+WebRouteKind AsyncWebSocket::route(String& path, WebRequestMethodComposite& methods) const {
+  path = _url;
+  methods = HTTP_GET;
+  return ROUTE_EXACT;
+}
+
 void AsyncWebSocket::handleRequest(AsyncWebServerRequest *request){
-  if(!request->hasHeader(WS_STR_VERSION) || !request->hasHeader(WS_STR_KEY)){
+  size_t keyLen, versionLen, protocolLen;
+  const char *key = request->header(HDR_WS_KEY, keyLen);
+  const char *version = request->header(HDR_WS_VERSION, versionLen);
+  // The key is always base64 of 16 random bytes
+  if(key == NULL || keyLen != 24 || version == NULL){
     request->send(400);
     return;
   }
   if((_username != "" && _password != "") && !request->authenticate(_username.c_str(), _password.c_str())){
     return request->requestAuthentication();
   }
-  AsyncWebHeader* version = request->getHeader(WS_STR_VERSION);
-  if(version->value().toInt() != 13){
+  if(versionLen != 2 || memcmp(version, "13", 2)){
     AsyncWebServerResponse *response = request->beginResponse(400);
     response->addHeader(WS_STR_VERSION,"13");
     request->send(response);
     return;
   }
-  AsyncWebHeader* key = request->getHeader(WS_STR_KEY);
-  AsyncWebServerResponse *response = new AsyncWebSocketResponse(key->value(), this);
-  if(request->hasHeader(WS_STR_PROTOCOL)){
-    AsyncWebHeader* protocol = request->getHeader(WS_STR_PROTOCOL);
-    //ToDo: check protocol
-    response->addHeader(WS_STR_PROTOCOL, protocol->value());
-  }
-  request->send(response);
+  const char *protocol = request->header(HDR_WS_PROTOCOL, protocolLen);
+  request->send(new (request->arena()) AsyncWebSocketResponse(key, keyLen, protocol, protocolLen, this, request->arena()));
 }
 
 AsyncWebSocketMessageBuffer * AsyncWebSocket::makeBuffer(size_t size)
@@ -1221,14 +1459,13 @@ void AsyncWebSocket::_cleanBuffers()
 {
   AsyncWebLockGuard l(_lock);
 
-  for(AsyncWebSocketMessageBuffer * c: _buffers){
-    if(c && c->canDelete()){
-        _buffers.remove(c);
-    }
-  }
+  _buffers.remove_if([](AsyncWebSocketMessageBuffer * c){
+    return c && c->canDelete();
+  });
 }
 
 AsyncWebSocket::AsyncWebSocketClientLinkedList AsyncWebSocket::getClients() const {
+  AsyncWebLockGuard l(_lock);
   return _clients;
 }
 
@@ -1237,51 +1474,77 @@ AsyncWebSocket::AsyncWebSocketClientLinkedList AsyncWebSocket::getClients() cons
  * Authentication code from https://github.com/Links2004/arduinoWebSockets/blob/master/src/WebSockets.cpp#L480
  */
 
-AsyncWebSocketResponse::AsyncWebSocketResponse(const String& key, AsyncWebSocket *server){
-  _server = server;
+static char *appendView(char *out, const char *str, size_t len){
+  memcpy(out, str, len);
+  return out + len;
+}
+
+AsyncWebSocketResponse::AsyncWebSocketResponse(const char *key, size_t keyLen, const char *protocol, size_t protocolLen, AsyncWebSocket *server, AsyncWebArena *arena)
+  : AsyncWebServerResponse(arena)
+  , _server(server)
+  , _handshakeLength(0)
+{
   _code = 101;
   _sendContentLength = false;
-
-  uint8_t * hash = (uint8_t*)malloc(20);
-  if(hash == NULL){
-    _state = RESPONSE_FAILED;
-    return;
-  }
-  char * buffer = (char *) malloc(33);
-  if(buffer == NULL){
-    free(hash);
+  if(key == NULL || keyLen > 64){
     _state = RESPONSE_FAILED;
     return;
   }
+
+  uint8_t hash[20];
 #ifdef ESP8266
-  sha1(key + WS_STR_UUID, hash);
+  uint8_t keyed[64 + 36];
+  memcpy(keyed, key, keyLen);
+  memcpy(keyed + keyLen, WS_STR_UUID, 36);
+  sha1(keyed, keyLen + 36, hash);
 #else
-  (String&)key += WS_STR_UUID;
   mbedtls_sha1_context ctx;
   mbedtls_sha1_init(&ctx);
   mbedtls_sha1_starts_ret(&ctx);
-  mbedtls_sha1_update_ret(&ctx, (const unsigned char*)key.c_str(), key.length());
+  mbedtls_sha1_update_ret(&ctx, (const unsigned char*)key, keyLen);
+  mbedtls_sha1_update_ret(&ctx, (const unsigned char*)WS_STR_UUID, 36);
   mbedtls_sha1_finish_ret(&ctx, hash);
   mbedtls_sha1_free(&ctx);
 #endif
-  base64_encodestate _state;
-  base64_init_encodestate(&_state);
-  int len = base64_encode_block((const char *) hash, 20, buffer, &_state);
-  len = base64_encode_blockend((buffer + len), &_state);
-  addHeader(WS_STR_CONNECTION, WS_STR_UPGRADE);
-  addHeader(WS_STR_UPGRADE, "websocket");
-  addHeader(WS_STR_ACCEPT,buffer);
-  free(buffer);
-  free(hash);
-}
+  char accept[33]; // 20 bytes always encode to 28 chars
+  base64_encodestate state;
+  base64_init_encodestate(&state);
+  int len = base64_encode_block((const char *) hash, 20, accept, &state);
+  base64_encode_blockend(accept + len, &state);
+
+  // Only one subprotocol can be agreed on: the client's first choice
+  const char *comma = protocol ? (const char*)memchr(protocol, ',', protocolLen) : NULL;
+  if(comma)
+    protocolLen = comma - protocol;
+  while(protocolLen && protocol[protocolLen - 1] == ' ')
+    protocolLen--;
+  if(protocolLen > MAX_PROTOCOL)
+    protocolLen = 0;
+
+  char *out = appendView(_handshake, "HTTP/1.1 101 Switching Protocols\r\n", 34);
+  out = appendView(out, "Connection: Upgrade\r\nUpgrade: websocket\r\n", 41);
+  out = appendView(out, "Sec-WebSocket-Accept: ", 22);
+  out = appendView(out, accept, 28);
+  out = appendView(out, "\r\n", 2);
+  if(protocolLen){
+    out = appendView(out, "Sec-WebSocket-Protocol: ", 24);
+    out = appendView(out, protocol, protocolLen);
+    out = appendView(out, "\r\n", 2);
+  }
+  out = appendView(out, "\r\n", 2);
+  _handshakeLength = out - _handshake;
+}
+
+AsyncWebSocketResponse::AsyncWebSocketResponse(const String& key, AsyncWebSocket *server)
+  : AsyncWebSocketResponse(key.c_str(), key.length(), NULL, 0, server)
+{}
 
 void AsyncWebSocketResponse::_respond(AsyncWebServerRequest *request){
-  if(_state == RESPONSE_FAILED){
+  if(_state == RESPONSE_FAILED || request->client()->write(_handshake, _handshakeLength) != _handshakeLength){
+    _state = RESPONSE_FAILED;
     request->client()->close(true);
     return;
   }
-  String out = _assembleHead(request->version());
-  request->client()->write(out.c_str(), _headLength);
   _state = RESPONSE_WAIT_ACK;
 }
 
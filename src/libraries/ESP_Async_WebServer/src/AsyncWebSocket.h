@@ -29,9 +29,13 @@
 #include <ESPAsyncTCP.h>
 #define WS_MAX_QUEUED_MESSAGES 8
 #endif
+#define WS_MAX_QUEUED_CONTROLS 8
 #include <ESPAsyncWebServer.h>
 
 #include "AsyncWebSynchronization.h"
+#include "WebSharedBuffer.h"
+#include "WebQueue.h"
+#include "WebTopic.h"
 
 #ifdef ESP8266
 #include <Hash.h>
@@ -154,6 +158,21 @@ public:
     virtual size_t send(AsyncClient *client) override ;
 };
 
+// One reference to a complete frame shared by every client it was broadcast to
+class AsyncWebSocketSharedMessage: public AsyncWebSocketMessage {
+  private:
+    AsyncWebSharedBuffer * _frame;
+    size_t _sent;
+    size_t _ack;
+    size_t _acked;
+public:
+    AsyncWebSocketSharedMessage(AsyncWebSharedBuffer * frame);
+    virtual ~AsyncWebSocketSharedMessage() override;
+    virtual bool betweenFrames() const override { return _sent == 0; }
+    virtual void ack(size_t len, uint32_t time) override ;
+    virtual size_t send(AsyncClient *client) override ;
+};
+
 class AsyncWebSocketClient {
   private:
     AsyncClient *_client;
@@ -161,8 +180,15 @@ class AsyncWebSocketClient {
     uint32_t _clientId;
     AwsClientStatus _status;
 
-    LinkedList<AsyncWebSocketControl *> _controlQueue;
-    LinkedList<AsyncWebSocketMessage *> _messageQueue;
+    AsyncWebQueue<AsyncWebSocketControl *, WS_MAX_QUEUED_CONTROLS> _controlQueue;
+    AsyncWebQueue<AsyncWebSocketMessage *, WS_MAX_QUEUED_MESSAGES> _messageQueue;
+    // Taken off the queues by whichever task runs the queue, which alone touches them
+    AsyncWebSocketControl *_control;
+    AsyncWebSocketMessage *_message;
+    AsyncWebQueueRunner _runner;
+    std::atomic<size_t> _ackedLen;
+    std::atomic<uint32_t> _ackTime;
+    AsyncWebTopicCursor _topics;
 
     uint8_t _pstate;
     AwsFrameInfo _pinfo;
@@ -173,6 +199,7 @@ class AsyncWebSocketClient {
     void _queueMessage(AsyncWebSocketMessage *dataMessage);
     void _queueControl(AsyncWebSocketControl *controlMessage);
     void _runQueue();
+    bool _drainQueue();
 
   public:
     void *_tempObject;
@@ -226,9 +253,10 @@ class AsyncWebSocketClient {
     void binary(const __FlashStringHelper *data, size_t len);
     void binary(AsyncWebSocketMessageBuffer *buffer); 
 
-    bool canSend() { return _messageQueue.length() < WS_MAX_QUEUED_MESSAGES; }
+    bool canSend() { return !_messageQueue.isFull(); }
 
     //system callbacks (do not call)
+    void _onPublish();
     void _onAck(size_t len, uint32_t time);
     void _onError(int8_t);
     void _onPoll();
@@ -242,14 +270,22 @@ typedef std::function<void(AsyncWebSocket * server, AsyncWebSocketClient * clien
 //WebServer Handler implementation that plays the role of a socket server
 class AsyncWebSocket: public AsyncWebHandler {
   public:
-    typedef LinkedList<AsyncWebSocketClient *> AsyncWebSocketClientLinkedList;
+    typedef AsyncWebList<AsyncWebSocketClient *> AsyncWebSocketClientLinkedList;
   private:
     String _url;
     AsyncWebSocketClientLinkedList _clients;
     uint32_t _cNextId;
     AwsEventHandler _eventHandler;
     bool _enabled;
+    AwsQueuePolicy _queuePolicy;
+    AsyncWebTopics _topics;
     AsyncWebLock _lock;
+    size_t _walking; // sends running on a snapshot of _clients, outside _lock
+    AsyncWebSocketClientLinkedList _retiredClients; // removed meanwhile, & deleted by _collectClients()
+
+    void _broadcast(AsyncWebSharedBuffer * frame);
+    void _forEachConnected(std::function<void(AsyncWebSocketClient *)> fn);
+    void _collectClients();
 
   public:
     AsyncWebSocket(const String& url);
@@ -257,6 +293,9 @@ class AsyncWebSocket: public AsyncWebHandler {
     const char * url() const { return _url.c_str(); }
     void enable(bool e){ _enabled = e; }
     bool enabled() const { return _enabled; }
+    // What a client's full message queue does with one more message (default QUEUE_DROP_NEWEST)
+    void setQueuePolicy(AwsQueuePolicy policy){ _queuePolicy = policy; }
+    AwsQueuePolicy queuePolicy() const { return _queuePolicy; }
     bool availableForWriteAll();
     bool availableForWrite(uint32_t id);
 
@@ -304,6 +343,10 @@ class AsyncWebSocket: public AsyncWebHandler {
     void message(uint32_t id, AsyncWebSocketMessage *message);
     void messageAll(AsyncWebSocketMultiMessage *message);
 
+    // A new latest-value topic sent as text frames, owned by the socket; NULL past ASYNCWEB_MAX_TOPICS
+    AsyncWebTopic * topic();
+    const AsyncWebTopics & topics() const { return _topics; }
+
     size_t printf(uint32_t id, const char *format, ...)  __attribute__ ((format (printf, 3, 4)));
     size_t printfAll(const char *format, ...)  __attribute__ ((format (printf, 2, 3)));
 #ifndef ESP32
@@ -321,25 +364,44 @@ class AsyncWebSocket: public AsyncWebHandler {
     void _addClient(AsyncWebSocketClient * client);
     void _handleDisconnect(AsyncWebSocketClient * client);
     void _handleEvent(AsyncWebSocketClient * client, AwsEventType type, void * arg, uint8_t *data, size_t len);
+    void _onPublish();
     virtual bool canHandle(AsyncWebServerRequest *request) override final;
+    virtual WebRouteKind route(String& path, WebRequestMethodComposite& methods) const override final;
     virtual void handleRequest(AsyncWebServerRequest *request) override final;
 
 
     //  messagebuffer functions/objects. 
     AsyncWebSocketMessageBuffer * makeBuffer(size_t size = 0); 
     AsyncWebSocketMessageBuffer * makeBuffer(uint8_t * data, size_t size); 
-    LinkedList<AsyncWebSocketMessageBuffer *> _buffers;
+    AsyncWebList<AsyncWebSocketMessageBuffer *> _buffers;
     void _cleanBuffers(); 
 
     AsyncWebSocketClientLinkedList getClients() const;
 };
 
+class AsyncWebSocketTopic: public AsyncWebTopic {
+  private:
+    AsyncWebSocket *_server;
+  protected:
+    virtual AsyncWebSharedBuffer *_format(const char *message, size_t len) override;
+    virtual void _notify() override;
+  public:
+    AsyncWebSocketTopic(AsyncWebSocket *server): _server(server) {}
+};
+
 //WebServer response to authenticate the socket and detach the tcp client from the web server request
+//The whole 101 is serialised once, from the request's own header bytes, into the response itself:
+//accepting an upgrade builds no String or header list, so a burst of reconnects stays cheap.
+//Headers added to it (DefaultHeaders included) aren't sent.
 class AsyncWebSocketResponse: public AsyncWebServerResponse {
+  public:
+    static const size_t MAX_PROTOCOL = 48; // longest subprotocol it will echo back
   private:
-    String _content;
     AsyncWebSocket *_server;
+    char _handshake[160 + MAX_PROTOCOL];
+    size_t _handshakeLength;
   public:
+    AsyncWebSocketResponse(const char *key, size_t keyLen, const char *protocol, size_t protocolLen, AsyncWebSocket *server, AsyncWebArena *arena=NULL);
     AsyncWebSocketResponse(const String& key, AsyncWebSocket *server);
     void _respond(AsyncWebServerRequest *request);
     size_t _ack(AsyncWebServerRequest *request, size_t len, uint32_t time);
@@ -27,6 +27,10 @@
 #include "FS.h"
 
 #include "StringArray.h"
+#include "WebRouter.h"
+#include "WebTemplate.h"
+#include "WebDeflate.h"
+#include "AsyncWebSynchronization.h"
 
 #ifdef ESP32
 #include <WiFi.h>
@@ -46,9 +50,39 @@
 
 #define DEBUGF(...) //Serial.printf(__VA_ARGS__)
 
+//longest request or header line accepted; longer ones are answered with 414/431
+#ifndef ASYNCWEBSERVER_MAX_LINE
+#define ASYNCWEBSERVER_MAX_LINE 1024
+#endif
+
+//most body a streamed response reads ahead of the socket: by default a full lwIP send buffer
+//plus the segment after it, so each ack finds the next window's worth ready
+#ifndef ASYNCWEBSERVER_SEND_BUFFER
+#if defined(CONFIG_TCP_SND_BUF_DEFAULT) && defined(CONFIG_TCP_MSS)
+#define ASYNCWEBSERVER_SEND_BUFFER (CONFIG_TCP_SND_BUF_DEFAULT + CONFIG_TCP_MSS)
+#else
+#define ASYNCWEBSERVER_SEND_BUFFER 4096
+#endif
+#endif
+
+//how long a kept-alive connection waits for its next request (seconds) & how many requests one
+//connection serves before it's closed; AsyncWebServer::setKeepAlive() changes both at run time
+#ifndef ASYNCWEBSERVER_KEEPALIVE_TIMEOUT
+#define ASYNCWEBSERVER_KEEPALIVE_TIMEOUT 5
+#endif
+#ifndef ASYNCWEBSERVER_KEEPALIVE_MAX
+#define ASYNCWEBSERVER_KEEPALIVE_MAX 100
+#endif
+
+//most bytes of pipelined requests held while the response ahead of them goes out
+#ifndef ASYNCWEBSERVER_MAX_PIPELINED
+#define ASYNCWEBSERVER_MAX_PIPELINED 2048
+#endif
+
 class AsyncWebServer;
 class AsyncWebServerRequest;
 class AsyncWebServerResponse;
+class AsyncPreparedResponse;
 class AsyncWebHeader;
 class AsyncWebParameter;
 class AsyncWebRewrite;
@@ -80,7 +114,7 @@ typedef std::function<void(void)> ArDisconnectHandler;
  * PARAMETER :: Chainable object to hold GET/POST and FILE parameters
  * */
 
-class AsyncWebParameter {
+class AsyncWebParameter: public AsyncWebArenaObject {
   private:
     String _name;
     String _value;
@@ -102,13 +136,14 @@ class AsyncWebParameter {
  * HEADER :: Chainable object to hold the headers
  * */
 
-class AsyncWebHeader {
+class AsyncWebHeader: public AsyncWebArenaObject {
   private:
     String _name;
     String _value;
 
   public:
     AsyncWebHeader(const String& name, const String& value): _name(name), _value(value){}
+    AsyncWebHeader(const char *name, size_t nameLen, const char *value, size_t valueLen): _name(viewToString(name, nameLen)), _value(viewToString(value, valueLen)){}
     AsyncWebHeader(const String& data): _name(), _value(){
       if(!data) return;
       int index = data.indexOf(':');
@@ -120,6 +155,7 @@ class AsyncWebHeader {
     const String& name() const { return _name; }
     const String& value() const { return _value; }
     String toString() const { return String(_name+": "+_value+"\r\n"); }
+    static String viewToString(const char *data, size_t len){ String s; s.concat(data, len); return s; }
 };
 
 /*
@@ -128,6 +164,14 @@ class AsyncWebHeader {
 
 typedef enum { RCT_NOT_USED = -1, RCT_DEFAULT = 0, RCT_HTTP, RCT_WS, RCT_EVENT, RCT_MAX } RequestedConnectionType;
 
+// Request headers the parser recognises; each has a fixed slot, so looking one up doesn't scan the list
+typedef enum {
+  HDR_HOST, HDR_CONTENT_TYPE, HDR_CONTENT_LENGTH, HDR_EXPECT, HDR_AUTHORIZATION, HDR_UPGRADE,
+  HDR_ACCEPT, HDR_ACCEPT_ENCODING, HDR_CONNECTION, HDR_ORIGIN, HDR_LAST_EVENT_ID,
+  HDR_IF_MODIFIED_SINCE, HDR_IF_NONE_MATCH, HDR_WS_KEY, HDR_WS_VERSION, HDR_WS_PROTOCOL,
+  HDR_KNOWN, HDR_UNKNOWN = HDR_KNOWN
+} WebHeaderId;
+
 typedef std::function<size_t(uint8_t*, size_t, size_t)> AwsResponseFiller;
 typedef std::function<String(const String&)> AwsTemplateProcessor;
 
@@ -137,15 +181,26 @@ class AsyncWebServerRequest {
   friend class AsyncWebServer;
   friend class AsyncCallbackWebHandler;
   private:
+    mutable AsyncWebArena _arena; // request-scoped storage; declared first so it outlives everything placed in it
     AsyncClient* _client;
     AsyncWebServer* _server;
     AsyncWebHandler* _handler;
     AsyncWebServerResponse* _response;
+    const char *_preparedData; // unsent part of an AsyncPreparedResponse
+    size_t _preparedLeft;
     StringArray _interestingHeaders;
+    uint32_t _interestingIds; // bit per WebHeaderId kept without naming it in _interestingHeaders
     ArDisconnectHandler _onDisconnectfn;
 
     String _temp;
+    char *_line;          // head line split across received segments
+    uint16_t _lineLength;
     uint8_t _parseState;
+    bool _keepAlive;          // the client will send another request on this connection
+    uint8_t _encodings;       // ENCODING_ bits of the compressed encodings the client accepts
+    uint16_t _served;         // requests already answered on this connection
+    char *_pipelined;         // requests received behind this one, parsed once its response is done
+    size_t _pipelinedLength;
 
     uint8_t _version;
     WebRequestMethodComposite _method;
@@ -163,9 +218,30 @@ class AsyncWebServerRequest {
     size_t _contentLength;
     size_t _parsedLength;
 
-    LinkedList<AsyncWebHeader *> _headers;
-    LinkedList<AsyncWebParameter *> _params;
-    LinkedList<String *> _pathParams;
+    // A header line copied into the arena as raw bytes: name then value, not NUL-terminated.
+    // The AsyncWebHeader (and its Strings) is only built if someone looks the header up.
+    struct RawHeader {
+      RawHeader *next;
+      AsyncWebHeader *header;
+      uint16_t nameLen;
+      uint16_t valueLen;
+      uint8_t id;
+      const char *name() const { return (const char*)(this + 1); }
+      const char *value() const { return name() + nameLen; }
+    };
+    RawHeader *_rawHeaders;
+    RawHeader **_rawHeadersTail;
+    RawHeader *_knownHeaders[HDR_KNOWN];
+    size_t _headerCount;
+    static uint8_t _headerId(const char *name, size_t len);
+    void _addHeader(uint8_t id, const char *name, size_t nameLen, const char *value, size_t valueLen);
+    RawHeader *_findHeader(const char *name, size_t len) const;
+    AsyncWebHeader *_headerObject(RawHeader *raw) const;
+    void _freeHeaders();
+
+
+    AsyncWebList<AsyncWebParameter *, 4> _params; // most requests carry a few, so no arena block for them
+    AsyncWebList<String *> _pathParams;
 
     uint8_t _multiParseState;
     uint8_t _boundaryPosition;
@@ -184,17 +260,27 @@ class AsyncWebServerRequest {
     void _onError(int8_t error);
     void _onTimeout(uint32_t time);
     void _onDisconnect();
+    void _sendPrepared();
     void _onData(void *buf, size_t len);
+    bool _carryLine(const char *data, size_t len);
+    void _failHead();
+    void _dispatch();
+    void _holdPipelined(const char *data, size_t len);
+    void _ackResponse(size_t len, uint32_t time);
+    void _next();
+    void _reset();
 
     void _addParam(AsyncWebParameter*);
     void _addPathParam(const char *param);
 
-    bool _parseReqHead();
-    bool _parseReqHeader();
-    void _parseLine();
+    bool _parseReqHead(const char *line, size_t len);
+    bool _parseReqHeader(const char *line, size_t len);
+    void _parseLine(const char *line, size_t len);
     void _parsePlainPostChar(uint8_t data);
     void _parseMultipartPostByte(uint8_t data, bool last);
     void _addGetParams(const String& params);
+    void _addGetParams(const char *params, size_t len);
+    String _urlDecode(const char *text, size_t len) const;
 
     void _handleUploadStart();
     void _handleUploadByte(uint8_t data, bool last);
@@ -206,6 +292,8 @@ class AsyncWebServerRequest {
 
     AsyncWebServerRequest(AsyncWebServer*, AsyncClient*);
     ~AsyncWebServerRequest();
+    bool _canKeepAlive() const;
+    bool _compression(bool sized, size_t length, AsyncWebDeflate::Format &format) const;
 
     AsyncClient* client(){ return _client; }
     uint8_t version() const { return _version; }
@@ -230,10 +318,12 @@ class AsyncWebServerRequest {
 
     void setHandler(AsyncWebHandler *handler){ _handler = handler; }
     void addInterestingHeader(const String& name);
+    void addInterestingHeader(WebHeaderId id); // a recognised header, kept without copying its name
 
     void redirect(const String& url);
 
     void send(AsyncWebServerResponse *response);
+    void send(const AsyncPreparedResponse& response); // response must outlive the request
     void send(int code, const String& contentType=String(), const String& content=String());
     void send(FS &fs, const String& path, const String& contentType=String(), bool download=false, AwsTemplateProcessor callback=nullptr);
     void send(File content, const String& path, const String& contentType=String(), bool download=false, AwsTemplateProcessor callback=nullptr);
@@ -242,6 +332,7 @@ class AsyncWebServerRequest {
     void sendChunked(const String& contentType, AwsResponseFiller callback, AwsTemplateProcessor templateCallback=nullptr);
     void send_P(int code, const String& contentType, const uint8_t * content, size_t len, AwsTemplateProcessor callback=nullptr);
     void send_P(int code, const String& contentType, PGM_P content, AwsTemplateProcessor callback=nullptr);
+    void send(int code, const String& contentType, const AsyncWebTemplate& tpl, AwsTemplateFiller filler); // tpl must outlive the request
 
     AsyncWebServerResponse *beginResponse(int code, const String& contentType=String(), const String& content=String());
     AsyncWebServerResponse *beginResponse(FS &fs, const String& path, const String& contentType=String(), bool download=false, AwsTemplateProcessor callback=nullptr);
@@ -252,6 +343,7 @@ class AsyncWebServerRequest {
     AsyncResponseStream *beginResponseStream(const String& contentType, size_t bufferSize=1460);
     AsyncWebServerResponse *beginResponse_P(int code, const String& contentType, const uint8_t * content, size_t len, AwsTemplateProcessor callback=nullptr);
     AsyncWebServerResponse *beginResponse_P(int code, const String& contentType, PGM_P content, AwsTemplateProcessor callback=nullptr);
+    AsyncWebServerResponse *beginResponse(int code, const String& contentType, const AsyncWebTemplate& tpl, AwsTemplateFiller filler);
 
     size_t headers() const;                     // get header count
     bool hasHeader(const String& name) const;   // check if header exists
@@ -260,6 +352,12 @@ class AsyncWebServerRequest {
     AsyncWebHeader* getHeader(const String& name) const;
     AsyncWebHeader* getHeader(const __FlashStringHelper * data) const;
     AsyncWebHeader* getHeader(size_t num) const;
+    // A recognised header's value as it arrived (len bytes, not NUL-terminated), or NULL; no
+    // AsyncWebHeader is built, and the view lasts as long as the request
+    const char *header(WebHeaderId id, size_t &len) const;
+    // Storage freed with the request: a handler can place its response here with new (request->arena()),
+    // passing the same arena to the response's constructor
+    AsyncWebArena *arena() const { return &_arena; }
 
     size_t params() const;                      // get arguments count
     bool hasParam(const String& name, bool post=false, bool file=false) const;
@@ -332,15 +430,25 @@ class AsyncWebHandler {
     ArRequestFilterFunction _filter;
     String _username;
     String _password;
+    size_t _compressThreshold;
   public:
-    AsyncWebHandler():_username(""), _password(""){}
+    AsyncWebHandler():_username(""), _password(""), _compressThreshold((size_t)-1){}
     AsyncWebHandler& setFilter(ArRequestFilterFunction fn) { _filter = fn; return *this; }
     AsyncWebHandler& setAuthentication(const char *username, const char *password){  _username = String(username);_password = String(password); return *this; };
+    // Sends streamed bodies (templates, streams, callbacks, JSON; not plain Strings) of at least
+    // threshold bytes, or of unknown length, gzip/deflate-compressed to clients that accept it
+    AsyncWebHandler& setCompression(size_t threshold = ASYNCWEBSERVER_COMPRESS_THRESHOLD){ _compressThreshold = threshold; return *this; }
+    size_t compressThreshold() const { return _compressThreshold; }
     bool filter(AsyncWebServerRequest *request){ return _filter == NULL || _filter(request); }
     virtual ~AsyncWebHandler(){}
     virtual bool canHandle(AsyncWebServerRequest *request __attribute__((unused))){
       return false;
     }
+    // Describes which urls canHandle() can accept so the server can index the handler: fills in
+    // `path` (& `methods`, if narrower than HTTP_ANY). Read once at begin().
+    virtual WebRouteKind route(String& path __attribute__((unused)), WebRequestMethodComposite& methods __attribute__((unused))) const {
+      return ROUTE_ANY;
+    }
     virtual void handleRequest(AsyncWebServerRequest *request __attribute__((unused))){}
     virtual void handleUpload(AsyncWebServerRequest *request  __attribute__((unused)), const String& filename __attribute__((unused)), size_t index __attribute__((unused)), uint8_t *data __attribute__((unused)), size_t len __attribute__((unused)), bool final  __attribute__((unused))){}
     virtual void handleBody(AsyncWebServerRequest *request __attribute__((unused)), uint8_t *data __attribute__((unused)), size_t len __attribute__((unused)), size_t index __attribute__((unused)), size_t total __attribute__((unused))){}
@@ -355,37 +463,72 @@ typedef enum {
   RESPONSE_SETUP, RESPONSE_HEADERS, RESPONSE_CONTENT, RESPONSE_WAIT_ACK, RESPONSE_END, RESPONSE_FAILED
 } WebResponseState;
 
-class AsyncWebServerResponse {
+class AsyncWebServerResponse: public AsyncWebArenaObject {
   protected:
+    AsyncWebArena* _arena; // the request arena this response was placed in (NULL if not); holds its headers too
     int _code;
-    LinkedList<AsyncWebHeader *> _headers;
+    AsyncWebList<AsyncWebHeader *, 4> _headers;
     String _contentType;
     size_t _contentLength;
     bool _sendContentLength;
     bool _chunked;
+    char *_head;          // serialised status line & headers (_headLength bytes) until they're sent
     size_t _headLength;
+    size_t _headSent;
     size_t _sentLength;
     size_t _ackedLength;
     size_t _writtenLength;
     WebResponseState _state;
+    bool _keepAlive;      // the connection stays open for the next request once this is sent
     const char* _responseCodeToString(int code);
+    void _addConnectionHeader(AsyncWebServerRequest *request);
 
   public:
-    AsyncWebServerResponse();
+    // arena is the one the response was placed in with new (arena), as its headers go there too
+    AsyncWebServerResponse(AsyncWebArena *arena=NULL);
     virtual ~AsyncWebServerResponse();
     virtual void setCode(int code);
     virtual void setContentLength(size_t len);
     virtual void setContentType(const String& type);
     virtual void addHeader(const String& name, const String& value);
     virtual String _assembleHead(uint8_t version);
+    bool _buildHead(uint8_t version);
+    void _freeHead();
     virtual bool _started() const;
     virtual bool _finished() const;
     virtual bool _failed() const;
     virtual bool _sourceValid() const;
+    bool _keepsAlive() const { return _keepAlive; }
     virtual void _respond(AsyncWebServerRequest *request);
     virtual size_t _ack(AsyncWebServerRequest *request, size_t len, uint32_t time);
 };
 
+/*
+ * PREPARED RESPONSE :: A fixed reply serialised up front & written straight from its buffer
+ *
+ * For replies that never change (captive-portal redirects, 404s): sending one allocates nothing
+ * and skips _assembleHead. Set it up (& any DefaultHeaders) before begin(); the bytes can't change
+ * while it's in use.
+ * */
+
+class AsyncPreparedResponse {
+  private:
+    int _code;
+    String _contentType;
+    String _content;
+    AsyncWebList<AsyncWebHeader *> _headers;
+    String _bytes[2]; // whole reply, head & body, for HTTP/1.0 & HTTP/1.1 requests
+    void _prepare();
+
+  public:
+    AsyncPreparedResponse(int code, const String& contentType=String(), const String& content=String());
+    ~AsyncPreparedResponse();
+    AsyncPreparedResponse(const AsyncPreparedResponse&) = delete;
+    AsyncPreparedResponse& operator=(const AsyncPreparedResponse&) = delete;
+    AsyncPreparedResponse& addHeader(const String& name, const String& value);
+    const String& _bytesFor(uint8_t version) const { return _bytes[version ? 1 : 0]; }
+};
+
 /*
  * SERVER :: One instance
  * */
@@ -397,9 +540,21 @@ typedef std::function<void(AsyncWebServerRequest *request, uint8_t *data, size_t
 class AsyncWebServer {
   protected:
     AsyncServer _server;
-    LinkedList<AsyncWebRewrite*> _rewrites;
-    LinkedList<AsyncWebHandler*> _handlers;
+    AsyncWebList<AsyncWebRewrite*> _rewrites;
+    AsyncWebList<AsyncWebHandler*> _handlers;
+    AsyncWebRouter *_router;   // replaced whole, never changed while in use
+    bool _routed;              // begin() has run, so changing the handlers rebuilds _router
+    // Held while _handlers, _router & the lists below change; never while a handler's code runs
+    AsyncWebLock _routerLock;
+    size_t _matching;          // requests being matched right now, each against the _router of the time
+    AsyncWebList<AsyncWebRouter*> _retiredRouters;   // replaced or removed, & deleted by _collect()
+    AsyncWebList<AsyncWebHandler*> _retiredHandlers; // once _matching is 0
     AsyncCallbackWebHandler* _catchAllHandler;
+    uint16_t _keepAliveTimeout;
+    uint16_t _keepAliveMax;
+
+    void _swapRouter();
+    void _collect();
 
   public:
     AsyncWebServer(uint16_t port);
@@ -432,6 +587,12 @@ class AsyncWebServer {
     void onRequestBody(ArBodyHandlerFunction fn); //handle posts with plain body content (JSON often transmitted this way as a request)
 
     void reset(); //remove all writers and handlers, with onNotFound/onFileUpload/onRequestBody 
+
+    //keep connections open for idleTimeout seconds between requests, up to maxRequests each
+    //(0 for no limit); an idleTimeout of 0 closes every connection after its first response
+    void setKeepAlive(uint16_t idleTimeout, uint16_t maxRequests = ASYNCWEBSERVER_KEEPALIVE_MAX);
+    uint16_t keepAliveTimeout() const { return _keepAliveTimeout; }
+    uint16_t keepAliveMax() const { return _keepAliveMax; }
   
     void _handleDisconnect(AsyncWebServerRequest *request);
     void _attachHandler(AsyncWebServerRequest *request);
@@ -439,11 +600,11 @@ class AsyncWebServer {
 };
 
 class DefaultHeaders {
-  using headers_t = LinkedList<AsyncWebHeader *>;
+  using headers_t = AsyncWebList<AsyncWebHeader *>;
   headers_t _headers;
   
   DefaultHeaders()
-  :_headers(headers_t([](AsyncWebHeader *h){ delete h; }))
+  :_headers([](AsyncWebHeader *h){ delete h; })
   {}
 public:
   using ConstIterator = headers_t::ConstIterator;
@@ -23,159 +23,190 @@
 
 #include "stddef.h"
 #include "WString.h"
+#include "WebArena.h"
+#include <functional>
+#include <new>
+#include <utility>
 
-template <typename T>
-class LinkedListNode {
-    T _value;
-  public:
-    LinkedListNode<T>* next;
-    LinkedListNode(const T val): _value(val), next(nullptr) {}
-    ~LinkedListNode(){}
-    const T& value() const { return _value; };
-    T& value(){ return _value; }
-};
+/*
+ * LIST :: Ordered elements in one contiguous block, the first N of them kept inline
+ *
+ * Headers, parameters, handlers & clients are short lists that are scanned far more often than
+ * they change, so they're stored as arrays: length() & nth() are O(1), lookups walk adjacent
+ * memory, and a list that stays within its inline capacity allocates nothing. Past that the
+ * elements move to a block from the list's arena (or the heap), doubling as it fills.
+ *
+ * Iterators hold an index rather than a pointer, so an element added or removed mid-loop (eg a
+ * client disconnecting during a broadcast) can't leave the loop reading freed storage; the loop
+ * just sees the list as it is now. Destroying a list frees its storage but not its elements,
+ * which owners release with free() as before.
+ * */
 
-template <typename T, template<typename> class Item = LinkedListNode>
-class LinkedList {
+template <typename T, size_t N = 0>
+class AsyncWebList {
   public:
-    typedef Item<T> ItemType;
     typedef std::function<void(const T&)> OnRemove;
     typedef std::function<bool(const T&)> Predicate;
   private:
-    ItemType* _root;
+    T* _items;
+    size_t _length;
+    size_t _capacity;
     OnRemove _onRemove;
+    AsyncWebArena* _arena; // where storage past the inline elements comes from; NULL for the heap
+    alignas(T) uint8_t _inline[N ? N * sizeof(T) : 1];
+
+    T* _inlineItems(){ return reinterpret_cast<T*>(_inline); }
+
+    bool _reserve(size_t capacity){
+      T* items = (T*)(_arena ? AsyncWebArena::allocate(_arena, capacity * sizeof(T)) : malloc(capacity * sizeof(T)));
+      if(!items)
+        return false;
+      for(size_t i = 0; i < _length; i++){
+        new (&items[i]) T(std::move(_items[i]));
+        _items[i].~T();
+      }
+      _release();
+      _items = items;
+      _capacity = capacity;
+      return true;
+    }
+    bool _grow(){
+      return _reserve(_capacity ? _capacity * 2 : 4);
+    }
+    void _release(){
+      if(_items == _inlineItems())
+        return;
+      if(_arena) AsyncWebArena::release(_items);
+      else ::free(_items);
+    }
+    // Takes the element at i out of the list, keeping the rest in order, & hands it to _onRemove
+    // once the list no longer holds it
+    void _removeAt(size_t i){
+      T t(std::move(_items[i]));
+      for(; i + 1 < _length; i++)
+        _items[i] = std::move(_items[i + 1]);
+      _items[--_length].~T();
+      if(_onRemove)
+        _onRemove(t);
+    }
 
     class Iterator {
-      ItemType* _node;
+      const AsyncWebList* _list;
+      size_t _i;
     public:
-      Iterator(ItemType* current = nullptr) : _node(current) {}
-      Iterator(const Iterator& i) : _node(i._node) {}
-      Iterator& operator ++() { _node = _node->next; return *this; }
-      bool operator != (const Iterator& i) const { return _node != i._node; }
-      const T& operator * () const { return _node->value(); }
-      const T* operator -> () const { return &_node->value(); }
+      Iterator(const AsyncWebList* list, size_t i) : _list(list), _i(i) {}
+      Iterator& operator ++() { _i++; return *this; }
+      bool operator != (const Iterator& i) const { return _i < _list->_length && _i != i._i; }
+      const T& operator * () const { return _list->_items[_i]; }
+      const T* operator -> () const { return &_list->_items[_i]; }
     };
-    
+
   public:
     typedef const Iterator ConstIterator;
-    ConstIterator begin() const { return ConstIterator(_root); }
-    ConstIterator end() const { return ConstIterator(nullptr); }
-
-    LinkedList(OnRemove onRemove) : _root(nullptr), _onRemove(onRemove) {}
-    ~LinkedList(){}
-    void add(const T& t){
-      auto it = new ItemType(t);
-      if(!_root){
-        _root = it;
-      } else {
-        auto i = _root;
-        while(i->next) i = i->next;
-        i->next = it;
-      }
+    ConstIterator begin() const { return ConstIterator(this, 0); }
+    ConstIterator end() const { return ConstIterator(this, (size_t)-1); }
+
+    AsyncWebList(OnRemove onRemove, AsyncWebArena* arena = nullptr)
+      : _items(_inlineItems()), _length(0), _capacity(N), _onRemove(onRemove), _arena(arena) {}
+    // Copies are snapshots on the heap (eg AsyncWebSocket::getClients()); they share the elements
+    AsyncWebList(const AsyncWebList& other)
+      : _items(_inlineItems()), _length(0), _capacity(N), _onRemove(other._onRemove), _arena(nullptr) {
+      if(other._length > N)
+        _reserve(other._length);
+      for(const auto& t: other)
+        add(t);
+    }
+    AsyncWebList& operator=(const AsyncWebList&) = delete;
+    ~AsyncWebList(){
+      for(size_t i = 0; i < _length; i++)
+        _items[i].~T();
+      _release();
+    }
+
+    bool add(const T& t){
+      if(_length == _capacity && !_grow())
+        return false;
+      new (&_items[_length++]) T(t);
+      return true;
     }
     T& front() const {
-      return _root->value();
+      return _items[0];
     }
-    
+
     bool isEmpty() const {
-      return _root == nullptr;
+      return _length == 0;
     }
     size_t length() const {
-      size_t i = 0;
-      auto it = _root;
-      while(it){
-        i++;
-        it = it->next;
-      }
-      return i;
+      return _length;
     }
     size_t count_if(Predicate predicate) const {
-      size_t i = 0;
-      auto it = _root;
-      while(it){
-        if (!predicate){
-          i++;
-        }
-        else if (predicate(it->value())) {
-          i++;
-        }
-        it = it->next;
+      if(!predicate)
+        return _length;
+      size_t count = 0;
+      for(size_t i = 0; i < _length; i++){
+        if(predicate(_items[i]))
+          count++;
       }
-      return i;
-    }
-    const T* nth(size_t N) const {
-      size_t i = 0;
-      auto it = _root;
-      while(it){
-        if(i++ == N)
-          return &(it->value());
-        it = it->next;
-      }
-      return nullptr;
+      return count;
+    }
+    const T* nth(size_t i) const {
+      return i < _length ? &_items[i] : nullptr;
     }
     bool remove(const T& t){
-      auto it = _root;
-      auto pit = _root;
-      while(it){
-        if(it->value() == t){
-          if(it == _root){
-            _root = _root->next;
-          } else {
-            pit->next = it->next;
-          }
-          
-          if (_onRemove) {
-            _onRemove(it->value());
-          }
-          
-          delete it;
+      for(size_t i = 0; i < _length; i++){
+        if(_items[i] == t){
+          _removeAt(i);
           return true;
         }
-        pit = it;
-        it = it->next;
       }
       return false;
     }
     bool remove_first(Predicate predicate){
-      auto it = _root;
-      auto pit = _root;
-      while(it){
-        if(predicate(it->value())){
-          if(it == _root){
-            _root = _root->next;
-          } else {
-            pit->next = it->next;
-          }
-          if (_onRemove) {
-            _onRemove(it->value());
-          }
-          delete it;
+      for(size_t i = 0; i < _length; i++){
+        if(predicate(_items[i])){
+          _removeAt(i);
           return true;
         }
-        pit = it;
-        it = it->next;
       }
       return false;
     }
-    
-    void free(){
-      while(_root != nullptr){
-        auto it = _root;
-        _root = _root->next;
-        if (_onRemove) {
-          _onRemove(it->value());
+    // Removes every element matching predicate; returns how many went
+    size_t remove_if(Predicate predicate){
+      size_t removed = 0;
+      for(size_t i = 0; i < _length; ){
+        if(predicate(_items[i])){
+          _removeAt(i);
+          removed++;
+        } else {
+          i++;
         }
-        delete it;
       }
-      _root = nullptr;
+      return removed;
+    }
+
+    void free(){
+      while(_length)
+        _removeAt(0);
+    }
+    // free(), then gives back any storage past the inline elements, so the list takes nothing from
+    // its arena (eg a request starting over on a kept-alive connection)
+    void clear(){
+      free();
+      _release();
+      _items = _inlineItems();
+      _capacity = N;
     }
 };
 
+// The name these lists had when they were linked, for code outside the library that uses it
+template <typename T>
+using LinkedList = AsyncWebList<T>;
+
 
-class StringArray : public LinkedList<String> {
+class StringArray : public AsyncWebList<String> {
 public:
   
-  StringArray() : LinkedList(nullptr) {}
+  StringArray(AsyncWebArena* arena = nullptr) : AsyncWebList(nullptr, arena) {}
   
   bool containsIgnoreCase(const String& str){
     for (const auto& s : *this) {
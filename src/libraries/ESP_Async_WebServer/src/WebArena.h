@@ -0,0 +1,144 @@
+#ifndef ASYNCWEBARENA_H_
+#define ASYNCWEBARENA_H_
+
+// Per-request bump allocator, so a page load doesn't scatter dozens of small blocks over the
+// heap that WiFi also allocates from
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <new>
+#include <atomic>
+#include <utility>
+
+// Bytes kept inline in every request (0 puts everything on the heap). It changes the request's
+// layout, so override it with a build flag that reaches the library as well as the sketch.
+#ifndef ASYNCWEBSERVER_ARENA_SIZE
+#define ASYNCWEBSERVER_ARENA_SIZE 1024
+#endif
+
+typedef struct {
+    uint32_t allocs;     // blocks served from a request's arena
+    uint32_t fallbacks;  // blocks that didn't fit in their request's arena & went to the heap
+    uint32_t heapAllocs; // blocks allocated outside any request (eg responses built by a handler object)
+    uint32_t peak;       // most arena bytes used by a single request
+} AsyncWebArenaStats;
+
+/*
+ * ARENA :: Backs one request's headers, parameters, list nodes, response & response headers
+ *
+ * Every block starts with a tag naming the arena it came from (NULL for the heap), so release()
+ * works on any block whatever its origin. Blocks aren't reused individually; the
+ * arena rewinds to empty once every block handed out has been released.
+ * */
+
+class AsyncWebArena {
+  private:
+    struct Header {
+      AsyncWebArena *owner;
+      uint32_t magic;
+    };
+    union Tag {
+      Header header;
+      max_align_t align;
+    };
+    static const uint32_t MAGIC = 0xA7E4A5u;
+    static const size_t ALIGN = alignof(max_align_t);
+
+    alignas(max_align_t) uint8_t _buffer[ASYNCWEBSERVER_ARENA_SIZE ? ASYNCWEBSERVER_ARENA_SIZE : 1];
+    size_t _used;
+    size_t _live;
+    size_t _highWater;
+
+    static std::atomic<uint32_t> _allocs;
+    static std::atomic<uint32_t> _fallbacks;
+    static std::atomic<uint32_t> _heapAllocs;
+    static std::atomic<uint32_t> _peak;
+
+    void _rewind(){
+      uint32_t peak = _peak.load(std::memory_order_relaxed);
+      while(_highWater > peak && !_peak.compare_exchange_weak(peak, _highWater, std::memory_order_relaxed));
+      _used = 0;
+      _highWater = 0;
+    }
+
+  public:
+    AsyncWebArena(): _used(0), _live(0), _highWater(0) {}
+    ~AsyncWebArena(){ _rewind(); }
+    AsyncWebArena(const AsyncWebArena&) = delete;
+    AsyncWebArena& operator=(const AsyncWebArena&) = delete;
+
+    size_t used() const { return _used; }
+    size_t live() const { return _live; }
+
+    // Returns a block from `arena`, or from the heap if `arena` is NULL or full; NULL if both fail
+    static void *allocate(AsyncWebArena *arena, size_t size){
+      size_t need = sizeof(Tag) + ((size + ALIGN - 1) & ~(ALIGN - 1));
+      Tag *tag;
+      if(arena && arena->_used + need <= ASYNCWEBSERVER_ARENA_SIZE){
+        tag = (Tag*)(arena->_buffer + arena->_used);
+        arena->_used += need;
+        arena->_live++;
+        if(arena->_used > arena->_highWater)
+          arena->_highWater = arena->_used;
+        _allocs.fetch_add(1, std::memory_order_relaxed);
+      } else {
+        tag = (Tag*)malloc(need);
+        if(!tag)
+          return NULL;
+        (arena ? _fallbacks : _heapAllocs).fetch_add(1, std::memory_order_relaxed);
+        arena = NULL;
+      }
+      tag->header.owner = arena;
+      tag->header.magic = MAGIC;
+      return tag + 1;
+    }
+
+    // Frees a block from allocate(), whichever arena (or the heap) it came from
+    static void release(void *ptr){
+      if(!ptr)
+        return;
+      Tag *tag = (Tag*)ptr - 1;
+      AsyncWebArena *owner = tag->header.owner;
+      tag->header.magic = 0;
+      if(!owner){
+        free(tag);
+      } else if(--owner->_live == 0){
+        owner->_rewind();
+      }
+    }
+
+    template<typename T, typename... Args>
+    static T *create(AsyncWebArena *arena, Args&&... args){
+      void *ptr = allocate(arena, sizeof(T));
+      return ptr ? new (ptr) T(std::forward<Args>(args)...) : NULL;
+    }
+
+    template<typename T>
+    static void destroy(T *obj){
+      if(obj){
+        obj->~T();
+        release(obj);
+      }
+    }
+
+    static void getStats(AsyncWebArenaStats &stats){
+      stats.allocs = _allocs.load(std::memory_order_relaxed);
+      stats.fallbacks = _fallbacks.load(std::memory_order_relaxed);
+      stats.heapAllocs = _heapAllocs.load(std::memory_order_relaxed);
+      stats.peak = _peak.load(std::memory_order_relaxed);
+    }
+};
+
+// Base for classes whose instances may live in a request's arena: `new (arena) T(...)` places one
+// there (or on the heap if arena is NULL/full), plain `new T(...)` uses the heap, and `delete`
+// works on either.
+class AsyncWebArenaObject {
+  public:
+    static void *operator new(size_t size) noexcept { return AsyncWebArena::allocate(NULL, size); }
+    static void *operator new(size_t size, AsyncWebArena *arena) noexcept { return AsyncWebArena::allocate(arena, size); }
+    static void operator delete(void *ptr) { AsyncWebArena::release(ptr); }
+    static void operator delete(void *ptr, AsyncWebArena *) { AsyncWebArena::release(ptr); }
+};
+
+#endif /* ASYNCWEBARENA_H_ */
@@ -0,0 +1,216 @@
+#include "WebDeflate.h"
+#include <string.h>
+
+static const size_t MIN_MATCH = 3;
+static const size_t MAX_MATCH = 258;
+
+// Indexed by length symbol - 257 & distance symbol (RFC 1951 3.2.5)
+static const uint16_t lengthBase[29] = {
+  3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t lengthExtra[29] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t distanceBase[30] = {
+  1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073,
+  4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t distanceExtra[30] = {
+  0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+// Index of the last entry in base that's no more than value
+static size_t symbolFor(const uint16_t *base, size_t count, size_t value){
+  size_t i = count - 1;
+  while(base[i] > value)
+    i--;
+  return i;
+}
+
+static uint32_t crc32(uint32_t crc, const uint8_t *data, size_t len){
+  static const uint32_t table[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+  };
+  crc = ~crc;
+  while(len--){
+    crc ^= *data++;
+    crc = (crc >> 4) ^ table[crc & 15];
+    crc = (crc >> 4) ^ table[crc & 15];
+  }
+  return ~crc;
+}
+
+static uint32_t adler32(uint32_t adler, const uint8_t *data, size_t len){
+  uint32_t a = adler & 0xFFFF;
+  uint32_t b = adler >> 16;
+  while(len){
+    size_t n = len < 5552 ? len : 5552; // the most bytes before b can overflow
+    len -= n;
+    while(n--){
+      a += *data++;
+      b += a;
+    }
+    a %= 65521;
+    b %= 65521;
+  }
+  return (b << 16) | a;
+}
+
+static inline size_t hash3(const uint8_t *p){
+  uint32_t v = ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+  return (v * 2654435761u) >> (32 - ASYNCWEBDEFLATE_HASH_BITS);
+}
+
+AsyncWebDeflate::AsyncWebDeflate(Format format)
+  : _pos(0)
+  , _end(0)
+  , _bits(0)
+  , _bitCount(0)
+  , _check(format == ZLIB ? 1 : 0)
+  , _size(0)
+  , _format(format)
+  , _started(false)
+  , _finished(false)
+{
+  memset(_head, 0, sizeof(_head));
+}
+
+uint8_t *AsyncWebDeflate::input(size_t &len){
+  if(_pos >= WINDOW)
+    _slide();
+  len = _finished ? 0 : sizeof(_data) - _end;
+  return _data + _end;
+}
+
+void AsyncWebDeflate::added(size_t len){
+  _check = _format == GZIP ? crc32(_check, _data + _end, len) : adler32(_check, _data + _end, len);
+  _size += len;
+  _end += len;
+}
+
+// Drops the oldest WINDOW bytes, which are out of reach of anything still to be compressed
+void AsyncWebDeflate::_slide(){
+  memmove(_data, _data + WINDOW, _end - WINDOW);
+  _pos -= WINDOW;
+  _end -= WINDOW;
+  for(size_t i = 0; i < HASH_SIZE; i++)
+    _head[i] = _head[i] > WINDOW ? _head[i] - WINDOW : 0;
+}
+
+void AsyncWebDeflate::_insert(size_t pos){
+  if(pos + MIN_MATCH <= _end)
+    _head[hash3(_data + pos)] = pos + 1;
+}
+
+void AsyncWebDeflate::_putBits(uint8_t *&out, uint32_t bits, uint8_t count){
+  _bits |= bits << _bitCount;
+  _bitCount += count;
+  while(_bitCount >= 8){
+    *out++ = _bits;
+    _bits >>= 8;
+    _bitCount -= 8;
+  }
+}
+
+// Huffman codes go out most significant bit first, unlike everything else
+void AsyncWebDeflate::_putCode(uint8_t *&out, uint16_t code, uint8_t count){
+  uint16_t reversed = 0;
+  for(uint8_t i = 0; i < count; i++, code >>= 1)
+    reversed = (reversed << 1) | (code & 1);
+  _putBits(out, reversed, count);
+}
+
+void AsyncWebDeflate::_putLiteral(uint8_t *&out, uint8_t literal){
+  if(literal < 144)
+    _putCode(out, 0x30 + literal, 8);
+  else
+    _putCode(out, 0x190 + literal - 144, 9);
+}
+
+void AsyncWebDeflate::_putMatch(uint8_t *&out, size_t length, size_t distance){
+  size_t i = symbolFor(lengthBase, 29, length);
+  uint16_t symbol = 257 + i;
+  if(symbol < 280)
+    _putCode(out, symbol - 256, 7);
+  else
+    _putCode(out, 0xC0 + symbol - 280, 8);
+  _putBits(out, length - lengthBase[i], lengthExtra[i]);
+
+  i = symbolFor(distanceBase, 30, distance);
+  _putCode(out, i, 5);
+  _putBits(out, distance - distanceBase[i], distanceExtra[i]);
+}
+
+void AsyncWebDeflate::_flush(uint8_t *&out){
+  if(_bitCount)
+    *out++ = _bits;
+  _bits = 0;
+  _bitCount = 0;
+}
+
+size_t AsyncWebDeflate::compress(uint8_t *out, size_t outLen, bool finish){
+  uint8_t *start = out;
+  uint8_t *limit = out + outLen;
+
+  if(!_started){
+    if(outLen < 16)
+      return 0;
+    if(_format == GZIP){
+      static const uint8_t header[10] = { 0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 0xFF };
+      memcpy(out, header, sizeof(header));
+      out += sizeof(header);
+    } else {
+      *out++ = 0x78;
+      *out++ = 0x01;
+    }
+    _putBits(out, 1, 1); // BFINAL: the whole body is one block
+    _putBits(out, 1, 2); // BTYPE 01: fixed Huffman codes
+    _started = true;
+  }
+
+  // A symbol is at most 31 bits, on top of at most 7 waiting in _bits
+  while(_pos < _end && limit - out >= 5){
+    size_t avail = _end - _pos;
+    if(avail < MAX_MATCH && !finish) // wait for the rest of a possible match
+      break;
+    size_t length = 0;
+    size_t distance = 0;
+    if(avail >= MIN_MATCH){
+      size_t h = hash3(_data + _pos);
+      size_t candidate = _head[h];
+      _head[h] = _pos + 1;
+      if(candidate && _pos + 1 - candidate <= WINDOW){
+        candidate--;
+        distance = _pos - candidate;
+        size_t max = avail < MAX_MATCH ? avail : MAX_MATCH;
+        while(length < max && _data[candidate + length] == _data[_pos + length])
+          length++;
+      }
+    }
+    if(length >= MIN_MATCH){
+      _putMatch(out, length, distance);
+      for(size_t i = 1; i < length; i++)
+        _insert(_pos + i);
+      _pos += length;
+    } else {
+      _putLiteral(out, _data[_pos++]);
+    }
+  }
+
+  if(finish && _pos == _end && !_finished && limit - out >= 10){
+    _putCode(out, 0, 7); // end of block
+    _flush(out);
+    if(_format == GZIP){
+      for(uint8_t i = 0; i < 4; i++)
+        *out++ = _check >> (8 * i);
+      for(uint8_t i = 0; i < 4; i++)
+        *out++ = _size >> (8 * i);
+    } else {
+      for(uint8_t i = 0; i < 4; i++)
+        *out++ = _check >> (24 - 8 * i);
+    }
+    _finished = true;
+  }
+  return out - start;
+}
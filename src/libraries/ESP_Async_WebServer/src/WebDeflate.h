@@ -0,0 +1,78 @@
+#ifndef ASYNCWEBDEFLATE_H_
+#define ASYNCWEBDEFLATE_H_
+
+// Streaming gzip/zlib compression of response bodies, for routes that opt in with
+// AsyncWebHandler::setCompression(): a few ms of CPU per page for a fraction of the airtime
+
+#include <stddef.h>
+#include <stdint.h>
+
+// How far back a match may reach; the compressor holds twice this much of the body
+#ifndef ASYNCWEBDEFLATE_WINDOW
+#define ASYNCWEBDEFLATE_WINDOW 1024
+#endif
+
+// log2 of the match hash table's entries (2 bytes each)
+#ifndef ASYNCWEBDEFLATE_HASH_BITS
+#define ASYNCWEBDEFLATE_HASH_BITS 10
+#endif
+
+// Smallest body setCompression() compresses unless it's given another threshold
+#ifndef ASYNCWEBSERVER_COMPRESS_THRESHOLD
+#define ASYNCWEBSERVER_COMPRESS_THRESHOLD 512
+#endif
+
+/*
+ * DEFLATE :: Fixed-size LZ77 compressor writing one fixed-Huffman block
+ *
+ * Everything it needs is inside the object, so a response allocates it once and compressing
+ * allocates nothing. Each position gets a single hash probe for a match, which on HTML & JSON
+ * costs little and keeps most of what a full deflate would save. The body is copied into
+ * input() & compressed into whatever room the caller has; what doesn't fit waits for the next call.
+ * */
+
+class AsyncWebDeflate {
+  public:
+    typedef enum { GZIP, ZLIB } Format; // Content-Encoding gzip & deflate respectively
+
+  private:
+    static const size_t WINDOW = ASYNCWEBDEFLATE_WINDOW;
+    static const size_t HASH_SIZE = (size_t)1 << ASYNCWEBDEFLATE_HASH_BITS;
+    static_assert(WINDOW >= 512 && WINDOW <= 16384, "deflate window must be 512 to 16384 bytes");
+
+    uint8_t _data[2 * WINDOW]; // the last WINDOW bytes compressed (history), then the input not yet compressed
+    uint16_t _head[HASH_SIZE]; // latest position + 1 of each hashed 3 bytes in _data, 0 for none
+    size_t _pos;               // next byte of _data to compress
+    size_t _end;               // end of the input in _data
+    uint32_t _bits;            // output bits not yet written out, LSB first
+    uint8_t _bitCount;
+    uint32_t _check;           // CRC-32 (gzip) or Adler-32 (zlib) of the input so far
+    uint32_t _size;
+    Format _format;
+    bool _started;
+    bool _finished;
+
+    void _putBits(uint8_t *&out, uint32_t bits, uint8_t count);
+    void _putCode(uint8_t *&out, uint16_t code, uint8_t count);
+    void _putLiteral(uint8_t *&out, uint8_t literal);
+    void _putMatch(uint8_t *&out, size_t length, size_t distance);
+    void _flush(uint8_t *&out);
+    void _insert(size_t pos);
+    void _slide();
+
+  public:
+    AsyncWebDeflate(Format format);
+    AsyncWebDeflate(const AsyncWebDeflate&) = delete;
+    AsyncWebDeflate& operator=(const AsyncWebDeflate&) = delete;
+
+    // Where up to `len` more bytes of the body can be copied, then handed over with added()
+    uint8_t *input(size_t &len);
+    void added(size_t len);
+    // Compresses what it can into out (at most outLen bytes, and it needs 16 to get anywhere) &
+    // returns how many it wrote; with finish, the body has all been added & the stream is closed
+    // off once it's compressed
+    size_t compress(uint8_t *out, size_t outLen, bool finish);
+    bool finished() const { return _finished; }
+};
+
+#endif /* ASYNCWEBDEFLATE_H_ */
@@ -50,6 +50,7 @@ class AsyncStaticWebHandler: public AsyncWebHandler {
   public:
     AsyncStaticWebHandler(const char* uri, FS& fs, const char* path, const char* cache_control);
     virtual bool canHandle(AsyncWebServerRequest *request) override final;
+    virtual WebRouteKind route(String& path, WebRequestMethodComposite& methods) const override final;
     virtual void handleRequest(AsyncWebServerRequest *request) override final;
     AsyncStaticWebHandler& setIsDir(bool isDir);
     AsyncStaticWebHandler& setDefaultFile(const char* filename);
@@ -124,6 +125,18 @@ class AsyncCallbackWebHandler: public AsyncWebHandler {
       request->addInterestingHeader("ANY");
       return true;
     }
+
+    virtual WebRouteKind route(String& path, WebRequestMethodComposite& methods) const override final {
+      methods = _method;
+      if(_isRegex || !_uri.length() || _uri.startsWith("/*."))
+        return ROUTE_ANY;
+      if(_uri.endsWith("*")){
+        path = _uri.substring(0, _uri.length() - 1);
+        return ROUTE_PREFIX;
+      }
+      path = _uri;
+      return ROUTE_PATH;
+    }
   
     virtual void handleRequest(AsyncWebServerRequest *request) override final {
       if((_username != "" && _password != "") && !request->authenticate(_username.c_str(), _password.c_str()))
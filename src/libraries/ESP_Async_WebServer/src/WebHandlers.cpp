@@ -102,6 +102,12 @@ bool AsyncStaticWebHandler::canHandle(AsyncWebServerRequest *request){
   return false;
 }
 
+WebRouteKind AsyncStaticWebHandler::route(String& path, WebRequestMethodComposite& methods) const {
+  path = _uri;
+  methods = HTTP_GET;
+  return ROUTE_PREFIX;
+}
+
 bool AsyncStaticWebHandler::_getFile(AsyncWebServerRequest *request)
 {
   // Remove the found uri
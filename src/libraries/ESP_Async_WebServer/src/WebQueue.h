@@ -0,0 +1,176 @@
+#ifndef ASYNCWEBQUEUE_H_
+#define ASYNCWEBQUEUE_H_
+
+// Fixed-capacity message queues for WebSocket & SSE clients: the sketch queues messages from its
+// own tasks while the client sends them from AsyncTCP's, with no heap node per message
+
+#include <Arduino.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+
+// How long a QUEUE_BLOCK producer waits for room before giving up on its message
+#ifndef ASYNCWEBQUEUE_BLOCK_MS
+#define ASYNCWEBQUEUE_BLOCK_MS 100
+#endif
+
+typedef enum {
+  QUEUE_DROP_NEWEST,     // a full queue refuses the new message
+  QUEUE_DROP_OLDEST,     // the oldest message not yet started makes room for the new one
+  QUEUE_COALESCE_LATEST, // every message not yet started gives way to the new one (eg status updates)
+  QUEUE_BLOCK            // the producer waits up to ASYNCWEBQUEUE_BLOCK_MS for room, then refuses it;
+                         // never from an event handler, which runs on the task that makes the room
+} AwsQueuePolicy;
+
+/*
+ * QUEUE :: Bounded multi-producer, multi-consumer ring of pointers
+ *
+ * Each slot carries a sequence number saying whether it's free for the push or full for the pop
+ * of the current lap, so pushes & pops only contend on their own index. A consumer takes the
+ * message it's working on out of the queue, which leaves everything still queued unstarted; that
+ * lets a producer facing a full queue pop the oldest messages itself under the drop policies.
+ * */
+
+template <typename T, size_t N>
+class AsyncWebQueue {
+  public:
+    typedef std::function<void(const T&)> OnDrop;
+  private:
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "queue capacity must be a power of two");
+    struct Slot {
+      std::atomic<uint32_t> seq;
+      T value;
+    };
+    Slot _slots[N];
+    std::atomic<uint32_t> _head;
+    std::atomic<uint32_t> _tail;
+    OnDrop _onDrop;
+
+    void _drop(const T& t){
+      if(_onDrop)
+        _onDrop(t);
+    }
+
+  public:
+    AsyncWebQueue(OnDrop onDrop): _head(0), _tail(0), _onDrop(onDrop) {
+      for(size_t i = 0; i < N; i++)
+        _slots[i].seq.store(i, std::memory_order_relaxed);
+    }
+    ~AsyncWebQueue(){ clear(); }
+    AsyncWebQueue(const AsyncWebQueue&) = delete;
+    AsyncWebQueue& operator=(const AsyncWebQueue&) = delete;
+
+    static size_t capacity(){ return N; }
+    size_t length() const {
+      uint32_t head = _head.load(std::memory_order_acquire);
+      return _tail.load(std::memory_order_acquire) - head;
+    }
+    bool isEmpty() const { return length() == 0; }
+    bool isFull() const { return length() >= N; }
+
+    // Adds t at the back unless the queue is full
+    bool tryPush(const T& t){
+      uint32_t pos = _tail.load(std::memory_order_relaxed);
+      for(;;){
+        Slot &slot = _slots[pos & (N - 1)];
+        int32_t diff = (int32_t)(slot.seq.load(std::memory_order_acquire) - pos);
+        if(diff == 0){
+          if(_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)){
+            slot.value = t;
+            slot.seq.store(pos + 1, std::memory_order_release);
+            return true;
+          }
+        } else if(diff < 0){
+          return false;
+        } else {
+          pos = _tail.load(std::memory_order_relaxed);
+        }
+      }
+    }
+
+    // Takes the front message into t; false if the queue is empty
+    bool pop(T& t){
+      uint32_t pos = _head.load(std::memory_order_relaxed);
+      for(;;){
+        Slot &slot = _slots[pos & (N - 1)];
+        int32_t diff = (int32_t)(slot.seq.load(std::memory_order_acquire) - (pos + 1));
+        if(diff == 0){
+          if(_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)){
+            t = slot.value;
+            slot.seq.store(pos + N, std::memory_order_release);
+            return true;
+          }
+        } else if(diff < 0){
+          return false;
+        } else {
+          pos = _head.load(std::memory_order_relaxed);
+        }
+      }
+    }
+
+    // Adds t at the back, making room as policy says if the queue is full. Whatever doesn't end up
+    // queued, t included, goes to the drop callback; false if t was refused.
+    bool push(const T& t, AwsQueuePolicy policy){
+      if(tryPush(t))
+        return true;
+      T old;
+      if(policy == QUEUE_DROP_OLDEST || policy == QUEUE_COALESCE_LATEST){
+        // Other producers may take the room first; give up after a lap's worth of tries
+        for(size_t i = 0; i < N; i++){
+          if(pop(old))
+            _drop(old);
+          while(policy == QUEUE_COALESCE_LATEST && pop(old))
+            _drop(old);
+          if(tryPush(t))
+            return true;
+        }
+      } else if(policy == QUEUE_BLOCK){
+        uint32_t start = millis();
+        while(millis() - start < ASYNCWEBQUEUE_BLOCK_MS){
+          delay(1);
+          if(tryPush(t))
+            return true;
+        }
+      }
+      _drop(t);
+      return false;
+    }
+
+    void clear(){
+      T t;
+      while(pop(t))
+        _drop(t);
+    }
+};
+
+/*
+ * QUEUE RUNNER :: Keeps a client's consumer side on one task at a time without blocking
+ *
+ * Whoever asks for a pass while another task is in one just leaves a note, and the running task
+ * does another pass before it lets go, so no request is lost and nobody waits.
+ *
+ *   if(!_runner.request()) return;
+ *   do { _runner.start(); ...one pass... } while(_runner.next());
+ * */
+
+class AsyncWebQueueRunner {
+  private:
+    std::atomic<bool> _running;
+    std::atomic<bool> _pending;
+  public:
+    AsyncWebQueueRunner(): _running(false), _pending(false) {}
+    // True if the caller now runs the passes
+    bool request(){
+      _pending.store(true);
+      return !_running.exchange(true);
+    }
+    void start(){ _pending.store(false); }
+    // True if a pass was asked for during the last one & the caller has to run it as well
+    bool next(){
+      _running.store(false);
+      return _pending.load() && !_running.exchange(true);
+    }
+};
+
+#endif /* ASYNCWEBQUEUE_H_ */
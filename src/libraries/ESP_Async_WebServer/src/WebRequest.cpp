@@ -31,14 +31,26 @@ static const String SharedEmptyString = String();
 #define __is_param_char(c) ((c) && ((c) != '{') && ((c) != '[') && ((c) != '&') && ((c) != '='))
 
 enum { PARSE_REQ_START, PARSE_REQ_HEADERS, PARSE_REQ_BODY, PARSE_REQ_END, PARSE_REQ_FAIL };
+enum { ENCODING_GZIP = 1, ENCODING_DEFLATE = 2 };
 
 AsyncWebServerRequest::AsyncWebServerRequest(AsyncWebServer* s, AsyncClient* c)
   : _client(c)
   , _server(s)
   , _handler(NULL)
   , _response(NULL)
+  , _preparedData(NULL)
+  , _preparedLeft(0)
+  , _interestingHeaders(&_arena)
+  , _interestingIds(0)
   , _temp()
+  , _line(NULL)
+  , _lineLength(0)
   , _parseState(0)
+  , _keepAlive(false)
+  , _encodings(0)
+  , _served(0)
+  , _pipelined(NULL)
+  , _pipelinedLength(0)
   , _version(0)
   , _method(HTTP_ANY)
   , _url()
@@ -53,9 +65,12 @@ AsyncWebServerRequest::AsyncWebServerRequest(AsyncWebServer* s, AsyncClient* c)
   , _expectingContinue(false)
   , _contentLength(0)
   , _parsedLength(0)
-  , _headers(LinkedList<AsyncWebHeader *>([](AsyncWebHeader *h){ delete h; }))
-  , _params(LinkedList<AsyncWebParameter *>([](AsyncWebParameter *p){ delete p; }))
-  , _pathParams(LinkedList<String *>([](String *p){ delete p; }))
+  , _rawHeaders(NULL)
+  , _rawHeadersTail(&_rawHeaders)
+  , _knownHeaders()
+  , _headerCount(0)
+  , _params([](AsyncWebParameter *p){ delete p; }, &_arena)
+  , _pathParams([](String *p){ AsyncWebArena::destroy(p); }, &_arena)
   , _multiParseState(0)
   , _boundaryPosition(0)
   , _itemStartIndex(0)
@@ -78,7 +93,7 @@ AsyncWebServerRequest::AsyncWebServerRequest(AsyncWebServer* s, AsyncClient* c)
 }
 
 AsyncWebServerRequest::~AsyncWebServerRequest(){
-  _headers.free();
+  _freeHeaders();
 
   _params.free();
   _pathParams.free();
@@ -96,109 +111,194 @@ AsyncWebServerRequest::~AsyncWebServerRequest(){
   if(_tempFile){
     _tempFile.close();
   }
+
+  AsyncWebArena::release(_line);
+  free(_pipelined);
 }
 
+// Head lines are parsed in place from each received segment (AsyncClient delivers every pbuf of
+// a chain separately, straight from its payload). Only a line that straddles two segments is
+// copied, into _line, so no String is built or reallocated per line and the caller's buffer is
+// never written to.
 void AsyncWebServerRequest::_onData(void *buf, size_t len){
-  size_t i = 0;
-  while (true) {
+  const char *data = (const char*)buf;
 
-  if(_parseState < PARSE_REQ_BODY){
-    // Find new line in buf
-    char *str = (char*)buf;
-    for (i = 0; i < len; i++) {
-      if (str[i] == '\n') {
-        break;
-      }
+  // Anything after the end of this request belongs to the next one (see _holdPipelined)
+  if(_parseState >= PARSE_REQ_END){
+    if(_parseState == PARSE_REQ_END)
+      _holdPipelined(data, len);
+    return;
+  }
+
+  while(len && _parseState < PARSE_REQ_BODY){
+    const char *eol = (const char*)memchr(data, '\n', len);
+    if(!eol){ // line continues in the next segment
+      if(!_carryLine(data, len))
+        _failHead();
+      return;
     }
-    if (i == len) { // No new line, just add the buffer in _temp
-      char ch = str[len-1];
-      str[len-1] = 0;
-      _temp.reserve(_temp.length()+len);
-      _temp.concat(str);
-      _temp.concat(ch);
-    } else { // Found new line - extract it and parse
-      str[i] = 0; // Terminate the string at the end of the line.
-      _temp.concat(str);
-      _temp.trim();
-      _parseLine();
-      if (++i < len) {
-        // Still have more buffer to process
-        buf = str+i;
-        len-= i;
-        continue;
+    size_t lineLen = eol - data;
+    if(_lineLength){
+      if(!_carryLine(data, lineLen)){
+        _failHead();
+        return;
       }
+      _parseLine(_line, _lineLength);
+      _lineLength = 0;
+    } else {
+      _parseLine(data, lineLen);
     }
-  } else if(_parseState == PARSE_REQ_BODY){
+    data = eol + 1;
+    len -= lineLen + 1;
+  }
+
+  if(len && _parseState == PARSE_REQ_BODY){
+    uint8_t *body = (uint8_t*)data;
+    size_t bodyLen = std::min(len, _contentLength - _parsedLength);
     // A handler should be already attached at this point in _parseLine function.
     // If handler does nothing (_onRequest is NULL), we don't need to really parse the body.
     const bool needParse = _handler && !_handler->isRequestHandlerTrivial();
     if(_isMultipart){
       if(needParse){
         size_t i;
-        for(i=0; i<len; i++){
-          _parseMultipartPostByte(((uint8_t*)buf)[i], i == len - 1);
+        for(i=0; i<bodyLen; i++){
+          _parseMultipartPostByte(body[i], i == bodyLen - 1);
           _parsedLength++;
         }
       } else
-          _parsedLength += len;
+          _parsedLength += bodyLen;
     } else {
       if(_parsedLength == 0){
         if(_contentType.startsWith("application/x-www-form-urlencoded")){
           _isPlainPost = true;
-        } else if(_contentType == "text/plain" && __is_param_char(((char*)buf)[0])){
+        } else if(_contentType == "text/plain" && __is_param_char(data[0])){
           size_t i = 0;
-          while (i<len && __is_param_char(((char*)buf)[i++]));
-          if(i < len && ((char*)buf)[i-1] == '='){
+          while (i<bodyLen && __is_param_char(data[i++]));
+          if(i < bodyLen && data[i-1] == '='){
             _isPlainPost = true;
           }
         }
       }
       if(!_isPlainPost) {
         //check if authenticated before calling the body
-        if(_handler) _handler->handleBody(this, (uint8_t*)buf, len, _parsedLength, _contentLength);
-        _parsedLength += len;
+        if(_handler) _handler->handleBody(this, body, bodyLen, _parsedLength, _contentLength);
+        _parsedLength += bodyLen;
       } else if(needParse) {
         size_t i;
-        for(i=0; i<len; i++){
+        for(i=0; i<bodyLen; i++){
           _parsedLength++;
-          _parsePlainPostChar(((uint8_t*)buf)[i]);
+          _parsePlainPostChar(body[i]);
         }
       } else {
-        _parsedLength += len;
+        _parsedLength += bodyLen;
       }
     }
-    if(_parsedLength == _contentLength){
+    data += bodyLen;
+    len -= bodyLen;
+    if(_parsedLength == _contentLength)
       _parseState = PARSE_REQ_END;
-      //check if authenticated before calling handleRequest and request auth instead
-      if(_handler) _handler->handleRequest(this);
-      else send(501);
-    }
   }
-  break;
+
+  // Whatever follows is held before the handler runs, as its response may end the connection
+  if(_parseState == PARSE_REQ_END){
+    if(len)
+      _holdPipelined(data, len);
+    _dispatch();
+  }
+}
+
+void AsyncWebServerRequest::_dispatch(){
+  //check if authenticated before calling handleRequest and request auth instead
+  if(_handler) _handler->handleRequest(this);
+  else send(501);
+}
+
+// Requests a client sends without waiting for the response to the one before (or sends before
+// that response is done) are kept as received and parsed in order once it is. If the client
+// won't keep the connection or sends more than fits, they're dropped & the connection closes
+// after the current response, which tells the client to send them again.
+void AsyncWebServerRequest::_holdPipelined(const char *data, size_t len){
+  if(!_canKeepAlive() || (_response != NULL && !_response->_keepsAlive()))
+    return;
+  char *pipelined = NULL;
+  if(_pipelinedLength + len <= ASYNCWEBSERVER_MAX_PIPELINED)
+    pipelined = (char*)realloc(_pipelined, _pipelinedLength + len);
+  if(pipelined == NULL){
+    free(_pipelined);
+    _pipelined = NULL;
+    _pipelinedLength = 0;
+    _keepAlive = false;
+    return;
+  }
+  memcpy(pipelined + _pipelinedLength, data, len);
+  _pipelined = pipelined;
+  _pipelinedLength += len;
+}
+
+bool AsyncWebServerRequest::_carryLine(const char *data, size_t len){
+  if(_lineLength + len > ASYNCWEBSERVER_MAX_LINE)
+    return false;
+  if(!_line){
+    _line = (char*)AsyncWebArena::allocate(&_arena, ASYNCWEBSERVER_MAX_LINE);
+    if(!_line)
+      return false;
   }
+  memcpy(_line + _lineLength, data, len);
+  _lineLength += len;
+  return true;
+}
+
+void AsyncWebServerRequest::_failHead(){
+  int code = (_parseState == PARSE_REQ_START) ? 414 : 431;
+  _parseState = PARSE_REQ_FAIL;
+  send(code);
 }
 
 void AsyncWebServerRequest::_removeNotInterestingHeaders(){
   if (_interestingHeaders.containsIgnoreCase("ANY")) return; // nothing to do
-  for(const auto& header: _headers){
-      if(!_interestingHeaders.containsIgnoreCase(header->name().c_str())){
-        _headers.remove(header);
+  // Indexed again from the kept headers, so a known header still finds its first kept copy
+  memset(_knownHeaders, 0, sizeof(_knownHeaders));
+  RawHeader **link = &_rawHeaders;
+  while(RawHeader *raw = *link){
+    bool interesting = raw->id != HDR_UNKNOWN && (_interestingIds & ((uint32_t)1 << raw->id));
+    for(const auto& name: _interestingHeaders){
+      if(interesting || (raw->nameLen == name.length() && !strncasecmp(raw->name(), name.c_str(), raw->nameLen))){
+        interesting = true;
+        break;
       }
+    }
+    if(interesting){
+      if(raw->id != HDR_UNKNOWN && !_knownHeaders[raw->id])
+        _knownHeaders[raw->id] = raw;
+      link = &raw->next;
+      continue;
+    }
+    *link = raw->next;
+    delete raw->header;
+    AsyncWebArena::release(raw);
+    _headerCount--;
   }
+  _rawHeadersTail = link;
 }
 
 void AsyncWebServerRequest::_onPoll(){
   //os_printf("p\n");
+  if(_preparedLeft && _client != NULL && _client->canSend()){
+    _sendPrepared();
+  }
   if(_response != NULL && _client != NULL && _client->canSend() && !_response->_finished()){
-    _response->_ack(this, 0, 0);
+    _ackResponse(0, 0);
   }
 }
 
 void AsyncWebServerRequest::_onAck(size_t len, uint32_t time){
   //os_printf("a:%u:%u\n", len, time);
+  if(_preparedLeft){
+    _sendPrepared();
+  }
   if(_response != NULL){
     if(!_response->_finished()){
-      _response->_ack(this, len, time);
+      _ackResponse(len, time);
     } else {
       AsyncWebServerResponse* r = _response;
       _response = NULL;
@@ -207,6 +307,115 @@ void AsyncWebServerRequest::_onAck(size_t len, uint32_t time){
   }
 }
 
+// A response that keeps the connection open never closes it or hands it over from _ack, so this
+// request is still here once it's done to go on to the next one
+void AsyncWebServerRequest::_ackResponse(size_t len, uint32_t time){
+  bool keepAlive = _response->_keepsAlive();
+  _response->_ack(this, len, time);
+  if(keepAlive && _response->_finished())
+    _next();
+}
+
+bool AsyncWebServerRequest::_canKeepAlive() const {
+  uint16_t max = _server->keepAliveMax();
+  return _keepAlive && _parseState == PARSE_REQ_END && _server->keepAliveTimeout()
+    && (!max || _served + 1 < max);
+}
+
+// Whether the handler wants a body of `length` bytes (or of unknown length, if not sized)
+// compressed & the client can take it, & if so in which format
+bool AsyncWebServerRequest::_compression(bool sized, size_t length, AsyncWebDeflate::Format &format) const {
+  if(_handler == NULL || !_encodings)
+    return false;
+  size_t threshold = _handler->compressThreshold();
+  if(threshold == (size_t)-1 || (sized && length < threshold))
+    return false;
+  format = (_encodings & ENCODING_GZIP) ? AsyncWebDeflate::GZIP : AsyncWebDeflate::ZLIB;
+  return true;
+}
+
+// Starts over on the same connection with the next request, pipelined or still to come
+void AsyncWebServerRequest::_next(){
+  if(!_keepAlive){ // the pipelined requests didn't fit, so the client has to send them again
+    _client->close();
+    return;
+  }
+  _served++;
+  _reset();
+  _client->setRxTimeout(_server->keepAliveTimeout());
+  if(_pipelinedLength){
+    char *pipelined = _pipelined;
+    size_t len = _pipelinedLength;
+    _pipelined = NULL;
+    _pipelinedLength = 0;
+    _onData(pipelined, len);
+    free(pipelined);
+  }
+}
+
+// Puts everything back as the constructor left it except the connection & what's counted over it.
+// Everything the request placed in its arena is released here, so the arena rewinds to empty.
+void AsyncWebServerRequest::_reset(){
+  // The request is over even though the connection isn't
+  if(_onDisconnectfn){
+    _onDisconnectfn();
+    _onDisconnectfn = nullptr;
+  }
+  delete _response;
+  _response = NULL;
+  _handler = NULL;
+  _preparedData = NULL;
+  _preparedLeft = 0;
+  _interestingHeaders.clear();
+  _interestingIds = 0;
+
+  _temp = String();
+  AsyncWebArena::release(_line);
+  _line = NULL;
+  _lineLength = 0;
+  _parseState = PARSE_REQ_START;
+  _keepAlive = false;
+  _encodings = 0;
+
+  _version = 0;
+  _method = HTTP_ANY;
+  _url = String();
+  _host = String();
+  _contentType = String();
+  _boundary = String();
+  _authorization = String();
+  _reqconntype = RCT_HTTP;
+  _isDigest = false;
+  _isMultipart = false;
+  _isPlainPost = false;
+  _expectingContinue = false;
+  _contentLength = 0;
+  _parsedLength = 0;
+
+  _freeHeaders();
+  _params.clear();
+  _pathParams.clear();
+
+  _multiParseState = 0;
+  _boundaryPosition = 0;
+  _itemStartIndex = 0;
+  _itemSize = 0;
+  _itemName = String();
+  _itemFilename = String();
+  _itemType = String();
+  _itemValue = String();
+  free(_itemBuffer);
+  _itemBuffer = NULL;
+  _itemBufferIndex = 0;
+  _itemIsFile = false;
+
+  free(_tempObject);
+  _tempObject = NULL;
+  if(_tempFile){
+    _tempFile.close();
+  }
+}
+
 void AsyncWebServerRequest::_onError(int8_t error){
   (void)error;
 }
@@ -230,124 +439,328 @@ void AsyncWebServerRequest::_onDisconnect(){
 }
 
 void AsyncWebServerRequest::_addParam(AsyncWebParameter *p){
-  _params.add(p);
+  if(p && !_params.add(p))
+    delete p;
 }
 
 void AsyncWebServerRequest::_addPathParam(const char *p){
-  _pathParams.add(new String(p));
+  String *param = AsyncWebArena::create<String>(&_arena, p);
+  if(param && !_pathParams.add(param))
+    AsyncWebArena::destroy(param);
 }
 
 void AsyncWebServerRequest::_addGetParams(const String& params){
-  size_t start = 0;
-  while (start < params.length()){
-    int end = params.indexOf('&', start);
-    if (end < 0) end = params.length();
-    int equal = params.indexOf('=', start);
-    if (equal < 0 || equal > end) equal = end;
-    String name = params.substring(start, equal);
-    String value = equal + 1 < end ? params.substring(equal + 1, end) : String();
-    _addParam(new AsyncWebParameter(urlDecode(name), urlDecode(value)));
-    start = end + 1;
+  _addGetParams(params.c_str(), params.length());
+}
+
+void AsyncWebServerRequest::_addGetParams(const char *params, size_t len){
+  const char *end = params + len;
+  while (params < end){
+    const char *amp = (const char*)memchr(params, '&', end - params);
+    if (!amp) amp = end;
+    const char *equal = (const char*)memchr(params, '=', amp - params);
+    const char *value = equal ? equal + 1 : amp;
+    if (!equal) equal = amp;
+    _addParam(new (&_arena) AsyncWebParameter(_urlDecode(params, equal - params), _urlDecode(value, amp - value)));
+    params = amp + 1;
+  }
+}
+
+// Case-insensitive comparisons of a (pointer, length) view against a literal
+static bool viewEquals(const char *view, size_t len, const char *literal){
+  return strlen(literal) == len && !strncasecmp(view, literal, len);
+}
+
+static bool viewStartsWith(const char *view, size_t len, const char *literal){
+  size_t n = strlen(literal);
+  return len >= n && !strncasecmp(view, literal, n);
+}
+
+static bool viewContains(const char *view, size_t len, const char *literal){
+  size_t n = strlen(literal);
+  for (size_t pos = 0; pos + n <= len; pos++){
+    if (!strncasecmp(view + pos, literal, n)) return true;
+  }
+  return false;
+}
+
+static void trimView(const char *&view, size_t &len){
+  while(len && (*view == ' ' || *view == '\t')){
+    view++;
+    len--;
+  }
+  while(len && (view[len - 1] == ' ' || view[len - 1] == '\t'))
+    len--;
+}
+
+// A q value of 0 ("0", "0.0", ...) means the coding is refused
+static bool qIsZero(const char *params, size_t len){
+  while(len){
+    const char *semicolon = (const char*)memchr(params, ';', len);
+    size_t paramLen = semicolon ? semicolon - params : len;
+    const char *param = params;
+    trimView(param, paramLen);
+    if(paramLen >= 2 && (param[0] == 'q' || param[0] == 'Q') && param[1] == '='){
+      for(size_t i = 2; i < paramLen; i++){
+        if(param[i] != '0' && param[i] != '.')
+          return false;
+      }
+      return true;
+    }
+    if(!semicolon)
+      break;
+    len -= paramLen + 1;
+    params = semicolon + 1;
   }
+  return false;
 }
 
-bool AsyncWebServerRequest::_parseReqHead(){
+// ENCODING_ bits for the codings an Accept-Encoding list accepts: each entry is matched as a whole
+// token, q=0 refuses it, and * covers whatever isn't named
+static uint8_t acceptedEncodings(const char *list, size_t len){
+  uint8_t accepted = 0, named = 0;
+  bool any = false;
+  while(len){
+    const char *comma = (const char*)memchr(list, ',', len);
+    size_t entryLen = comma ? comma - list : len;
+    const char *entry = list;
+    const char *semicolon = (const char*)memchr(entry, ';', entryLen);
+    size_t tokenLen = semicolon ? semicolon - entry : entryLen;
+    const char *token = entry;
+    trimView(token, tokenLen);
+    bool refused = semicolon && qIsZero(semicolon + 1, entry + entryLen - semicolon - 1);
+
+    uint8_t coding = 0;
+    if(viewEquals(token, tokenLen, "gzip") || viewEquals(token, tokenLen, "x-gzip"))
+      coding = ENCODING_GZIP;
+    else if(viewEquals(token, tokenLen, "deflate"))
+      coding = ENCODING_DEFLATE;
+    else if(viewEquals(token, tokenLen, "*"))
+      any = !refused;
+    named |= coding;
+    if(!refused)
+      accepted |= coding;
+
+    if(!comma)
+      break;
+    len -= entryLen + 1;
+    list = comma + 1;
+  }
+  if(any)
+    accepted |= (ENCODING_GZIP | ENCODING_DEFLATE) & ~named;
+  return accepted;
+}
+
+bool AsyncWebServerRequest::_parseReqHead(const char *line, size_t len){
+  static const struct { const char *name; WebRequestMethod method; } methods[] = {
+    { "GET", HTTP_GET }, { "POST", HTTP_POST }, { "DELETE", HTTP_DELETE }, { "PUT", HTTP_PUT },
+    { "PATCH", HTTP_PATCH }, { "HEAD", HTTP_HEAD }, { "OPTIONS", HTTP_OPTIONS }
+  };
+
   // Split the head into method, url and version
-  int index = _temp.indexOf(' ');
-  String m = _temp.substring(0, index);
-  index = _temp.indexOf(' ', index+1);
-  String u = _temp.substring(m.length()+1, index);
-  _temp = _temp.substring(index+1);
-
-  if(m == "GET"){
-    _method = HTTP_GET;
-  } else if(m == "POST"){
-    _method = HTTP_POST;
-  } else if(m == "DELETE"){
-    _method = HTTP_DELETE;
-  } else if(m == "PUT"){
-    _method = HTTP_PUT;
-  } else if(m == "PATCH"){
-    _method = HTTP_PATCH;
-  } else if(m == "HEAD"){
-    _method = HTTP_HEAD;
-  } else if(m == "OPTIONS"){
-    _method = HTTP_OPTIONS;
-  }
-
-  String g = String();
-  index = u.indexOf('?');
-  if(index > 0){
-    g = u.substring(index +1);
-    u = u.substring(0, index);
-  }
-  _url = urlDecode(u);
-  _addGetParams(g);
-
-  if(!_temp.startsWith("HTTP/1.0"))
+  const char *end = line + len;
+  const char *m = line;
+  const char *u = (const char*)memchr(line, ' ', len);
+  if (!u) u = end;
+  size_t mLen = u - m;
+  if (u < end) u++;
+  const char *v = (const char*)memchr(u, ' ', end - u);
+  if (!v) v = end;
+  size_t uLen = v - u;
+  if (v < end) v++;
+
+  for (const auto& entry: methods){
+    if (strlen(entry.name) == mLen && !memcmp(m, entry.name, mLen)){
+      _method = entry.method;
+      break;
+    }
+  }
+
+  const char *query = (const char*)memchr(u, '?', uLen);
+  if (query > u){
+    _url = _urlDecode(u, query - u);
+    _addGetParams(query + 1, u + uLen - query - 1);
+  } else {
+    _url = _urlDecode(u, uLen);
+  }
+
+  if (end - v < 8 || memcmp(v, "HTTP/1.0", 8))
     _version = 1;
+  _keepAlive = _version == 1;
 
-  _temp = String();
   return true;
 }
 
-bool strContains(String src, String find, bool mindcase = true) {
-  int pos=0, i=0;
-  const int slen = src.length();
-  const int flen = find.length();
+// Indexed by WebHeaderId
+static const char * const knownHeaders[] = {
+  "Host", "Content-Type", "Content-Length", "Expect", "Authorization", "Upgrade",
+  "Accept", "Accept-Encoding", "Connection", "Origin", "Last-Event-ID",
+  "If-Modified-Since", "If-None-Match", "Sec-WebSocket-Key", "Sec-WebSocket-Version", "Sec-WebSocket-Protocol"
+};
+static_assert(sizeof(knownHeaders) / sizeof(knownHeaders[0]) == HDR_KNOWN, "knownHeaders must match WebHeaderId");
+static_assert(HDR_KNOWN <= 32, "_interestingIds needs a bit per WebHeaderId");
+
+// Length and first letter pick at most one candidate from knownHeaders, so a header name costs one
+// switch and one comparison whether or not it's known.
+uint8_t AsyncWebServerRequest::_headerId(const char *name, size_t len){
+  uint8_t id;
+  switch(len){
+    case 4:  id = HDR_HOST; break;
+    case 6:
+      switch(tolower(name[0])){
+        case 'a': id = HDR_ACCEPT; break;
+        case 'e': id = HDR_EXPECT; break;
+        case 'o': id = HDR_ORIGIN; break;
+        default:  return HDR_UNKNOWN;
+      }
+      break;
+    case 7:  id = HDR_UPGRADE; break;
+    case 10: id = HDR_CONNECTION; break;
+    case 12: id = HDR_CONTENT_TYPE; break;
+    case 13:
+      switch(tolower(name[0])){
+        case 'a': id = HDR_AUTHORIZATION; break;
+        case 'i': id = HDR_IF_NONE_MATCH; break;
+        case 'l': id = HDR_LAST_EVENT_ID; break;
+        default:  return HDR_UNKNOWN;
+      }
+      break;
+    case 14: id = HDR_CONTENT_LENGTH; break;
+    case 15: id = HDR_ACCEPT_ENCODING; break;
+    case 17:
+      switch(tolower(name[0])){
+        case 'i': id = HDR_IF_MODIFIED_SINCE; break;
+        case 's': id = HDR_WS_KEY; break;
+        default:  return HDR_UNKNOWN;
+      }
+      break;
+    case 21: id = HDR_WS_VERSION; break;
+    case 22: id = HDR_WS_PROTOCOL; break;
+    default: return HDR_UNKNOWN;
+  }
+  return strncasecmp(name, knownHeaders[id], len) ? HDR_UNKNOWN : id;
+}
 
-  if (slen < flen) return false;
-  while (pos <= (slen - flen)) {
-    for (i=0; i < flen; i++) {
-      if (mindcase) {
-        if (src[pos+i] != find[i]) i = flen + 1; // no match
-      } else if (tolower(src[pos+i]) != tolower(find[i])) i = flen + 1; // no match
-    }
-    if (i == flen) return true;
-    pos++;
+void AsyncWebServerRequest::_addHeader(uint8_t id, const char *name, size_t nameLen, const char *value, size_t valueLen){
+  RawHeader *raw = (RawHeader*)AsyncWebArena::allocate(&_arena, sizeof(RawHeader) + nameLen + valueLen);
+  if(!raw)
+    return;
+  raw->next = NULL;
+  raw->header = NULL;
+  raw->nameLen = nameLen;
+  raw->valueLen = valueLen;
+  raw->id = id;
+  memcpy((char*)raw->name(), name, nameLen);
+  memcpy((char*)raw->value(), value, valueLen);
+
+  *_rawHeadersTail = raw;
+  _rawHeadersTail = &raw->next;
+  _headerCount++;
+  if(id != HDR_UNKNOWN && !_knownHeaders[id])
+    _knownHeaders[id] = raw;
+}
+
+AsyncWebServerRequest::RawHeader *AsyncWebServerRequest::_findHeader(const char *name, size_t len) const {
+  uint8_t id = _headerId(name, len);
+  if(id != HDR_UNKNOWN)
+    return _knownHeaders[id];
+  for(RawHeader *raw = _rawHeaders; raw; raw = raw->next){
+    if(raw->id == HDR_UNKNOWN && raw->nameLen == len && !strncasecmp(raw->name(), name, len))
+      return raw;
   }
-  return false;
+  return NULL;
 }
 
-bool AsyncWebServerRequest::_parseReqHeader(){
-  int index = _temp.indexOf(':');
-  if(index){
-    String name = _temp.substring(0, index);
-    String value = _temp.substring(index + 2);
-    if(name.equalsIgnoreCase("Host")){
-      _host = value;
-    } else if(name.equalsIgnoreCase("Content-Type")){
-	  _contentType = value.substring(0, value.indexOf(';'));
-      if (value.startsWith("multipart/")){
-        _boundary = value.substring(value.indexOf('=')+1);
+AsyncWebHeader *AsyncWebServerRequest::_headerObject(RawHeader *raw) const {
+  if(raw && !raw->header)
+    raw->header = new (&_arena) AsyncWebHeader(raw->name(), raw->nameLen, raw->value(), raw->valueLen);
+  return raw ? raw->header : NULL;
+}
+
+void AsyncWebServerRequest::_freeHeaders(){
+  while(_rawHeaders){
+    RawHeader *raw = _rawHeaders;
+    _rawHeaders = raw->next;
+    delete raw->header;
+    AsyncWebArena::release(raw);
+  }
+  _rawHeadersTail = &_rawHeaders;
+  memset(_knownHeaders, 0, sizeof(_knownHeaders));
+  _headerCount = 0;
+}
+
+bool AsyncWebServerRequest::_parseReqHeader(const char *line, size_t len){
+  const char *colon = (const char*)memchr(line, ':', len);
+  if(!colon || colon == line)
+    return true;
+
+  const char *name = line;
+  size_t nameLen = colon - line;
+  const char *value = colon + 1;
+  size_t valueLen = line + len - value;
+  while(valueLen && (*value == ' ' || *value == '\t')){
+    value++;
+    valueLen--;
+  }
+
+  uint8_t id = _headerId(name, nameLen);
+  switch(id){
+    case HDR_HOST:
+      _host = AsyncWebHeader::viewToString(value, valueLen);
+      break;
+    case HDR_CONTENT_TYPE: {
+      const char *semicolon = (const char*)memchr(value, ';', valueLen);
+      _contentType = AsyncWebHeader::viewToString(value, semicolon ? semicolon - value : valueLen);
+      if (valueLen >= 10 && !memcmp(value, "multipart/", 10)){
+        const char *equal = (const char*)memchr(value, '=', valueLen);
+        const char *b = equal ? equal + 1 : value;
+        _boundary = AsyncWebHeader::viewToString(b, value + valueLen - b);
         _boundary.replace("\"","");
         _isMultipart = true;
       }
-    } else if(name.equalsIgnoreCase("Content-Length")){
-      _contentLength = atoi(value.c_str());
-    } else if(name.equalsIgnoreCase("Expect") && value == "100-continue"){
-      _expectingContinue = true;
-    } else if(name.equalsIgnoreCase("Authorization")){
-      if(value.length() > 5 && value.substring(0,5).equalsIgnoreCase("Basic")){
-        _authorization = value.substring(6);
-      } else if(value.length() > 6 && value.substring(0,6).equalsIgnoreCase("Digest")){
+      break;
+    }
+    case HDR_CONTENT_LENGTH: {
+      size_t length = 0;
+      for(size_t i = 0; i < valueLen && isdigit(value[i]); i++)
+        length = length * 10 + (value[i] - '0');
+      _contentLength = length;
+      break;
+    }
+    case HDR_EXPECT:
+      if(valueLen == 12 && !memcmp(value, "100-continue", 12))
+        _expectingContinue = true;
+      break;
+    case HDR_AUTHORIZATION:
+      if(valueLen > 5 && viewStartsWith(value, valueLen, "Basic")){
+        _authorization = AsyncWebHeader::viewToString(value + 6, valueLen - 6);
+      } else if(valueLen > 6 && viewStartsWith(value, valueLen, "Digest")){
         _isDigest = true;
-        _authorization = value.substring(7);
+        _authorization = AsyncWebHeader::viewToString(value + 7, valueLen - 7);
       }
-    } else {
-      if(name.equalsIgnoreCase("Upgrade") && value.equalsIgnoreCase("websocket")){
-        // WebSocket request can be uniquely identified by header: [Upgrade: websocket]
+      break;
+    case HDR_ACCEPT_ENCODING:
+      _encodings |= acceptedEncodings(value, valueLen);
+      break;
+    case HDR_CONNECTION:
+      // HTTP/1.1 connections persist unless the client says close, HTTP/1.0 ones only if it asks
+      if(viewContains(value, valueLen, "close"))
+        _keepAlive = false;
+      else if(viewContains(value, valueLen, "keep-alive"))
+        _keepAlive = true;
+      break;
+    case HDR_UPGRADE:
+      // WebSocket request can be uniquely identified by header: [Upgrade: websocket]
+      if(viewEquals(value, valueLen, "websocket"))
         _reqconntype = RCT_WS;
-      } else {
-        if(name.equalsIgnoreCase("Accept") && strContains(value, "text/event-stream", false)){
-          // WebEvent request can be uniquely identified by header:  [Accept: text/event-stream]
-          _reqconntype = RCT_EVENT;
-        }
-      }
-    }
-    _headers.add(new AsyncWebHeader(name, value));
+      break;
+    case HDR_ACCEPT:
+      // WebEvent request can be uniquely identified by header:  [Accept: text/event-stream]
+      if(viewContains(value, valueLen, "text/event-stream"))
+        _reqconntype = RCT_EVENT;
+      break;
   }
-  _temp = String();
+  _addHeader(id, name, nameLen, value, valueLen);
   return true;
 }
 
@@ -361,7 +774,7 @@ void AsyncWebServerRequest::_parsePlainPostChar(uint8_t data){
       name = _temp.substring(0, _temp.indexOf('='));
       value = _temp.substring(_temp.indexOf('=') + 1);
     }
-    _addParam(new AsyncWebParameter(urlDecode(name), urlDecode(value), true));
+    _addParam(new (&_arena) AsyncWebParameter(urlDecode(name), urlDecode(value), true));
     _temp = String();
   }
 }
@@ -508,13 +921,13 @@ void AsyncWebServerRequest::_parseMultipartPostByte(uint8_t data, bool last){
     } else if(_boundaryPosition == _boundary.length() - 1){
       _multiParseState = DASH3_OR_RETURN2;
       if(!_itemIsFile){
-        _addParam(new AsyncWebParameter(_itemName, _itemValue, true));
+        _addParam(new (&_arena) AsyncWebParameter(_itemName, _itemValue, true));
       } else {
         if(_itemSize){
           //check if authenticated before calling the upload
           if(_handler) _handler->handleUpload(this, _itemFilename, _itemSize - _itemBufferIndex, _itemBuffer, _itemBufferIndex, true);
           _itemBufferIndex = 0;
-          _addParam(new AsyncWebParameter(_itemName, _itemFilename, true, true, _itemSize));
+          _addParam(new (&_arena) AsyncWebParameter(_itemName, _itemFilename, true, true, _itemSize));
         }
         free(_itemBuffer);
         _itemBuffer = NULL;
@@ -551,21 +964,37 @@ void AsyncWebServerRequest::_parseMultipartPostByte(uint8_t data, bool last){
   }
 }
 
-void AsyncWebServerRequest::_parseLine(){
+// Every head line is held to ASYNCWEBSERVER_MAX_LINE, whether it was parsed in place or carried
+void AsyncWebServerRequest::_parseLine(const char *line, size_t len){
+  if(len > ASYNCWEBSERVER_MAX_LINE){
+    _failHead();
+    return;
+  }
+  while(len && isspace(*line)){
+    line++;
+    len--;
+  }
+  while(len && isspace(line[len - 1]))
+    len--;
+
   if(_parseState == PARSE_REQ_START){
-    if(!_temp.length()){
+    if(!len && _served) // a stray CRLF after the last request on a kept-alive connection
+      return;
+    if(!len){
       _parseState = PARSE_REQ_FAIL;
       _client->close();
     } else {
-      _parseReqHead();
+      _parseReqHead(line, len);
       _parseState = PARSE_REQ_HEADERS;
     }
     return;
   }
 
   if(_parseState == PARSE_REQ_HEADERS){
-    if(!_temp.length()){
+    if(!len){
       //end of headers
+      AsyncWebArena::release(_line);
+      _line = NULL;
       _server->_rewriteRequest(this);
       _server->_attachHandler(this);
       _removeNotInterestingHeaders();
@@ -574,28 +1003,17 @@ void AsyncWebServerRequest::_parseLine(){
         _client->write(response, os_strlen(response));
       }
       //check handler for authentication
-      if(_contentLength){
-        _parseState = PARSE_REQ_BODY;
-      } else {
-        _parseState = PARSE_REQ_END;
-        if(_handler) _handler->handleRequest(this);
-        else send(501);
-      }
-    } else _parseReqHeader();
+      _parseState = _contentLength ? PARSE_REQ_BODY : PARSE_REQ_END;
+    } else _parseReqHeader(line, len);
   }
 }
 
 size_t AsyncWebServerRequest::headers() const{
-  return _headers.length();
+  return _headerCount;
 }
 
 bool AsyncWebServerRequest::hasHeader(const String& name) const {
-  for(const auto& h: _headers){
-    if(h->name().equalsIgnoreCase(name)){
-      return true;
-    }
-  }
-  return false;
+  return _findHeader(name.c_str(), name.length()) != NULL;
 }
 
 bool AsyncWebServerRequest::hasHeader(const __FlashStringHelper * data) const {
@@ -619,12 +1037,7 @@ bool AsyncWebServerRequest::hasHeader(const __FlashStringHelper * data) const {
 }
 
 AsyncWebHeader* AsyncWebServerRequest::getHeader(const String& name) const {
-  for(const auto& h: _headers){
-    if(h->name().equalsIgnoreCase(name)){
-      return h;
-    }
-  }
-  return nullptr;
+  return _headerObject(_findHeader(name.c_str(), name.length()));
 }
 
 AsyncWebHeader* AsyncWebServerRequest::getHeader(const __FlashStringHelper * data) const {
@@ -641,9 +1054,17 @@ AsyncWebHeader* AsyncWebServerRequest::getHeader(const __FlashStringHelper * dat
   }
 }
 
+const char *AsyncWebServerRequest::header(WebHeaderId id, size_t &len) const {
+  RawHeader *raw = (id < HDR_KNOWN) ? _knownHeaders[id] : NULL;
+  len = raw ? raw->valueLen : 0;
+  return raw ? raw->value() : NULL;
+}
+
 AsyncWebHeader* AsyncWebServerRequest::getHeader(size_t num) const {
-  auto header = _headers.nth(num);
-  return header ? *header : nullptr;
+  RawHeader *raw = _rawHeaders;
+  while(raw && num--)
+    raw = raw->next;
+  return _headerObject(raw);
 }
 
 size_t AsyncWebServerRequest::params() const {
@@ -708,6 +1129,11 @@ void AsyncWebServerRequest::addInterestingHeader(const String& name){
     _interestingHeaders.add(name);
 }
 
+void AsyncWebServerRequest::addInterestingHeader(WebHeaderId id){
+  if(id < HDR_KNOWN)
+    _interestingIds |= (uint32_t)1 << id;
+}
+
 void AsyncWebServerRequest::send(AsyncWebServerResponse *response){
   _response = response;
   if(_response == NULL){
@@ -726,48 +1152,72 @@ void AsyncWebServerRequest::send(AsyncWebServerResponse *response){
   }
 }
 
+void AsyncWebServerRequest::send(const AsyncPreparedResponse& response){
+  const String& bytes = response._bytesFor(_version);
+  _keepAlive = false; // its bytes say Connection: close
+  _client->setRxTimeout(0);
+  _preparedData = bytes.c_str();
+  _preparedLeft = bytes.length();
+  _sendPrepared();
+}
+
+void AsyncWebServerRequest::_sendPrepared(){
+  size_t len = _client->space();
+  if(len > _preparedLeft)
+    len = _preparedLeft;
+  if(!len)
+    return;
+  len = _client->write(_preparedData, len);
+  _preparedData += len;
+  _preparedLeft -= len;
+}
+
 AsyncWebServerResponse * AsyncWebServerRequest::beginResponse(int code, const String& contentType, const String& content){
-  return new AsyncBasicResponse(code, contentType, content);
+  return new (&_arena) AsyncBasicResponse(code, contentType, content, &_arena);
 }
 
 AsyncWebServerResponse * AsyncWebServerRequest::beginResponse(FS &fs, const String& path, const String& contentType, bool download, AwsTemplateProcessor callback){
   if(fs.exists(path) || (!download && fs.exists(path+".gz")))
-    return new AsyncFileResponse(fs, path, contentType, download, callback);
+    return new (&_arena) AsyncFileResponse(fs, path, contentType, download, callback, &_arena);
   return NULL;
 }
 
 AsyncWebServerResponse * AsyncWebServerRequest::beginResponse(File content, const String& path, const String& contentType, bool download, AwsTemplateProcessor callback){
   if(content == true)
-    return new AsyncFileResponse(content, path, contentType, download, callback);
+    return new (&_arena) AsyncFileResponse(content, path, contentType, download, callback, &_arena);
   return NULL;
 }
 
 AsyncWebServerResponse * AsyncWebServerRequest::beginResponse(Stream &stream, const String& contentType, size_t len, AwsTemplateProcessor callback){
-  return new AsyncStreamResponse(stream, contentType, len, callback);
+  return new (&_arena) AsyncStreamResponse(stream, contentType, len, callback, &_arena);
 }
 
 AsyncWebServerResponse * AsyncWebServerRequest::beginResponse(const String& contentType, size_t len, AwsResponseFiller callback, AwsTemplateProcessor templateCallback){
-  return new AsyncCallbackResponse(contentType, len, callback, templateCallback);
+  return new (&_arena) AsyncCallbackResponse(contentType, len, callback, templateCallback, &_arena);
 }
 
 AsyncWebServerResponse * AsyncWebServerRequest::beginChunkedResponse(const String& contentType, AwsResponseFiller callback, AwsTemplateProcessor templateCallback){
   if(_version)
-    return new AsyncChunkedResponse(contentType, callback, templateCallback);
-  return new AsyncCallbackResponse(contentType, 0, callback, templateCallback);
+    return new (&_arena) AsyncChunkedResponse(contentType, callback, templateCallback, &_arena);
+  return new (&_arena) AsyncCallbackResponse(contentType, 0, callback, templateCallback, &_arena);
 }
 
 AsyncResponseStream * AsyncWebServerRequest::beginResponseStream(const String& contentType, size_t bufferSize){
-  return new AsyncResponseStream(contentType, bufferSize);
+  return new (&_arena) AsyncResponseStream(contentType, bufferSize, &_arena);
 }
 
 AsyncWebServerResponse * AsyncWebServerRequest::beginResponse_P(int code, const String& contentType, const uint8_t * content, size_t len, AwsTemplateProcessor callback){
-  return new AsyncProgmemResponse(code, contentType, content, len, callback);
+  return new (&_arena) AsyncProgmemResponse(code, contentType, content, len, callback, &_arena);
 }
 
 AsyncWebServerResponse * AsyncWebServerRequest::beginResponse_P(int code, const String& contentType, PGM_P content, AwsTemplateProcessor callback){
   return beginResponse_P(code, contentType, (const uint8_t *)content, strlen_P(content), callback);
 }
 
+AsyncWebServerResponse * AsyncWebServerRequest::beginResponse(int code, const String& contentType, const AsyncWebTemplate& tpl, AwsTemplateFiller filler){
+  return new (&_arena) AsyncTemplateResponse(code, contentType, tpl, filler, &_arena);
+}
+
 void AsyncWebServerRequest::send(int code, const String& contentType, const String& content){
   send(beginResponse(code, contentType, content));
 }
@@ -804,6 +1254,10 @@ void AsyncWebServerRequest::send_P(int code, const String& contentType, PGM_P co
   send(beginResponse_P(code, contentType, content, callback));
 }
 
+void AsyncWebServerRequest::send(int code, const String& contentType, const AsyncWebTemplate& tpl, AwsTemplateFiller filler){
+  send(beginResponse(code, contentType, tpl, filler));
+}
+
 void AsyncWebServerRequest::redirect(const String& url){
   AsyncWebServerResponse * response = beginResponse(302);
   response->addHeader("Location",url);
@@ -923,7 +1377,7 @@ const String& AsyncWebServerRequest::pathArg(size_t i) const {
 }
 
 const String& AsyncWebServerRequest::header(const char* name) const {
-  AsyncWebHeader* h = getHeader(String(name));
+  AsyncWebHeader* h = _headerObject(_findHeader(name, strlen(name)));
   return h ? h->value() : SharedEmptyString;
 }
 
@@ -953,17 +1407,20 @@ const String& AsyncWebServerRequest::headerName(size_t i) const {
 }
 
 String AsyncWebServerRequest::urlDecode(const String& text) const {
+  return _urlDecode(text.c_str(), text.length());
+}
+
+String AsyncWebServerRequest::_urlDecode(const char *text, size_t len) const {
   char temp[] = "0x00";
-  unsigned int len = text.length();
-  unsigned int i = 0;
+  size_t i = 0;
   String decoded = String();
   decoded.reserve(len); // Allocate the string internal buffer - never longer from source text
   while (i < len){
     char decodedChar;
-    char encodedChar = text.charAt(i++);
+    char encodedChar = text[i++];
     if ((encodedChar == '%') && (i + 1 < len)){
-      temp[2] = text.charAt(i++);
-      temp[3] = text.charAt(i++);
+      temp[2] = text[i++];
+      temp[3] = text[i++];
       decodedChar = strtol(temp, NULL, 16);
     } else if (encodedChar == '+') {
       decodedChar = ' ';
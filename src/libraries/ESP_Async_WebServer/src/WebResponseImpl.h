@@ -33,7 +33,7 @@ class AsyncBasicResponse: public AsyncWebServerResponse {
   private:
     String _content;
   public:
-    AsyncBasicResponse(int code, const String& contentType=String(), const String& content=String());
+    AsyncBasicResponse(int code, const String& contentType=String(), const String& content=String(), AsyncWebArena *arena=NULL);
     void _respond(AsyncWebServerRequest *request);
     size_t _ack(AsyncWebServerRequest *request, size_t len, uint32_t time);
     bool _sourceValid() const { return true; }
@@ -41,7 +41,6 @@ class AsyncBasicResponse: public AsyncWebServerResponse {
 
 class AsyncAbstractResponse: public AsyncWebServerResponse {
   private:
-    String _head;
     // Data is inserted into cache at begin(). 
     // This is inefficient with vector, but if we use some other container, 
     // we won't be able to access it as contiguous array of bytes when reading from it,
@@ -49,10 +48,25 @@ class AsyncAbstractResponse: public AsyncWebServerResponse {
     std::vector<uint8_t> _cache;
     size_t _readDataFromCacheOrContent(uint8_t* data, const size_t len);
     size_t _fillBufferAndProcessTemplates(uint8_t* buf, size_t maxLen);
+    // The body is read ahead of the socket into one buffer kept for the whole response, already
+    // framed as it goes on the wire; lwIP copies out of it, so it's reused from the front
+    uint8_t *_buffer;
+    size_t _bufferSize;
+    size_t _bufferStart;  // first byte not yet handed to lwIP
+    size_t _bufferEnd;
+    bool _bodyDone;       // the whole body, as sent, is in the buffer
+    bool _sourceSized;    // the source's length is _contentLength, whether or not that's sent
+    bool _sourceDone;     // everything the source has is read
+    AsyncWebDeflate *_compressor;
+    void _startCompression(AsyncWebServerRequest *request);
+    bool _produce(size_t want);
+    size_t _readSource(uint8_t *buf, size_t maxLen);
+    size_t _compress(uint8_t *out, size_t maxLen);
   protected:
     AwsTemplateProcessor _callback;
   public:
-    AsyncAbstractResponse(AwsTemplateProcessor callback=nullptr);
+    AsyncAbstractResponse(AwsTemplateProcessor callback=nullptr, AsyncWebArena *arena=NULL);
+    ~AsyncAbstractResponse();
     void _respond(AsyncWebServerRequest *request);
     size_t _ack(AsyncWebServerRequest *request, size_t len, uint32_t time);
     bool _sourceValid() const { return false; }
@@ -72,8 +86,8 @@ class AsyncFileResponse: public AsyncAbstractResponse {
     String _path;
     void _setContentType(const String& path);
   public:
-    AsyncFileResponse(FS &fs, const String& path, const String& contentType=String(), bool download=false, AwsTemplateProcessor callback=nullptr);
-    AsyncFileResponse(File content, const String& path, const String& contentType=String(), bool download=false, AwsTemplateProcessor callback=nullptr);
+    AsyncFileResponse(FS &fs, const String& path, const String& contentType=String(), bool download=false, AwsTemplateProcessor callback=nullptr, AsyncWebArena *arena=NULL);
+    AsyncFileResponse(File content, const String& path, const String& contentType=String(), bool download=false, AwsTemplateProcessor callback=nullptr, AsyncWebArena *arena=NULL);
     ~AsyncFileResponse();
     bool _sourceValid() const { return !!(_content); }
     virtual size_t _fillBuffer(uint8_t *buf, size_t maxLen) override;
@@ -83,7 +97,7 @@ class AsyncStreamResponse: public AsyncAbstractResponse {
   private:
     Stream *_content;
   public:
-    AsyncStreamResponse(Stream &stream, const String& contentType, size_t len, AwsTemplateProcessor callback=nullptr);
+    AsyncStreamResponse(Stream &stream, const String& contentType, size_t len, AwsTemplateProcessor callback=nullptr, AsyncWebArena *arena=NULL);
     bool _sourceValid() const { return !!(_content); }
     virtual size_t _fillBuffer(uint8_t *buf, size_t maxLen) override;
 };
@@ -93,7 +107,7 @@ class AsyncCallbackResponse: public AsyncAbstractResponse {
     AwsResponseFiller _content;
     size_t _filledLength;
   public:
-    AsyncCallbackResponse(const String& contentType, size_t len, AwsResponseFiller callback, AwsTemplateProcessor templateCallback=nullptr);
+    AsyncCallbackResponse(const String& contentType, size_t len, AwsResponseFiller callback, AwsTemplateProcessor templateCallback=nullptr, AsyncWebArena *arena=NULL);
     bool _sourceValid() const { return !!(_content); }
     virtual size_t _fillBuffer(uint8_t *buf, size_t maxLen) override;
 };
@@ -103,7 +117,7 @@ class AsyncChunkedResponse: public AsyncAbstractResponse {
     AwsResponseFiller _content;
     size_t _filledLength;
   public:
-    AsyncChunkedResponse(const String& contentType, AwsResponseFiller callback, AwsTemplateProcessor templateCallback=nullptr);
+    AsyncChunkedResponse(const String& contentType, AwsResponseFiller callback, AwsTemplateProcessor templateCallback=nullptr, AsyncWebArena *arena=NULL);
     bool _sourceValid() const { return !!(_content); }
     virtual size_t _fillBuffer(uint8_t *buf, size_t maxLen) override;
 };
@@ -113,18 +127,33 @@ class AsyncProgmemResponse: public AsyncAbstractResponse {
     const uint8_t * _content;
     size_t _readLength;
   public:
-    AsyncProgmemResponse(int code, const String& contentType, const uint8_t * content, size_t len, AwsTemplateProcessor callback=nullptr);
+    AsyncProgmemResponse(int code, const String& contentType, const uint8_t * content, size_t len, AwsTemplateProcessor callback=nullptr, AsyncWebArena *arena=NULL);
     bool _sourceValid() const { return true; }
     virtual size_t _fillBuffer(uint8_t *buf, size_t maxLen) override;
 };
 
+// A compiled template with its variables' values taken once, when the response is created, so the
+// page is consistent & its length known up front
+class AsyncTemplateResponse: public AsyncAbstractResponse {
+  private:
+    const AsyncWebTemplate &_template;
+    uint8_t *_values;   // per variable: length byte then ASYNCWEBTEMPLATE_VALUE_LENGTH chars, in the response's arena
+    size_t _segment;    // where the next byte comes from
+    size_t _offset;
+  public:
+    AsyncTemplateResponse(int code, const String& contentType, const AsyncWebTemplate &tpl, AwsTemplateFiller filler, AsyncWebArena *arena=NULL);
+    ~AsyncTemplateResponse();
+    bool _sourceValid() const { return _template.valid() && (_values != NULL || !_template.variables()); }
+    virtual size_t _fillBuffer(uint8_t *buf, size_t maxLen) override;
+};
+
 class cbuf;
 
 class AsyncResponseStream: public AsyncAbstractResponse, public Print {
   private:
     cbuf *_content;
   public:
-    AsyncResponseStream(const String& contentType, size_t bufferSize);
+    AsyncResponseStream(const String& contentType, size_t bufferSize, AsyncWebArena *arena=NULL);
     ~AsyncResponseStream();
     bool _sourceValid() const { return (_state < RESPONSE_END); }
     virtual size_t _fillBuffer(uint8_t *buf, size_t maxLen) override;
@@ -21,6 +21,7 @@
 #include "ESPAsyncWebServer.h"
 #include "WebResponseImpl.h"
 #include "cbuf.h"
+#include <new>
 
 // Since ESP8266 does not link memchr by default, here's its implementation.
 void* memchr(void* ptr, int ch, size_t count)
@@ -72,6 +73,7 @@ const char* AsyncWebServerResponse::_responseCodeToString(int code) {
     case 415: return "Unsupported Media Type";
     case 416: return "Requested range not satisfiable";
     case 417: return "Expectation Failed";
+    case 431: return "Request Header Fields Too Large";
     case 500: return "Internal Server Error";
     case 501: return "Not Implemented";
     case 502: return "Bad Gateway";
@@ -82,25 +84,30 @@ const char* AsyncWebServerResponse::_responseCodeToString(int code) {
   }
 }
 
-AsyncWebServerResponse::AsyncWebServerResponse()
-  : _code(0)
-  , _headers(LinkedList<AsyncWebHeader *>([](AsyncWebHeader *h){ delete h; }))
+AsyncWebServerResponse::AsyncWebServerResponse(AsyncWebArena *arena)
+  : _arena(arena)
+  , _code(0)
+  , _headers([](AsyncWebHeader *h){ delete h; }, _arena)
   , _contentType()
   , _contentLength(0)
   , _sendContentLength(true)
   , _chunked(false)
+  , _head(NULL)
   , _headLength(0)
+  , _headSent(0)
   , _sentLength(0)
   , _ackedLength(0)
   , _writtenLength(0)
   , _state(RESPONSE_SETUP)
+  , _keepAlive(false)
 {
   for(auto header: DefaultHeaders::Instance()) {
-    _headers.add(new AsyncWebHeader(header->name(), header->value()));
+    addHeader(header->name(), header->value());
   }
 }
 
 AsyncWebServerResponse::~AsyncWebServerResponse(){
+  _freeHead();
   _headers.free();
 }
 
@@ -119,40 +126,112 @@ void AsyncWebServerResponse::setContentType(const String& type){
     _contentType = type;
 }
 
+// The connection is only kept if the client can tell where this body ends without it closing
+void AsyncWebServerResponse::_addConnectionHeader(AsyncWebServerRequest *request){
+  _keepAlive = (_sendContentLength || (_chunked && request->version())) && request->_canKeepAlive();
+  addHeader("Connection", _keepAlive ? "keep-alive" : "close");
+}
+
 void AsyncWebServerResponse::addHeader(const String& name, const String& value){
-  _headers.add(new AsyncWebHeader(name, value));
+  AsyncWebHeader *header = new (_arena) AsyncWebHeader(name, value);
+  if(header && !_headers.add(header))
+    delete header;
 }
 
-String AsyncWebServerResponse::_assembleHead(uint8_t version){
+static size_t decimalLength(size_t n){
+  size_t len = 1;
+  while(n >= 10){
+    n /= 10;
+    len++;
+  }
+  return len;
+}
+
+static char *appendDecimal(char *out, size_t n){
+  size_t len = decimalLength(n);
+  for(char *p = out + len; p != out; n /= 10)
+    *--p = '0' + n % 10;
+  return out + len;
+}
+
+static char *append(char *out, const char *str, size_t len){
+  memcpy(out, str, len);
+  return out + len;
+}
+
+static char *append(char *out, const String& str){
+  return append(out, str.c_str(), str.length());
+}
+
+// Serialises the status line & headers into one block from the response's arena, sized up front so
+// nothing is formatted twice or regrown
+bool AsyncWebServerResponse::_buildHead(uint8_t version){
   if(version){
     addHeader("Accept-Ranges","none");
     if(_chunked)
       addHeader("Transfer-Encoding","chunked");
   }
-  String out = String();
-  int bufSize = 300;
-  char buf[bufSize];
-
-  snprintf(buf, bufSize, "HTTP/1.%d %d %s\r\n", version, _code, _responseCodeToString(_code));
-  out.concat(buf);
+  const char *reason = _responseCodeToString(_code);
+  size_t reasonLen = strlen(reason);
+
+  size_t len = 9 + decimalLength(_code) + 1 + reasonLen + 2;
+  if(_sendContentLength)
+    len += 16 + decimalLength(_contentLength) + 2;
+  if(_contentType.length())
+    len += 14 + _contentType.length() + 2;
+  for(const auto& header: _headers)
+    len += header->name().length() + 2 + header->value().length() + 2;
+  len += 2;
+
+  _freeHead();
+  _head = (char*)AsyncWebArena::allocate(_arena, len);
+  if(!_head){
+    _headers.free();
+    return false;
+  }
 
-  if(_sendContentLength) {
-    snprintf(buf, bufSize, "Content-Length: %d\r\n", _contentLength);
-    out.concat(buf);
+  char *out = append(_head, "HTTP/1.", 7);
+  *out++ = '0' + version;
+  *out++ = ' ';
+  out = appendDecimal(out, _code);
+  *out++ = ' ';
+  out = append(out, reason, reasonLen);
+  out = append(out, "\r\n", 2);
+  if(_sendContentLength){
+    out = append(out, "Content-Length: ", 16);
+    out = appendDecimal(out, _contentLength);
+    out = append(out, "\r\n", 2);
   }
-  if(_contentType.length()) {
-    snprintf(buf, bufSize, "Content-Type: %s\r\n", _contentType.c_str());
-    out.concat(buf);
+  if(_contentType.length()){
+    out = append(out, "Content-Type: ", 14);
+    out = append(out, _contentType);
+    out = append(out, "\r\n", 2);
   }
-
   for(const auto& header: _headers){
-    snprintf(buf, bufSize, "%s: %s\r\n", header->name().c_str(), header->value().c_str());
-    out.concat(buf);
+    out = append(out, header->name());
+    out = append(out, ": ", 2);
+    out = append(out, header->value());
+    out = append(out, "\r\n", 2);
   }
   _headers.free();
+  append(out, "\r\n", 2);
+
+  _headLength = len;
+  _headSent = 0;
+  return true;
+}
+
+void AsyncWebServerResponse::_freeHead(){
+  AsyncWebArena::release(_head);
+  _head = NULL;
+}
 
-  out.concat("\r\n");
-  _headLength = out.length();
+String AsyncWebServerResponse::_assembleHead(uint8_t version){
+  String out = String();
+  if(_buildHead(version)){
+    out.concat(_head, _headLength);
+    _freeHead();
+  }
   return out;
 }
 
@@ -166,7 +245,9 @@ size_t AsyncWebServerResponse::_ack(AsyncWebServerRequest *request, size_t len,
 /*
  * String/Code Response
  * */
-AsyncBasicResponse::AsyncBasicResponse(int code, const String& contentType, const String& content){
+AsyncBasicResponse::AsyncBasicResponse(int code, const String& contentType, const String& content, AsyncWebArena *arena)
+  : AsyncWebServerResponse(arena)
+{
   _code = code;
   _content = content;
   _contentType = contentType;
@@ -175,62 +256,48 @@ AsyncBasicResponse::AsyncBasicResponse(int code, const String& contentType, cons
     if(!_contentType.length())
       _contentType = "text/plain";
   }
-  addHeader("Connection","close");
 }
 
 void AsyncBasicResponse::_respond(AsyncWebServerRequest *request){
-  _state = RESPONSE_HEADERS;
-  String out = _assembleHead(request->version());
-  size_t outLen = out.length();
-  size_t space = request->client()->space();
-  if(!_contentLength && space >= outLen){
-    _writtenLength += request->client()->write(out.c_str(), outLen);
-    _state = RESPONSE_WAIT_ACK;
-  } else if(_contentLength && space >= outLen + _contentLength){
-    out += _content;
-    outLen += _contentLength;
-    _writtenLength += request->client()->write(out.c_str(), outLen);
-    _state = RESPONSE_WAIT_ACK;
-  } else if(space && space < outLen){
-    String partial = out.substring(0, space);
-    _content = out.substring(space) + _content;
-    _contentLength += outLen - space;
-    _writtenLength += request->client()->write(partial.c_str(), partial.length());
-    _state = RESPONSE_CONTENT;
-  } else if(space > outLen && space < (outLen + _contentLength)){
-    size_t shift = space - outLen;
-    outLen += shift;
-    _sentLength += shift;
-    out += _content.substring(0, shift);
-    _content = _content.substring(shift);
-    _writtenLength += request->client()->write(out.c_str(), outLen);
-    _state = RESPONSE_CONTENT;
-  } else {
-    _content = out + _content;
-    _contentLength += outLen;
-    _state = RESPONSE_CONTENT;
+  _addConnectionHeader(request);
+  if(!_buildHead(request->version())){
+    _state = RESPONSE_FAILED;
+    request->client()->close();
+    return;
   }
+  _state = RESPONSE_CONTENT;
+  _ack(request, 0, 0);
 }
 
 size_t AsyncBasicResponse::_ack(AsyncWebServerRequest *request, size_t len, uint32_t time){
   (void)time;
   _ackedLength += len;
   if(_state == RESPONSE_CONTENT){
-    size_t available = _contentLength - _sentLength;
-    size_t space = request->client()->space();
-    //we can fit in this packet
-    if(space > available){
-      _writtenLength += request->client()->write(_content.c_str(), available);
+    // Head & body go out as two segments of one send, the body straight from _content
+    AsyncClient *client = request->client();
+    size_t space = client->space();
+    size_t headLen = std::min(space, _headLength - _headSent);
+    size_t bodyLen = std::min(space - headLen, _contentLength - _sentLength);
+    size_t written = 0;
+    if(headLen){
+      written = client->add(_head + _headSent, headLen, bodyLen ? (ASYNC_WRITE_FLAG_COPY | ASYNC_WRITE_FLAG_MORE) : ASYNC_WRITE_FLAG_COPY);
+      _headSent += written;
+      if(_headSent == _headLength)
+        _freeHead();
+    }
+    if(bodyLen && written == headLen){
+      size_t sent = client->add(_content.c_str() + _sentLength, bodyLen);
+      _sentLength += sent;
+      written += sent;
+    }
+    if(written)
+      client->send();
+    _writtenLength += written;
+    if(_headSent == _headLength && _sentLength == _contentLength){
       _content = String();
       _state = RESPONSE_WAIT_ACK;
-      return available;
     }
-    //send some data, the rest on ack
-    String out = _content.substring(0, space);
-    _content = _content.substring(space);
-    _sentLength += space;
-    _writtenLength += request->client()->write(out.c_str(), space);
-    return space;
+    return written;
   } else if(_state == RESPONSE_WAIT_ACK){
     if(_ackedLength >= _writtenLength){
       _state = RESPONSE_END;
@@ -239,12 +306,60 @@ size_t AsyncBasicResponse::_ack(AsyncWebServerRequest *request, size_t len, uint
   return 0;
 }
 
+/*
+ * Prepared Response
+ * */
+
+AsyncPreparedResponse::AsyncPreparedResponse(int code, const String& contentType, const String& content)
+  : _code(code)
+  , _contentType(contentType)
+  , _content(content)
+  , _headers([](AsyncWebHeader *h){ delete h; })
+{
+  _prepare();
+}
+
+AsyncPreparedResponse::~AsyncPreparedResponse(){
+  _headers.free();
+}
+
+AsyncPreparedResponse& AsyncPreparedResponse::addHeader(const String& name, const String& value){
+  _headers.add(new AsyncWebHeader(name, value));
+  _prepare();
+  return *this;
+}
+
+// Lets AsyncBasicResponse produce the bytes, so they match what request->send(code, ...) sends
+void AsyncPreparedResponse::_prepare(){
+  for(uint8_t version = 0; version < 2; version++){
+    AsyncBasicResponse *response = new AsyncBasicResponse(_code, _contentType, _content);
+    if(response == NULL)
+      return;
+    for(const auto& header: _headers)
+      response->addHeader(header->name(), header->value());
+    // Written as-is to any connection, so it never offers to keep one
+    response->addHeader("Connection","close");
+    _bytes[version] = response->_assembleHead(version);
+    _bytes[version] += _content;
+    delete response;
+  }
+}
 
 /*
  * Abstract Response
  * */
 
-AsyncAbstractResponse::AsyncAbstractResponse(AwsTemplateProcessor callback): _callback(callback)
+AsyncAbstractResponse::AsyncAbstractResponse(AwsTemplateProcessor callback, AsyncWebArena *arena)
+  : AsyncWebServerResponse(arena)
+  , _buffer(NULL)
+  , _bufferSize(0)
+  , _bufferStart(0)
+  , _bufferEnd(0)
+  , _bodyDone(false)
+  , _sourceSized(false)
+  , _sourceDone(false)
+  , _compressor(NULL)
+  , _callback(callback)
 {
   // In case of template processing, we're unable to determine real response size
   if(callback) {
@@ -254,9 +369,21 @@ AsyncAbstractResponse::AsyncAbstractResponse(AwsTemplateProcessor callback): _ca
   }
 }
 
+AsyncAbstractResponse::~AsyncAbstractResponse(){
+  AsyncWebArena::release(_buffer);
+  delete _compressor;
+}
+
 void AsyncAbstractResponse::_respond(AsyncWebServerRequest *request){
-  addHeader("Connection","close");
-  _head = _assembleHead(request->version());
+  _sourceSized = _sendContentLength && !_chunked;
+  _sourceDone = _sourceSized && !_contentLength;
+  _startCompression(request);
+  _addConnectionHeader(request);
+  if(!_buildHead(request->version())){
+    _state = RESPONSE_FAILED;
+    request->client()->close();
+    return;
+  }
   _state = RESPONSE_HEADERS;
   _ack(request, 0, 0);
 }
@@ -269,90 +396,55 @@ size_t AsyncAbstractResponse::_ack(AsyncWebServerRequest *request, size_t len, u
     return 0;
   }
   _ackedLength += len;
-  size_t space = request->client()->space();
+  AsyncClient *client = request->client();
+  size_t space = client->space();
 
-  size_t headLen = _head.length();
+  size_t headLen = _headLength - _headSent;
   if(_state == RESPONSE_HEADERS){
     if(space >= headLen){
       _state = RESPONSE_CONTENT;
-      space -= headLen;
     } else {
-      String out = _head.substring(0, space);
-      _head = _head.substring(space);
-      _writtenLength += request->client()->write(out.c_str(), out.length());
-      return out.length();
+      size_t written = client->write(_head + _headSent, space);
+      _headSent += written;
+      _writtenLength += written;
+      return written;
     }
   }
 
   if(_state == RESPONSE_CONTENT){
-    size_t outLen;
-    if(_chunked){
-      if(space <= 8){
-        return 0;
-      }
-      outLen = space;
-    } else if(!_sendContentLength){
-      outLen = space;
-    } else {
-      outLen = ((_contentLength - _sentLength) > space)?space:(_contentLength - _sentLength);
-    }
-
-    uint8_t *buf = (uint8_t *)malloc(outLen+headLen);
-    if (!buf) {
-      // os_printf("_ack malloc %d failed\n", outLen+headLen);
+    // Fill the window now & read one segment past it, ready for the next ack
+    size_t bodySpace = space > headLen ? space - headLen : 0;
+    if(!_produce(bodySpace + client->getMss()))
       return 0;
-    }
+    size_t bodyLen = std::min(bodySpace, _bufferEnd - _bufferStart);
+    bool more = !_bodyDone || _bufferEnd - _bufferStart > bodyLen;
 
+    // Head & body are added as segments of one send, all but the last marked as having more
+    size_t written = 0;
     if(headLen){
-      memcpy(buf, _head.c_str(), _head.length());
+      written = client->add(_head + _headSent, headLen, (bodyLen || more) ? (ASYNC_WRITE_FLAG_COPY | ASYNC_WRITE_FLAG_MORE) : ASYNC_WRITE_FLAG_COPY);
+      _headSent += written;
+      if(_headSent == _headLength)
+        _freeHead();
     }
-
-    size_t readLen = 0;
-
-    if(_chunked){
-      // HTTP 1.1 allows leading zeros in chunk length. Or spaces may be added.
-      // See RFC2616 sections 2, 3.6.1.
-      readLen = _fillBufferAndProcessTemplates(buf+headLen+6, outLen - 8);
-      if(readLen == RESPONSE_TRY_AGAIN){
-          free(buf);
-          return 0;
-      }
-      outLen = sprintf((char*)buf+headLen, "%x", readLen) + headLen;
-      while(outLen < headLen + 4) buf[outLen++] = ' ';
-      buf[outLen++] = '\r';
-      buf[outLen++] = '\n';
-      outLen += readLen;
-      buf[outLen++] = '\r';
-      buf[outLen++] = '\n';
-    } else {
-      readLen = _fillBufferAndProcessTemplates(buf+headLen, outLen);
-      if(readLen == RESPONSE_TRY_AGAIN){
-          free(buf);
-          return 0;
-      }
-      outLen = readLen + headLen;
-    }
-
-    if(headLen){
-        _head = String();
+    if(bodyLen && written == headLen){
+      size_t bodyWritten = client->add((const char*)_buffer + _bufferStart, bodyLen, more ? (ASYNC_WRITE_FLAG_COPY | ASYNC_WRITE_FLAG_MORE) : ASYNC_WRITE_FLAG_COPY);
+      _bufferStart += bodyWritten;
+      written += bodyWritten;
     }
-
-    if(outLen){
-        _writtenLength += request->client()->write((const char*)buf, outLen);
+    if(written){
+      client->send();
+      _writtenLength += written;
     }
 
-    if(_chunked){
-        _sentLength += readLen;
-    } else {
-        _sentLength += outLen - headLen;
-    }
-
-    free(buf);
-
-    if((_chunked && readLen == 0) || (!_sendContentLength && outLen == 0) || (!_chunked && _sentLength == _contentLength)){
+    if(_bodyDone && _bufferStart == _bufferEnd && _headSent == _headLength){
+      AsyncWebArena::release(_buffer);
+      _buffer = NULL;
+      delete _compressor;
+      _compressor = NULL;
       _state = RESPONSE_WAIT_ACK;
     }
-    return outLen;
+    return written;
 
   } else if(_state == RESPONSE_WAIT_ACK){
     if(!_sendContentLength || _ackedLength >= _writtenLength){
@@ -364,6 +456,127 @@ size_t AsyncAbstractResponse::_ack(AsyncWebServerRequest *request, size_t len, u
   return 0;
 }
 
+// The compressed length isn't known up front, so a compressed body is chunked (or, for HTTP/1.0,
+// ended by closing the connection)
+void AsyncAbstractResponse::_startCompression(AsyncWebServerRequest *request){
+  AsyncWebDeflate::Format format;
+  if(_code < 200 || _code == 204 || _code == 304 || _sourceDone)
+    return;
+  if(!request->_compression(_sourceSized, _contentLength, format))
+    return;
+  for(const auto& header: _headers){
+    if(header->name().equalsIgnoreCase("Content-Encoding")) // already compressed (eg a .gz file)
+      return;
+  }
+  _compressor = new (std::nothrow) AsyncWebDeflate(format);
+  if(_compressor == NULL) // sent uncompressed
+    return;
+  addHeader("Content-Encoding", format == AsyncWebDeflate::GZIP ? "gzip" : "deflate");
+  addHeader("Vary", "Accept-Encoding");
+  _sendContentLength = false;
+  _chunked = request->version() == 1;
+}
+
+// Reads the body into the send buffer, compressed & chunked as it goes on the wire, until `want`
+// bytes are waiting in it, it's full, or the source has nothing more for now; false only if the
+// buffer couldn't be allocated
+bool AsyncAbstractResponse::_produce(size_t want){
+  if(_bodyDone)
+    return true;
+
+  if(_buffer == NULL){
+    // A body of known length needs no more room than it has left (a little more if compressed)
+    _bufferSize = ASYNCWEBSERVER_SEND_BUFFER;
+    if(_sourceSized){
+      size_t left = _contentLength - _sentLength;
+      if(_compressor)
+        left += left / 8 + 64;
+      if(left < _bufferSize)
+        _bufferSize = left;
+    }
+    if(!_bufferSize){
+      _bodyDone = true;
+      return true;
+    }
+    _buffer = (uint8_t*)AsyncWebArena::allocate(_arena, _bufferSize);
+    if(_buffer == NULL)
+      return false;
+    _bufferStart = _bufferEnd = 0;
+  } else if(_bufferStart){
+    memmove(_buffer, _buffer + _bufferStart, _bufferEnd - _bufferStart);
+    _bufferEnd -= _bufferStart;
+    _bufferStart = 0;
+  }
+
+  while(!_bodyDone && _bufferEnd < want && _bufferEnd < _bufferSize){
+    uint8_t *out = _buffer + _bufferEnd;
+    size_t room = _bufferSize - _bufferEnd;
+    size_t framing = _chunked ? 8 : 0;
+    if(room <= framing + (_compressor ? 16 : 0))
+      break;
+    uint8_t *data = _chunked ? out + 6 : out;
+    size_t len = _compressor ? _compress(data, room - framing) : _readSource(data, room - framing);
+    if(len == RESPONSE_TRY_AGAIN)
+      break;
+    bool last = _compressor ? _compressor->finished() : _sourceDone;
+
+    if(_chunked && len){
+      // HTTP 1.1 allows leading zeros in chunk length. Or spaces may be added.
+      // See RFC2616 sections 2, 3.6.1.
+      size_t n = sprintf((char*)out, "%x", len);
+      while(n < 4) out[n++] = ' ';
+      out[n++] = '\r';
+      out[n++] = '\n';
+      n += len;
+      out[n++] = '\r';
+      out[n++] = '\n';
+      _bufferEnd += n;
+    } else {
+      _bufferEnd += len;
+    }
+
+    if(last){
+      if(_chunked){
+        if(_bufferSize - _bufferEnd < 5)
+          break;
+        memcpy(_buffer + _bufferEnd, "0\r\n\r\n", 5);
+        _bufferEnd += 5;
+      }
+      _bodyDone = true;
+    } else if(!len){
+      break;
+    }
+  }
+  return true;
+}
+
+// Reads up to maxLen bytes of the body from its source; RESPONSE_TRY_AGAIN if it has none yet
+size_t AsyncAbstractResponse::_readSource(uint8_t *buf, size_t maxLen){
+  if(_sourceSized && maxLen > _contentLength - _sentLength)
+    maxLen = _contentLength - _sentLength;
+  if(_sourceDone || !maxLen)
+    return 0;
+  size_t readLen = _fillBufferAndProcessTemplates(buf, maxLen);
+  if(readLen == RESPONSE_TRY_AGAIN)
+    return readLen;
+  _sentLength += readLen;
+  if(_sourceSized ? _sentLength == _contentLength : readLen == 0)
+    _sourceDone = true;
+  return readLen;
+}
+
+// Reads what the compressor has room for & compresses what it can of it into out
+size_t AsyncAbstractResponse::_compress(uint8_t *out, size_t maxLen){
+  size_t inLen;
+  uint8_t *in = _compressor->input(inLen);
+  if(inLen){
+    size_t readLen = _readSource(in, inLen);
+    if(readLen != RESPONSE_TRY_AGAIN)
+      _compressor->added(readLen);
+  }
+  return _compressor->compress(out, maxLen, _sourceDone);
+}
+
 size_t AsyncAbstractResponse::_readDataFromCacheOrContent(uint8_t* data, const size_t len)
 {
     // If we have something in cache, copy it to buffer
@@ -504,7 +717,7 @@ void AsyncFileResponse::_setContentType(const String& path){
   else _contentType = "text/plain";
 }
 
-AsyncFileResponse::AsyncFileResponse(FS &fs, const String& path, const String& contentType, bool download, AwsTemplateProcessor callback): AsyncAbstractResponse(callback){
+AsyncFileResponse::AsyncFileResponse(FS &fs, const String& path, const String& contentType, bool download, AwsTemplateProcessor callback, AsyncWebArena *arena): AsyncAbstractResponse(callback, arena){
   _code = 200;
   _path = path;
 
@@ -538,7 +751,7 @@ AsyncFileResponse::AsyncFileResponse(FS &fs, const String& path, const String& c
   addHeader("Content-Disposition", buf);
 }
 
-AsyncFileResponse::AsyncFileResponse(File content, const String& path, const String& contentType, bool download, AwsTemplateProcessor callback): AsyncAbstractResponse(callback){
+AsyncFileResponse::AsyncFileResponse(File content, const String& path, const String& contentType, bool download, AwsTemplateProcessor callback, AsyncWebArena *arena): AsyncAbstractResponse(callback, arena){
   _code = 200;
   _path = path;
 
@@ -577,7 +790,7 @@ size_t AsyncFileResponse::_fillBuffer(uint8_t *data, size_t len){
  * Stream Response
  * */
 
-AsyncStreamResponse::AsyncStreamResponse(Stream &stream, const String& contentType, size_t len, AwsTemplateProcessor callback): AsyncAbstractResponse(callback) {
+AsyncStreamResponse::AsyncStreamResponse(Stream &stream, const String& contentType, size_t len, AwsTemplateProcessor callback, AsyncWebArena *arena): AsyncAbstractResponse(callback, arena) {
   _code = 200;
   _content = &stream;
   _contentLength = len;
@@ -597,7 +810,7 @@ size_t AsyncStreamResponse::_fillBuffer(uint8_t *data, size_t len){
  * Callback Response
  * */
 
-AsyncCallbackResponse::AsyncCallbackResponse(const String& contentType, size_t len, AwsResponseFiller callback, AwsTemplateProcessor templateCallback): AsyncAbstractResponse(templateCallback) {
+AsyncCallbackResponse::AsyncCallbackResponse(const String& contentType, size_t len, AwsResponseFiller callback, AwsTemplateProcessor templateCallback, AsyncWebArena *arena): AsyncAbstractResponse(templateCallback, arena) {
   _code = 200;
   _content = callback;
   _contentLength = len;
@@ -619,7 +832,7 @@ size_t AsyncCallbackResponse::_fillBuffer(uint8_t *data, size_t len){
  * Chunked Response
  * */
 
-AsyncChunkedResponse::AsyncChunkedResponse(const String& contentType, AwsResponseFiller callback, AwsTemplateProcessor processorCallback): AsyncAbstractResponse(processorCallback) {
+AsyncChunkedResponse::AsyncChunkedResponse(const String& contentType, AwsResponseFiller callback, AwsTemplateProcessor processorCallback, AsyncWebArena *arena): AsyncAbstractResponse(processorCallback, arena) {
   _code = 200;
   _content = callback;
   _contentLength = 0;
@@ -641,7 +854,7 @@ size_t AsyncChunkedResponse::_fillBuffer(uint8_t *data, size_t len){
  * Progmem Response
  * */
 
-AsyncProgmemResponse::AsyncProgmemResponse(int code, const String& contentType, const uint8_t * content, size_t len, AwsTemplateProcessor callback): AsyncAbstractResponse(callback) {
+AsyncProgmemResponse::AsyncProgmemResponse(int code, const String& contentType, const uint8_t * content, size_t len, AwsTemplateProcessor callback, AsyncWebArena *arena): AsyncAbstractResponse(callback, arena) {
   _code = code;
   _content = content;
   _contentType = contentType;
@@ -662,11 +875,79 @@ size_t AsyncProgmemResponse::_fillBuffer(uint8_t *data, size_t len){
 }
 
 
+/*
+ * Template Response
+ * */
+
+static const size_t TEMPLATE_VALUE_SLOT = 1 + ASYNCWEBTEMPLATE_VALUE_LENGTH;
+static_assert(ASYNCWEBTEMPLATE_VALUE_LENGTH <= 255, "template values are stored with a length byte");
+
+AsyncTemplateResponse::AsyncTemplateResponse(int code, const String& contentType, const AsyncWebTemplate &tpl, AwsTemplateFiller filler, AsyncWebArena *arena)
+  : AsyncAbstractResponse(nullptr, arena)
+  , _template(tpl)
+  , _values(NULL)
+  , _segment(0)
+  , _offset(0)
+{
+  _code = code;
+  _contentType = contentType;
+  _contentLength = tpl.literalLength();
+  uint8_t count = tpl.variables();
+  if(!tpl.valid() || !count)
+    return;
+  _values = (uint8_t *)AsyncWebArena::allocate(_arena, count * TEMPLATE_VALUE_SLOT);
+  if(_values == NULL)
+    return;
+  for(uint8_t i = 0; i < count; i++){
+    uint8_t *slot = _values + i * TEMPLATE_VALUE_SLOT;
+    size_t len = filler ? filler(i, (char *)slot + 1, ASYNCWEBTEMPLATE_VALUE_LENGTH) : 0;
+    slot[0] = len < ASYNCWEBTEMPLATE_VALUE_LENGTH ? len : ASYNCWEBTEMPLATE_VALUE_LENGTH;
+  }
+  // A variable used more than once is sent each time
+  for(size_t s = 0; s < tpl.segments(); s++){
+    const AsyncWebTemplate::Segment &segment = tpl.segment(s);
+    if(segment.var != AsyncWebTemplate::LITERAL)
+      _contentLength += _values[segment.var * TEMPLATE_VALUE_SLOT];
+  }
+}
+
+AsyncTemplateResponse::~AsyncTemplateResponse(){
+  AsyncWebArena::release(_values);
+}
+
+size_t AsyncTemplateResponse::_fillBuffer(uint8_t *data, size_t len){
+  size_t filled = 0;
+  while(filled < len && _segment < _template.segments()){
+    const AsyncWebTemplate::Segment &segment = _template.segment(_segment);
+    const uint8_t *src;
+    size_t srcLen;
+    if(segment.var == AsyncWebTemplate::LITERAL){
+      src = (const uint8_t *)segment.data;
+      srcLen = segment.len;
+    } else {
+      src = _values + segment.var * TEMPLATE_VALUE_SLOT + 1;
+      srcLen = src[-1];
+    }
+    size_t n = std::min(srcLen - _offset, len - filled);
+    memcpy_P(data + filled, src + _offset, n);
+    filled += n;
+    _offset += n;
+    if(_offset == srcLen){
+      _segment++;
+      _offset = 0;
+    }
+  }
+  return filled;
+}
+
+
 /*
  * Response Stream (You can print/write/printf to it, up to the contentLen bytes)
  * */
 
-AsyncResponseStream::AsyncResponseStream(const String& contentType, size_t bufferSize){
+AsyncResponseStream::AsyncResponseStream(const String& contentType, size_t bufferSize, AsyncWebArena *arena)
+  : AsyncAbstractResponse(nullptr, arena)
+{
   _code = 200;
   _contentLength = 0;
   _contentType = contentType;
@@ -0,0 +1,219 @@
+#include "ESPAsyncWebServer.h"
+#include "WebRouter.h"
+
+static const uint32_t FNV_OFFSET = 2166136261u;
+
+static inline uint32_t fnvStep(uint32_t hash, char c){
+  return (hash ^ (uint8_t)c) * 16777619u;
+}
+
+static uint32_t fnv(const char *str, size_t len){
+  uint32_t hash = FNV_OFFSET;
+  while(len--)
+    hash = fnvStep(hash, *str++);
+  return hash;
+}
+
+// Adds route r to the sorted candidate list, skipping duplicates; false if the list is full
+static bool addCandidate(uint16_t *found, size_t &count, size_t max, uint16_t r){
+  size_t i = count;
+  while(i && found[i - 1] > r)
+    i--;
+  if(i && found[i - 1] == r)
+    return true;
+  if(count == max)
+    return false;
+  memmove(found + i + 1, found + i, (count - i) * sizeof(uint16_t));
+  found[i] = r;
+  count++;
+  return true;
+}
+
+AsyncWebRouter::AsyncWebRouter()
+  : _routes(NULL)
+  , _routeCount(0)
+  , _slots(NULL)
+  , _slotMask(0)
+  , _nodes(NULL)
+  , _nodeCount(0)
+  , _any(NONE)
+  , _built(false)
+{}
+
+AsyncWebRouter::~AsyncWebRouter(){
+  clear();
+}
+
+void AsyncWebRouter::clear(){
+  delete[] _routes;
+  delete[] _slots;
+  delete[] _nodes;
+  _routes = NULL;
+  _routeCount = 0;
+  _slots = NULL;
+  _slotMask = 0;
+  _nodes = NULL;
+  _nodeCount = 0;
+  _any = NONE;
+  _built = false;
+}
+
+void AsyncWebRouter::_append(uint16_t *head, uint16_t route){
+  while(*head != NONE)
+    head = &_routes[*head].next;
+  *head = route;
+}
+
+void AsyncWebRouter::_insertPath(uint16_t route){
+  Route &r = _routes[route];
+  size_t i = r.hash & _slotMask;
+  while(_slots[i] != NONE){
+    Route &first = _routes[_slots[i]];
+    if(first.hash == r.hash && first.path == r.path){
+      _append(&first.next, route);
+      return;
+    }
+    i = (i + 1) & _slotMask;
+  }
+  _slots[i] = route;
+}
+
+void AsyncWebRouter::_insertPrefix(uint16_t route){
+  const String &path = _routes[route].path;
+  size_t node = 0;
+  for(size_t i = 0; i < path.length(); i++){
+    uint16_t *link = &_nodes[node].child;
+    while(*link != NONE && _nodes[*link].c != path[i])
+      link = &_nodes[*link].sibling;
+    if(*link == NONE){
+      Node &n = _nodes[_nodeCount];
+      n.c = path[i];
+      n.child = n.sibling = n.routes = NONE;
+      *link = _nodeCount++;
+    }
+    node = *link;
+  }
+  _append(&_nodes[node].routes, route);
+}
+
+uint16_t AsyncWebRouter::_lookup(uint32_t hash, const char *path, size_t len) const {
+  size_t i = hash & _slotMask;
+  while(_slots[i] != NONE){
+    const Route &r = _routes[_slots[i]];
+    if(r.hash == hash && r.path.length() == len && !memcmp(r.path.c_str(), path, len))
+      return _slots[i];
+    i = (i + 1) & _slotMask;
+  }
+  return NONE;
+}
+
+void AsyncWebRouter::build(const AsyncWebList<AsyncWebHandler*>& handlers){
+  clear();
+  size_t count = handlers.length();
+  if(count >= NONE)
+    return; // left unbuilt, so the server walks its handlers instead
+
+  _routes = new Route[count ? count : 1];
+  if(_routes == NULL)
+    return;
+
+  size_t paths = 0, prefixChars = 0;
+  for(const auto& h: handlers){
+    Route &r = _routes[_routeCount];
+    WebRequestMethodComposite methods = HTTP_ANY;
+    r.handler = h;
+    r.kind = h->route(r.path, methods);
+    r.methods = methods;
+    r.next = NONE;
+    r.hash = fnv(r.path.c_str(), r.path.length());
+    if(r.kind == ROUTE_EXACT || r.kind == ROUTE_PATH)
+      paths++;
+    else if(r.kind == ROUTE_PREFIX)
+      prefixChars += r.path.length();
+    _routeCount++;
+  }
+
+  size_t slots = 4;
+  while(slots < paths * 2)
+    slots <<= 1;
+  _slots = new uint16_t[slots];
+  _nodes = new Node[1 + prefixChars];
+  if(_slots == NULL || _nodes == NULL){
+    clear();
+    return;
+  }
+  _slotMask = slots - 1;
+  memset(_slots, 0xFF, slots * sizeof(uint16_t));
+  _nodes[0].c = 0;
+  _nodes[0].child = _nodes[0].sibling = _nodes[0].routes = NONE;
+  _nodeCount = 1;
+
+  for(uint16_t i = 0; i < _routeCount; i++){
+    switch(_routes[i].kind){
+      case ROUTE_EXACT:
+      case ROUTE_PATH:   _insertPath(i); break;
+      case ROUTE_PREFIX: _insertPrefix(i); break;
+      default:           _append(&_any, i); break;
+    }
+  }
+  _built = true;
+}
+
+AsyncWebHandler *AsyncWebRouter::match(AsyncWebServerRequest *request) const {
+  const String &url = request->url();
+  const char *path = url.c_str();
+  size_t len = url.length();
+  WebRequestMethodComposite method = request->method();
+
+  uint16_t found[MAX_CANDIDATES];
+  size_t count = 0;
+  bool full = false;
+
+  for(uint16_t r = _any; r != NONE && !full; r = _routes[r].next){
+    if(_routes[r].methods & method)
+      full = !addCandidate(found, count, MAX_CANDIDATES, r);
+  }
+
+  // PATH routes match at every '/' in the url as well as at its end; EXACT ones only at the end
+  uint32_t hash = FNV_OFFSET;
+  for(size_t i = 0; i <= len && !full; i++){
+    if(i == len || (i && path[i] == '/')){
+      for(uint16_t r = _lookup(hash, path, i); r != NONE && !full; r = _routes[r].next){
+        if((_routes[r].methods & method) && (i == len || _routes[r].kind == ROUTE_PATH))
+          full = !addCandidate(found, count, MAX_CANDIDATES, r);
+      }
+    }
+    if(i < len)
+      hash = fnvStep(hash, path[i]);
+  }
+
+  size_t node = 0;
+  for(size_t i = 0; node != NONE && !full; i++){
+    for(uint16_t r = _nodes[node].routes; r != NONE && !full; r = _routes[r].next){
+      if(_routes[r].methods & method)
+        full = !addCandidate(found, count, MAX_CANDIDATES, r);
+    }
+    if(i == len)
+      break;
+    node = _nodes[node].child;
+    while(node != NONE && _nodes[node].c != path[i])
+      node = _nodes[node].sibling;
+  }
+
+  if(full){
+    // Too many candidates to sort on the stack; fall back to trying every route in order
+    for(size_t r = 0; r < _routeCount; r++){
+      AsyncWebHandler *h = _routes[r].handler;
+      if((_routes[r].methods & method) && h->filter(request) && h->canHandle(request))
+        return h;
+    }
+    return NULL;
+  }
+
+  for(size_t i = 0; i < count; i++){
+    AsyncWebHandler *h = _routes[found[i]].handler;
+    if(h->filter(request) && h->canHandle(request))
+      return h;
+  }
+  return NULL;
+}
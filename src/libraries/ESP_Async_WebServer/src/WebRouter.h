@@ -0,0 +1,74 @@
+#ifndef ASYNCWEBROUTER_H_
+#define ASYNCWEBROUTER_H_
+
+// Index over the server's handlers built at begin(), so a request is only offered to the handlers
+// whose path could match its url instead of to every handler in turn
+
+#include <stddef.h>
+#include <stdint.h>
+#include "StringArray.h"
+
+class AsyncWebHandler;
+class AsyncWebServerRequest;
+
+typedef enum {
+  ROUTE_ANY,    // not indexed: offered every request (regex, "/*.ext" & custom handlers)
+  ROUTE_EXACT,  // url == path
+  ROUTE_PATH,   // url == path, or url starts with path + "/"
+  ROUTE_PREFIX  // url starts with path
+} WebRouteKind;
+
+/*
+ * ROUTER :: Hash of exact paths plus a prefix trie, each entry tagged with its methods
+ *
+ * Only narrows down the candidates: they're still tried in registration order with filter() and
+ * canHandle(), so the first handler that accepts a request is the same one the plain walk finds.
+ * */
+
+class AsyncWebRouter {
+  private:
+    struct Route {
+      AsyncWebHandler *handler;
+      String path;
+      uint32_t hash;
+      uint16_t next;  // next route in the same hash slot, trie node or ANY list, in registration order
+      uint8_t kind;
+      uint8_t methods;
+    };
+    struct Node {
+      char c;
+      uint16_t child;
+      uint16_t sibling;
+      uint16_t routes;
+    };
+    static const uint16_t NONE = 0xFFFF;
+    static const size_t MAX_CANDIDATES = 16;
+
+    Route *_routes;
+    size_t _routeCount;
+    uint16_t *_slots;     // open addressing over EXACT & PATH routes, holding the first route per path
+    size_t _slotMask;
+    Node *_nodes;         // trie of PREFIX routes; _nodes[0] is the empty prefix
+    size_t _nodeCount;
+    uint16_t _any;
+    bool _built;
+
+    void _append(uint16_t *head, uint16_t route);
+    void _insertPath(uint16_t route);
+    void _insertPrefix(uint16_t route);
+    uint16_t _lookup(uint32_t hash, const char *path, size_t len) const;
+
+  public:
+    AsyncWebRouter();
+    ~AsyncWebRouter();
+    AsyncWebRouter(const AsyncWebRouter&) = delete;
+    AsyncWebRouter& operator=(const AsyncWebRouter&) = delete;
+
+    bool built() const { return _built; }
+    void build(const AsyncWebList<AsyncWebHandler*>& handlers);
+    void clear();
+    // First handler in registration order that passes filter() & canHandle(), or NULL
+    AsyncWebHandler *match(AsyncWebServerRequest *request) const;
+};
+
+#endif /* ASYNCWEBROUTER_H_ */
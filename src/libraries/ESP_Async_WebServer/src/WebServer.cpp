@@ -20,6 +20,12 @@
 */
 #include "ESPAsyncWebServer.h"
 #include "WebHandlerImpl.h"
+#include <new>
+
+std::atomic<uint32_t> AsyncWebArena::_allocs(0);
+std::atomic<uint32_t> AsyncWebArena::_fallbacks(0);
+std::atomic<uint32_t> AsyncWebArena::_heapAllocs(0);
+std::atomic<uint32_t> AsyncWebArena::_peak(0);
 
 bool ON_STA_FILTER(AsyncWebServerRequest *request) {
   return WiFi.localIP() == request->client()->localIP();
@@ -32,8 +38,15 @@ bool ON_AP_FILTER(AsyncWebServerRequest *request) {
 
 AsyncWebServer::AsyncWebServer(uint16_t port)
   : _server(port)
-  , _rewrites(LinkedList<AsyncWebRewrite*>([](AsyncWebRewrite* r){ delete r; }))
-  , _handlers(LinkedList<AsyncWebHandler*>([](AsyncWebHandler* h){ delete h; }))
+  , _rewrites([](AsyncWebRewrite* r){ delete r; })
+  , _handlers(nullptr) // deleted by _collect(), once no request can be matching against them
+  , _router(NULL)
+  , _routed(false)
+  , _matching(0)
+  , _retiredRouters(nullptr)
+  , _retiredHandlers(nullptr)
+  , _keepAliveTimeout(ASYNCWEBSERVER_KEEPALIVE_TIMEOUT)
+  , _keepAliveMax(ASYNCWEBSERVER_KEEPALIVE_MAX)
 {
   _catchAllHandler = new AsyncCallbackWebHandler();
   if(_catchAllHandler == NULL)
@@ -54,6 +67,8 @@ AsyncWebServer::AsyncWebServer(uint16_t port)
 AsyncWebServer::~AsyncWebServer(){
   reset();  
   end();
+  delete _router;
+  _collect();
   if(_catchAllHandler) delete _catchAllHandler;
 }
 
@@ -70,16 +85,77 @@ AsyncWebRewrite& AsyncWebServer::rewrite(const char* from, const char* to){
   return addRewrite(new AsyncWebRewrite(from, to));
 }
 
+// The AsyncTCP task may be matching a request while handlers change, so the list & the table are
+// changed together under _routerLock, and whatever they no longer hold is only deleted once no
+// request is being matched against it
 AsyncWebHandler& AsyncWebServer::addHandler(AsyncWebHandler* handler){
-  _handlers.add(handler);
+  {
+    AsyncWebLockGuard l(_routerLock);
+    _handlers.add(handler);
+    if(_routed)
+      _swapRouter();
+  }
+  _collect();
   return *handler;
 }
 
 bool AsyncWebServer::removeHandler(AsyncWebHandler *handler){
-  return _handlers.remove(handler);
+  bool removed;
+  {
+    AsyncWebLockGuard l(_routerLock);
+    removed = _handlers.remove(handler);
+    if(removed){
+      if(_routed)
+        _swapRouter();
+      _retiredHandlers.add(handler);
+    }
+  }
+  _collect();
+  return removed;
+}
+
+// Builds a table of _handlers as they are now & makes it current, retiring the one it replaces;
+// called with _routerLock held
+void AsyncWebServer::_swapRouter(){
+  AsyncWebRouter *router = new (std::nothrow) AsyncWebRouter();
+  if(router != NULL)
+    router->build(_handlers);
+  if(_router != NULL)
+    _retiredRouters.add(_router);
+  _router = router;
+}
+
+// Deletes the tables & handlers retired while requests were being matched, once none is
+void AsyncWebServer::_collect(){
+  for(;;){
+    AsyncWebRouter *router = NULL;
+    AsyncWebHandler *handler = NULL;
+    {
+      AsyncWebLockGuard l(_routerLock);
+      if(_matching)
+        return;
+      if(!_retiredRouters.isEmpty()){
+        router = _retiredRouters.front();
+        _retiredRouters.remove(router);
+      } else if(!_retiredHandlers.isEmpty()){
+        handler = _retiredHandlers.front();
+        _retiredHandlers.remove(handler);
+      } else {
+        return;
+      }
+    }
+    delete router;
+    delete handler;
+  }
 }
 
 void AsyncWebServer::begin(){
+  {
+    AsyncWebLockGuard l(_routerLock);
+    _routed = true;
+    _swapRouter();
+  }
+  _collect();
   _server.setNoDelay(true);
   _server.begin();
 }
@@ -88,6 +164,11 @@ void AsyncWebServer::end(){
   _server.end();
 }
 
+void AsyncWebServer::setKeepAlive(uint16_t idleTimeout, uint16_t maxRequests){
+  _keepAliveTimeout = idleTimeout;
+  _keepAliveMax = maxRequests;
+}
+
 #if ASYNC_TCP_SSL_ENABLED
 void AsyncWebServer::onSslFileRequest(AcSSlFileHandler cb, void* arg){
   _server.onSslFileRequest(cb, arg);
@@ -111,13 +192,46 @@ void AsyncWebServer::_rewriteRequest(AsyncWebServerRequest *request){
   }
 }
 
+// The handlers' filter() & canHandle() run without _routerLock; _matching keeps the table & the
+// handlers this sees from being deleted until it's done
 void AsyncWebServer::_attachHandler(AsyncWebServerRequest *request){
-  for(const auto& h: _handlers){
-    if (h->filter(request) && h->canHandle(request)){
-      request->setHandler(h);
-      return;
+  AsyncWebRouter *router;
+  {
+    AsyncWebLockGuard l(_routerLock);
+    router = _router;
+    _matching++;
+  }
+  AsyncWebHandler *handler = NULL;
+  if(router != NULL && router->built()){
+    handler = router->match(request);
+  } else {
+    // No table (before begin(), or it couldn't be built): walk the list, one handler at a time
+    for(size_t i = 0; handler == NULL; i++){
+      AsyncWebHandler *h;
+      {
+        AsyncWebLockGuard l(_routerLock);
+        const auto *next = _handlers.nth(i);
+        h = next ? *next : NULL;
+      }
+      if(h == NULL)
+        break;
+      if(h->filter(request) && h->canHandle(request))
+        handler = h;
     }
   }
+  {
+    AsyncWebLockGuard l(_routerLock);
+    // Removed while this was matching, so it's about to be deleted: treat it as not found
+    if(handler != NULL && _retiredHandlers.count_if([handler](AsyncWebHandler* const& h){ return h == handler; }))
+      handler = NULL;
+    _matching--;
+  }
+  _collect();
+
+  if(handler){
+    request->setHandler(handler);
+    return;
+  }
   
   request->addInterestingHeader("ANY");
   request->setHandler(_catchAllHandler);
@@ -182,7 +296,17 @@ void AsyncWebServer::onRequestBody(ArBodyHandlerFunction fn){
 
 void AsyncWebServer::reset(){
   _rewrites.free();
-  _handlers.free();
+  {
+    AsyncWebLockGuard l(_routerLock);
+    while(!_handlers.isEmpty()){
+      AsyncWebHandler *handler = _handlers.front();
+      _handlers.remove(handler);
+      _retiredHandlers.add(handler);
+    }
+    if(_routed)
+      _swapRouter();
+  }
+  _collect();
   
   if (_catchAllHandler != NULL){
     _catchAllHandler->onRequest(NULL);
@@ -0,0 +1,57 @@
+#ifndef ASYNCWEBSHAREDBUFFER_H_
+#define ASYNCWEBSHAREDBUFFER_H_
+
+// Immutable, reference counted bytes for messages fanned out to many clients: a broadcast is
+// formatted once and every client's queue holds a reference plus its own cursor instead of a copy
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <new>
+#include <atomic>
+
+/*
+ * SHARED BUFFER :: Count, length & bytes in a single heap block
+ *
+ * The creator fills data() before handing the buffer to any client and never writes it again.
+ * Clients drop their reference from the async_tcp task as their copy is acked while the loop may
+ * still be broadcasting, hence the atomic count.
+ * */
+
+class AsyncWebSharedBuffer {
+  private:
+    std::atomic<uint32_t> _refs;
+    size_t _len;
+
+    AsyncWebSharedBuffer(size_t len): _refs(1), _len(len) {}
+    ~AsyncWebSharedBuffer(){}
+
+  public:
+    AsyncWebSharedBuffer(const AsyncWebSharedBuffer&) = delete;
+    AsyncWebSharedBuffer& operator=(const AsyncWebSharedBuffer&) = delete;
+
+    // Room for `len` bytes plus a terminating NUL; the caller owns the first reference. NULL if
+    // the heap is exhausted.
+    static AsyncWebSharedBuffer *create(size_t len){
+      void *mem = malloc(sizeof(AsyncWebSharedBuffer) + len + 1);
+      if(!mem)
+        return NULL;
+      AsyncWebSharedBuffer *buffer = new (mem) AsyncWebSharedBuffer(len);
+      buffer->data()[len] = 0;
+      return buffer;
+    }
+
+    uint8_t *data(){ return (uint8_t*)(this + 1); }
+    const uint8_t *data() const { return (const uint8_t*)(this + 1); }
+    size_t length() const { return _len; }
+
+    void retain(){ _refs.fetch_add(1, std::memory_order_relaxed); }
+    void release(){
+      if(_refs.fetch_sub(1, std::memory_order_acq_rel) == 1){
+        this->~AsyncWebSharedBuffer();
+        free(this);
+      }
+    }
+};
+
+#endif /* ASYNCWEBSHAREDBUFFER_H_ */
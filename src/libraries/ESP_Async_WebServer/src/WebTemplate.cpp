@@ -0,0 +1,75 @@
+#include "ESPAsyncWebServer.h"
+#include "WebTemplate.h"
+
+AsyncWebTemplate::AsyncWebTemplate(const char *source, std::initializer_list<const char*> names)
+  : AsyncWebTemplate(source, names.begin(), names.size())
+{}
+
+AsyncWebTemplate::AsyncWebTemplate(const char *source, const char * const *names, uint8_t count)
+  : _segments(NULL)
+  , _segmentCount(0)
+  , _literalLength(0)
+  , _variables(count < LITERAL ? count : 0)
+{
+  if(source == NULL || count >= LITERAL)
+    return;
+  // Counted first so the segments take one allocation of the right size
+  size_t segments = _compile(source, names, count, NULL);
+  _segments = new Segment[segments ? segments : 1];
+  if(_segments != NULL)
+    _segmentCount = _compile(source, names, count, _segments);
+}
+
+AsyncWebTemplate::~AsyncWebTemplate(){
+  delete[] _segments;
+}
+
+// Cuts source into segments, writing them to out unless it's NULL; returns how many there are
+size_t AsyncWebTemplate::_compile(const char *source, const char * const *names, uint8_t count, Segment *out){
+  size_t segments = 0;
+  size_t literal = 0;
+  const char *start = source;
+  const char *p = source;
+
+  auto emit = [&](const char *data, size_t len, uint8_t var){
+    if(var == LITERAL){
+      if(!len)
+        return;
+      literal += len;
+    }
+    if(out != NULL){
+      out[segments].data = data;
+      out[segments].len = len;
+      out[segments].var = var;
+    }
+    segments++;
+  };
+
+  while((p = strchr(p, TEMPLATE_PLACEHOLDER)) != NULL){
+    if(p[1] == TEMPLATE_PLACEHOLDER){
+      // %% is an escaped %: keep the first, drop the second
+      emit(start, p + 1 - start, LITERAL);
+      start = p = p + 2;
+      continue;
+    }
+    uint8_t var = LITERAL;
+    size_t nameLen = 0;
+    for(uint8_t i = 0; i < count && var == LITERAL; i++){
+      nameLen = strlen(names[i]);
+      if(!strncmp(p + 1, names[i], nameLen) && p[1 + nameLen] == TEMPLATE_PLACEHOLDER)
+        var = i;
+    }
+    if(var == LITERAL){
+      p++;
+      continue;
+    }
+    emit(start, p - start, LITERAL);
+    emit(NULL, 0, var);
+    start = p = p + nameLen + 2;
+  }
+  emit(start, strlen(start), LITERAL);
+
+  if(out != NULL)
+    _literalLength = literal;
+  return segments;
+}
@@ -0,0 +1,64 @@
+#ifndef ASYNCWEBTEMPLATE_H_
+#define ASYNCWEBTEMPLATE_H_
+
+// Templates compiled once into literal spans & variable ids, so serving a page is a copy of its
+// spans & the current values into the send buffer rather than a search for placeholders every time
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include <initializer_list>
+
+#ifndef TEMPLATE_PLACEHOLDER
+#define TEMPLATE_PLACEHOLDER '%'
+#endif
+
+// Longest value a variable can render to; each response keeps one slot this size per variable
+#ifndef ASYNCWEBTEMPLATE_VALUE_LENGTH
+#define ASYNCWEBTEMPLATE_VALUE_LENGTH 48
+#endif
+
+// Writes variable `id`'s current value (at most maxLen chars, no NUL needed) & returns its length
+typedef std::function<size_t(uint8_t id, char *value, size_t maxLen)> AwsTemplateFiller;
+
+/*
+ * TEMPLATE :: The source cut into segments at its placeholders
+ *
+ * Variables are named up front & numbered in that order; %name% becomes that variable's id, %%
+ * a single %, and anything else (a lone %, an unknown name) is sent as written. The source isn't
+ * copied, so it has to outlive the template: a string literal or PROGMEM page is the usual case.
+ * */
+
+class AsyncWebTemplate {
+  public:
+    static const uint8_t LITERAL = 0xFF;
+    struct Segment {
+      const char *data; // literal bytes, or NULL for a variable
+      size_t len;
+      uint8_t var;      // variable id, or LITERAL
+    };
+
+  private:
+    Segment *_segments;
+    size_t _segmentCount;
+    size_t _literalLength;
+    uint8_t _variables;
+
+    size_t _compile(const char *source, const char * const *names, uint8_t count, Segment *out);
+
+  public:
+    AsyncWebTemplate(const char *source, std::initializer_list<const char*> names);
+    AsyncWebTemplate(const char *source, const char * const *names, uint8_t count);
+    ~AsyncWebTemplate();
+    AsyncWebTemplate(const AsyncWebTemplate&) = delete;
+    AsyncWebTemplate& operator=(const AsyncWebTemplate&) = delete;
+
+    bool valid() const { return _segments != NULL; }
+    size_t segments() const { return _segmentCount; }
+    const Segment &segment(size_t i) const { return _segments[i]; }
+    uint8_t variables() const { return _variables; }
+    // Bytes of the page that aren't variables
+    size_t literalLength() const { return _literalLength; }
+};
+
+#endif /* ASYNCWEBTEMPLATE_H_ */
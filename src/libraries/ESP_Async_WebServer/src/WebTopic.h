@@ -0,0 +1,132 @@
+#ifndef ASYNCWEBTOPIC_H_
+#define ASYNCWEBTOPIC_H_
+
+// Latest-value channels for status that changes faster than clients can take it: publishing
+// replaces the topic's value instead of queueing another message, and each client is sent the
+// newest value whenever it has nothing else in flight, skipping the ones it missed
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "AsyncWebSynchronization.h"
+#include "WebSharedBuffer.h"
+
+// Topics per WebSocket or EventSource handler; each client keeps a version per topic
+#ifndef ASYNCWEB_MAX_TOPICS
+#define ASYNCWEB_MAX_TOPICS 4
+#endif
+
+/*
+ * TOPIC :: The newest value, already formatted for the handler's clients, & its version
+ *
+ * The handler's subclass formats a value once per publish into a shared buffer that every
+ * client sending it holds a reference to, and wakes its clients. The lock only covers swapping &
+ * retaining that buffer, so publishers & the clients' tasks never wait on each other for long.
+ * */
+
+class AsyncWebTopic {
+  private:
+    AsyncWebLock _lock;
+    AsyncWebSharedBuffer *_value;
+    uint32_t _version;
+
+  protected:
+    virtual AsyncWebSharedBuffer *_format(const char *message, size_t len) = 0;
+    virtual void _notify() = 0;
+
+  public:
+    AsyncWebTopic(): _value(NULL), _version(0) {}
+    virtual ~AsyncWebTopic(){
+      if(_value != NULL)
+        _value->release();
+    }
+    AsyncWebTopic(const AsyncWebTopic&) = delete;
+    AsyncWebTopic& operator=(const AsyncWebTopic&) = delete;
+
+    // Replaces the value clients will be sent next; false if it couldn't be formatted
+    bool publish(const char *message, size_t len){
+      AsyncWebSharedBuffer *value = _format(message, len);
+      if(value == NULL)
+        return false;
+      {
+        AsyncWebLockGuard l(_lock);
+        AsyncWebSharedBuffer *old = _value;
+        _value = value;
+        _version++;
+        value = old;
+      }
+      if(value != NULL)
+        value->release();
+      _notify();
+      return true;
+    }
+    bool publish(const char *message){ return publish(message, strlen(message)); }
+    bool publish(const String &message){ return publish(message.c_str(), message.length()); }
+
+    // The value if it's newer than `version` (which is moved up to it), retained for the caller
+    AsyncWebSharedBuffer *_latest(uint32_t &version){
+      AsyncWebLockGuard l(_lock);
+      if(_value == NULL || version == _version)
+        return NULL;
+      version = _version;
+      _value->retain();
+      return _value;
+    }
+};
+
+// A handler's topics, which it owns
+class AsyncWebTopics {
+  private:
+    AsyncWebTopic *_topics[ASYNCWEB_MAX_TOPICS];
+    size_t _count;
+
+  public:
+    AsyncWebTopics(): _count(0) {}
+    ~AsyncWebTopics(){
+      for(size_t i = 0; i < _count; i++)
+        delete _topics[i];
+    }
+    AsyncWebTopics(const AsyncWebTopics&) = delete;
+    AsyncWebTopics& operator=(const AsyncWebTopics&) = delete;
+
+    // Takes ownership of topic; NULL (and topic deleted) if the handler already has the most it can
+    AsyncWebTopic *add(AsyncWebTopic *topic){
+      if(topic == NULL || _count == ASYNCWEB_MAX_TOPICS){
+        delete topic;
+        return NULL;
+      }
+      _topics[_count++] = topic;
+      return topic;
+    }
+    size_t count() const { return _count; }
+    AsyncWebTopic *get(size_t i) const { return _topics[i]; }
+};
+
+// One client's last-sent version of each of its handler's topics
+class AsyncWebTopicCursor {
+  private:
+    uint32_t _versions[ASYNCWEB_MAX_TOPICS];
+    uint8_t _next;
+
+  public:
+    AsyncWebTopicCursor(): _next(0) {
+      memset(_versions, 0, sizeof(_versions));
+    }
+
+    // The newest value of a topic the client is behind on, retained for the caller, or NULL if it's
+    // up to date. Topics take turns, so a busy one can't starve the rest.
+    AsyncWebSharedBuffer *next(const AsyncWebTopics &topics){
+      size_t count = topics.count();
+      for(size_t i = 0; i < count; i++){
+        size_t t = (_next + i) % count;
+        AsyncWebSharedBuffer *value = topics.get(t)->_latest(_versions[t]);
+        if(value != NULL){
+          _next = (t + 1) % count;
+          return value;
+        }
+      }
+      return NULL;
+    }
+};
+
+#endif /* ASYNCWEBTOPIC_H_ */
@@ -0,0 +1,255 @@
+#!/usr/bin/env python3
+"""
+Load-tests the resistor cutter's web server with concurrent clients & reports throughput and latency.
+
+Usage:
+    http_bench.py [--host 4.3.2.1] [--port 80] [--clients 8] [--requests 50] [--keep-alive] [--probes] [path ...]
+    http_bench.py --fuzz 500 [--seed 1]
+
+Connect to the cutter's WiFi AP first. Each client cycles through the given paths (default: / and
+/generate_204). By default it asks the server to close after every response & opens a new
+connection per request. With --keep-alive it sends its requests one after another on a persistent
+connection, reading each response to its Content-Length or last chunk, and only reconnects when the
+server closes; the connections opened are counted, so the two modes show what setup costs.
+Compare runs with different async_tcp_set_workers() settings to see the effect of extra workers;
+AsyncTCP's event pool & coalescing counters (/api/async-tcp) and the web server's request arena &
+heap counters (/api/web) are printed before and after.
+
+--probes replays the captive-portal checks phones & laptops send on joining the AP, byte for byte,
+instead of the paths; they're most of what the request parser sees in the field.
+--fuzz sends N mangled probes (split at random points, truncated, bytes flipped, headers repeated
+or oversized) one at a time, checking after each that the server still answers a clean request.
+"""
+
+import argparse
+import asyncio
+import json
+import random
+import time
+
+
+# Connectivity checks as captured from each OS joining the AP
+PROBES = {
+    "android": b"GET /generate_204 HTTP/1.1\r\nUser-Agent: Dalvik/2.1.0 (Linux; U; Android 13; Pixel 6 Build/TQ3A.230805.001)\r\n"
+               b"Host: connectivitycheck.gstatic.com\r\nConnection: Keep-Alive\r\nAccept-Encoding: gzip\r\n\r\n",
+    "apple": b"GET /hotspot-detect.html HTTP/1.0\r\nHost: captive.apple.com\r\nConnection: close\r\n"
+             b"User-Agent: CaptiveNetworkSupport-481.100.1 wispr\r\n\r\n",
+    "windows": b"GET /connecttest.txt HTTP/1.1\r\nConnection: Close\r\nUser-Agent: Microsoft NCSI\r\n"
+               b"Host: www.msftconnecttest.com\r\n\r\n",
+    "windows-ncsi": b"GET /ncsi.txt HTTP/1.1\r\nConnection: Close\r\nUser-Agent: Microsoft NCSI\r\nHost: www.msftncsi.com\r\n\r\n",
+    "firefox": b"GET /canonical.html HTTP/1.1\r\nHost: detectportal.firefox.com\r\n"
+               b"User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:128.0) Gecko/20100101 Firefox/128.0\r\n"
+               b"Accept: */*\r\nAccept-Language: en-US,en;q=0.5\r\nAccept-Encoding: gzip, deflate\r\n"
+               b"Cache-Control: no-cache\r\nPragma: no-cache\r\nConnection: close\r\n\r\n",
+}
+
+
+def get(host, path, keep_alive=False):
+    connection = "keep-alive" if keep_alive else "close"
+    return f"GET {path} HTTP/1.1\r\nHost: {host}\r\nConnection: {connection}\r\n\r\n".encode()
+
+
+async def fetch(host, port, request, timeout, pieces=1):
+    """Sends one request (in `pieces` writes) & returns (status code, bytes received)."""
+    reader, writer = await asyncio.wait_for(asyncio.open_connection(host, port), timeout)
+    try:
+        cuts = sorted(random.sample(range(1, len(request)), min(pieces, len(request)) - 1))
+        for a, b in zip([0] + cuts, cuts + [len(request)]):
+            writer.write(request[a:b])
+            await writer.drain()
+            if b < len(request):
+                await asyncio.sleep(0.01)  # so each piece arrives in its own segment
+        data = await asyncio.wait_for(reader.read(), timeout)
+    finally:
+        writer.close()
+
+    status = data.split(b" ", 2)[1] if data.startswith(b"HTTP/") else b"0"
+    return int(status), len(data)
+
+
+async def read_response(reader, timeout):
+    """Reads one response off a connection; returns (status code, bytes received, whether it stays open)."""
+    head = await asyncio.wait_for(reader.readuntil(b"\r\n\r\n"), timeout)
+    lines = head.decode("latin-1").split("\r\n")
+    status = int(lines[0].split(" ", 2)[1]) if lines[0].startswith("HTTP/") else 0
+    headers = {}
+    for line in lines[1:]:
+        name, _, value = line.partition(":")
+        headers[name.strip().lower()] = value.strip().lower()
+
+    received = len(head)
+    if headers.get("transfer-encoding") == "chunked":
+        while True:
+            size_line = await asyncio.wait_for(reader.readuntil(b"\r\n"), timeout)
+            size = int(size_line.split(b";")[0], 16)
+            chunk = await asyncio.wait_for(reader.readexactly(size + 2), timeout)  # data & its CRLF
+            received += len(size_line) + len(chunk)
+            if size == 0:
+                break
+    elif "content-length" in headers:
+        body = await asyncio.wait_for(reader.readexactly(int(headers["content-length"])), timeout)
+        received += len(body)
+    else:
+        return status, received, False  # the body runs to the close
+
+    keep = lines[0].startswith("HTTP/1.1") and headers.get("connection") != "close"
+    return status, received, keep
+
+
+async def keep_alive_client(args, requests, latencies, errors, connections):
+    """Like client(), but sends each request on the connection the last one left open."""
+    reader = writer = None
+    for i in range(args.requests):
+        name, request = requests[i % len(requests)]
+        start = time.perf_counter()
+        try:
+            if writer is None:
+                reader, writer = await asyncio.wait_for(asyncio.open_connection(args.host, args.port), args.timeout)
+                connections.append(name)
+            writer.write(request)
+            await writer.drain()
+            status, _, keep = await read_response(reader, args.timeout)
+            if status >= 500 or status == 0:
+                errors.append(f"{name}: HTTP {status}")
+            else:
+                latencies.append(time.perf_counter() - start)
+        except (OSError, asyncio.TimeoutError, asyncio.IncompleteReadError, asyncio.LimitOverrunError, ValueError) as e:
+            errors.append(f"{name}: {type(e).__name__}")
+            keep = False
+        if not keep:
+            writer.close()
+            writer = None
+    if writer is not None:
+        writer.close()
+
+
+async def client(args, requests, latencies, errors):
+    for i in range(args.requests):
+        name, request = requests[i % len(requests)]
+        start = time.perf_counter()
+        try:
+            status, _ = await fetch(args.host, args.port, request, args.timeout)
+            if status >= 500 or status == 0:
+                errors.append(f"{name}: HTTP {status}")
+            else:
+                latencies.append(time.perf_counter() - start)
+        except (OSError, asyncio.TimeoutError) as e:
+            errors.append(f"{name}: {type(e).__name__}")
+
+
+def mangle(rng, request):
+    """Returns (description, request, pieces) for one randomly damaged copy of `request`."""
+    head = request[:-2]  # keeps the final CRLF off so headers can be appended
+    kind = rng.choice(("split", "truncate", "flip", "repeat", "oversize", "bare-lf"))
+    if kind == "split":
+        return kind, request, rng.randint(2, 8)
+    if kind == "truncate":
+        return kind, request[:rng.randrange(1, len(request))], 1
+    if kind == "flip":
+        data = bytearray(request)
+        for _ in range(rng.randint(1, 4)):
+            data[rng.randrange(len(data))] = rng.randrange(256)
+        return kind, bytes(data), 1
+    if kind == "repeat":
+        return kind, head + b"Host: a\r\n" * rng.randint(2, 40) + b"\r\n", rng.randint(1, 4)
+    if kind == "oversize":
+        return kind, head + b"X-Pad: " + b"a" * rng.randint(900, 3000) + b"\r\n\r\n", rng.randint(1, 4)
+    return kind, request.replace(b"\r\n", b"\n"), 1
+
+
+async def fuzz(args):
+    """Sends --fuzz mangled probes & checks the server answers a clean one after each."""
+    rng = random.Random(args.seed)
+    random.seed(args.seed)  # fetch() picks split points from the module generator
+    probes = list(PROBES.values())
+    failures = 0
+    for i in range(args.fuzz):
+        kind, request, pieces = mangle(rng, rng.choice(probes))
+        try:
+            # Truncated & corrupted heads may get no answer at all; only the follow-up must succeed
+            await fetch(args.host, args.port, request, min(args.timeout, 3.0), pieces)
+        except (OSError, asyncio.TimeoutError):
+            pass
+        try:
+            status, _ = await fetch(args.host, args.port, get(args.host, "/generate_204"), args.timeout)
+        except (OSError, asyncio.TimeoutError) as e:
+            status = type(e).__name__
+        if status not in (200, 204, 302):
+            failures += 1
+            print(f"#{i} after {kind} {request[:60]!r}...: {status}")
+    print(f"{args.fuzz} mangled requests, {failures} failed follow-ups")
+
+
+STATS_PATHS = ("/api/async-tcp", "/api/web")
+
+
+async def stats(args, path):
+    """Returns the JSON counters served at `path`, or None if they aren't available."""
+    try:
+        reader, writer = await asyncio.wait_for(asyncio.open_connection(args.host, args.port), args.timeout)
+        writer.write(f"GET {path} HTTP/1.1\r\nHost: {args.host}\r\nConnection: close\r\n\r\n".encode())
+        await writer.drain()
+        data = await asyncio.wait_for(reader.read(), args.timeout)
+        writer.close()
+        return json.loads(data.split(b"\r\n\r\n", 1)[1])
+    except (OSError, asyncio.TimeoutError, ValueError, IndexError):
+        return None
+
+
+def percentile(sorted_values, fraction):
+    return sorted_values[min(len(sorted_values) - 1, int(len(sorted_values) * fraction))]
+
+
+async def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("--host", default="4.3.2.1")
+    parser.add_argument("--port", type=int, default=80)
+    parser.add_argument("--clients", type=int, default=8, help="concurrent clients")
+    parser.add_argument("--requests", type=int, default=50, help="requests per client")
+    parser.add_argument("--timeout", type=float, default=10.0, help="seconds before a request fails")
+    parser.add_argument("--keep-alive", action="store_true", help="send each client's requests on one persistent connection")
+    parser.add_argument("--probes", action="store_true", help="replay recorded captive-portal checks instead of paths")
+    parser.add_argument("--fuzz", type=int, default=0, metavar="N", help="send N mangled requests instead of benchmarking")
+    parser.add_argument("--seed", type=int, default=1, help="random seed for --fuzz")
+    parser.add_argument("paths", nargs="*", default=["/", "/generate_204"])
+    args = parser.parse_args()
+
+    if args.fuzz:
+        await fuzz(args)
+        return
+
+    if args.probes:
+        requests = list(PROBES.items())
+    else:
+        requests = [(path, get(args.host, path, args.keep_alive)) for path in args.paths]
+
+    before = [await stats(args, path) for path in STATS_PATHS]
+
+    latencies, errors, connections = [], [], []
+    start = time.perf_counter()
+    if args.keep_alive:
+        await asyncio.gather(*(keep_alive_client(args, requests, latencies, errors, connections) for _ in range(args.clients)))
+    else:
+        await asyncio.gather(*(client(args, requests, latencies, errors) for _ in range(args.clients)))
+    elapsed = time.perf_counter() - start
+
+    after = [await stats(args, path) for path in STATS_PATHS]
+
+    print(f"{args.clients} clients x {args.requests} requests in {elapsed:.2f}s: "
+          f"{len(latencies) / elapsed:.1f} req/s, {len(errors)} errors")
+    if args.keep_alive:
+        print(f"{len(connections)} connections opened for {args.clients * args.requests} requests")
+    if latencies:
+        latencies.sort()
+        print("latency ms: p50 {:.1f}  p90 {:.1f}  p99 {:.1f}  max {:.1f}".format(
+            *(1000 * percentile(latencies, f) for f in (0.5, 0.9, 0.99)), 1000 * latencies[-1]))
+    for error in sorted(set(errors)):
+        print(f"  {errors.count(error)} x {error}")
+    for path, b, a in zip(STATS_PATHS, before, after):
+        if b and a:
+            print(f"{path} before:", json.dumps(b))
+            print(f"{path} after: ", json.dumps(a))
+
+
+if __name__ == "__main__":
+    asyncio.run(main())
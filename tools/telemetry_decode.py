@@ -0,0 +1,127 @@
+#!/usr/bin/env python3
+"""
+Decodes the binary telemetry stream from the resistor cutter (see src/ResistorCutter/Telemetry.h)
+into CSV or JSON lines.
+
+Usage:
+    telemetry_decode.py [--json] [--port /dev/ttyUSB0 [--baud 115200]] [capture.bin]
+
+Reads a raw capture file, stdin, or (with --port, requires pyserial) a live serial port.
+Text printed by the serial console shares the port; it's skipped automatically.
+"""
+
+import argparse
+import json
+import struct
+import sys
+
+# Keep in sync with TelemetryEvent in Telemetry.h
+EVENTS = {
+    0: ("boot", ()),
+    1: ("dropped", (None, "count", None)),
+    2: ("state_change", ("state", "r_per_kit", "kits")),
+    3: ("pause", ("paused", "prev_state", None)),
+    4: ("progress", ("percent", None, None)),
+    5: ("job_done", ("finished", None, None)),
+    6: ("page_served", ("page", "params", None)),
+    7: ("redirect", (None, "client_ip", "url_length")),
+}
+
+RECORD = struct.Struct("<IBBHii")
+PAYLOAD_LEN = RECORD.size + 1       # record + crc8
+FRAME_LEN = PAYLOAD_LEN + 1         # COBS adds one byte for payloads shorter than 254 bytes
+
+
+def crc8(data):
+    crc = 0
+    for byte in data:
+        crc ^= byte
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x07) & 0xFF if crc & 0x80 else (crc << 1) & 0xFF
+    return crc
+
+
+def cobs_decode(data):
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        code = data[i]
+        if code == 0 or i + code > len(data) + 1:
+            return None
+        out += data[i + 1:i + code]
+        i += code
+        if code < 0xFF and i < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+def decode_frame(chunk):
+    """Returns a dict for a valid frame, or None. Console text may precede a frame, so only the tail is used."""
+    if len(chunk) < FRAME_LEN:
+        return None
+    payload = cobs_decode(chunk[-FRAME_LEN:])
+    if payload is None or len(payload) != PAYLOAD_LEN or crc8(payload[:-1]) != payload[-1]:
+        return None
+
+    timestamp, event, seq, a0, a1, a2 = RECORD.unpack(payload[:-1])
+    name, arg_names = EVENTS.get(event, ("event_%d" % event, ("a0", "a1", "a2")))
+    fields = {"timestamp_us": timestamp, "seq": seq, "event": name}
+    for arg_name, value in zip(arg_names, (a0, a1, a2)):
+        if arg_name == "client_ip":
+            value = ".".join(str((value >> shift) & 0xFF) for shift in (0, 8, 16, 24))
+        if arg_name:
+            fields[arg_name] = value
+    return fields
+
+
+def frames(stream):
+    buffer = bytearray()
+    while True:
+        data = stream.read(256) if not hasattr(stream, "in_waiting") else stream.read(max(1, stream.in_waiting))
+        if not data:
+            return
+        buffer += data
+        while True:
+            end = buffer.find(b"\x00")
+            if end < 0:
+                break
+            frame = decode_frame(bytes(buffer[:end]))
+            del buffer[:end + 1]
+            if frame:
+                yield frame
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("capture", nargs="?", help="raw capture file (default: stdin)")
+    parser.add_argument("--json", action="store_true", help="print JSON lines instead of CSV")
+    parser.add_argument("--port", help="read from a serial port instead of a file")
+    parser.add_argument("--baud", type=int, default=115200)
+    args = parser.parse_args()
+
+    if args.port:
+        import serial
+        stream = serial.Serial(args.port, args.baud)
+    elif args.capture:
+        stream = open(args.capture, "rb")
+    else:
+        stream = sys.stdin.buffer
+
+    last_seq = None
+    if not args.json:
+        print("timestamp_us,seq,event,args")
+    for frame in frames(stream):
+        if last_seq is not None and frame["seq"] != (last_seq + 1) & 0xFF:
+            print("# %d frame(s) lost on the wire" % ((frame["seq"] - last_seq - 1) & 0xFF), file=sys.stderr)
+        last_seq = frame["seq"]
+
+        if args.json:
+            print(json.dumps(frame))
+        else:
+            extra = ";".join("%s=%s" % (k, v) for k, v in frame.items() if k not in ("timestamp_us", "seq", "event"))
+            print("%d,%d,%s,%s" % (frame["timestamp_us"], frame["seq"], frame["event"], extra))
+        sys.stdout.flush()
+
+
+if __name__ == "__main__":
+    main()